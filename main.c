@@ -5,22 +5,658 @@
 #include <stdlib.h>  // exit, strtod, atoi
 #include <math.h>    // sqrt, fabs, sin, M_PI
 #include <string.h>  // strlen, strchr, strcspn
+#include <stdint.h>  // uint8_t, uint16_t (packed ADC data)
+#include <pthread.h> // worker threads for parallel loops
+#include <unistd.h>  // sysconf
+#include <time.h>    // clock_gettime (batch timing)
+#include <stdatomic.h>  // lock-free ring buffer (live acquisition)
+#include <fcntl.h>   // open (FIFOs / growing files)
+#include <poll.h>    // poll (live reader)
+#include <errno.h>   // errno, EINTR
+#include <sys/stat.h>  // stat (capture index up to date?)
+#include <sys/mman.h>  // mmap (session snapshots)
 
 // ---------- Constants ----------
-#define MAX_SAMPLES 1000
+#define MAX_SAMPLES 1000            // limit for typed / generated samples
+#define SAMPLE_BUF_SIZE (1 << 24)   // capacity for samples loaded from files
 #define INPUT_BUF   100   // for safe input lines
+#define BATCH_BLOCK 4096  // rows processed per block in batch modes
+#define ADC_MAX     4095  // 12-bit ADC full scale
+#define ADC_BLOCK_PAIRS 65536  // packed 12-bit sample pairs per block
+
+#define CAL_MAX_COEFFS 8       // polynomial calibration terms
+#define CAL_MAX_POINTS 256     // tabulated calibration points
+#define CAL_LUT_MAX    65537   // LUT nodes (one per code for a 16-bit ADC)
+
+#define CAL_POLY      1
+#define CAL_STEINHART 2
+#define CAL_TABLE     3
+
+#define UNIT_TEXT     16       // longest unit name accepted
+
+#define MAX_THREADS    64      // upper limit for worker threads
+#define SUM_BLOCK      4096    // samples per block in accurate_sum
+#define SUM_LANES      8       // independent accumulators per block
+
+#define RC_MAX_STAGES  8       // stages in a swept RC network
+#define SWEEP_MAX_POINTS 2000000
+
+#define ESERIES_MAX    (192 * 8)   // values in an E-series table over 8 decades
+#define ESERIES_TOP    10          // best R/C choices listed
+
+#define MC_MAX_PARTS   20      // components in a Monte Carlo run
+#define MC_STREAM      65536   // trials per PRNG stream (fixed, not per thread)
+#define MC_CHUNK       1024    // trials generated per inner batch
+#define MC_BINS        65536   // fine histogram for percentiles
+
+#define SNAP_CHUNK     4096    // samples per shared snapshot chunk
+#define SNAP_HISTORY   32      // undo / redo levels kept
+#define SNAP_NAMED     16      // named versions kept
+#define SNAP_NAME      32
+
+#define LIVE_RING      (1 << 16)   // samples in the live ring (power of two)
+#define LIVE_BLOCK     4096        // samples moved per push / pop
+#define LIVE_READ      65536       // bytes read from the source at a time
+
+#define WFC_BLOCK      4096        // samples per compressed block
+#define WFC_MAX_PAYLOAD (WFC_BLOCK * 8 + 8)   // packed block plus read padding
+
+#define PYR_BASE       1024        // samples per level-0 summary node
+#define PYR_FANOUT     16          // nodes combined per level above
+#define PYR_MAX_LEVELS 16
+#define PYR_OVERVIEW_WIDTH 72      // columns in the overview waveform
+
+#define ROI_BLOCK      64          // samples per block in the region min/max table
+#define ROI_MAX_LEVELS 20
+
+#define TONE_MAX       64          // frequencies in one Goertzel bank
+
+#define CORR_DIRECT_MAX 64         // kernels up to this length skip the FFT
+
+#define SKIP_LEVELS    24          // running-median skiplist levels (windows to 2^24)
+
+#define HIST_MAX_BINS  1000        // bins in an amplitude histogram
+#define HIST_BAR       40          // widest histogram bar, in characters
+#define PCT_MAX        32          // percentiles asked for at once
+#define STREAM_QUANTILES 5         // P-squared estimators in stream statistics
+
+#define FRAME_MAX_LEN  (1 << 20)   // samples in one classified frame
+#define FRAME_MAX_RULES 16
+#define FRAME_MAX_CONDS 4          // conditions joined by "and" in one rule
+#define FRAME_LABEL    16
+#define FRAME_FALLBACK "mixed"     // label when no rule matches
+#define FRAME_TIMELINE_WIDTH 72
+#define FRAME_MAX_RUNS 40          // label runs listed under the timeline
+
+// frame features (menu 37), in CSV column order
+#define FEAT_DC       0
+#define FEAT_RMS      1
+#define FEAT_CREST    2
+#define FEAT_ZCR      3
+#define FEAT_PEAKS    4
+#define FEAT_CENTROID 5
+#define FEAT_DCRATIO  6
+#define FEAT_P2P      7
+#define FEAT_COUNT    8
+
+// rule comparisons
+#define CMP_LT 0
+#define CMP_LE 1
+#define CMP_GT 2
+#define CMP_GE 3
+#define CMP_EQ 4
+
+// envelope columns (menu 38), in CSV order after the time
+#define ENV_DC      0
+#define ENV_RMS     1
+#define ENV_MIN     2
+#define ENV_MAX     3
+#define ENV_PEAK    4
+#define ENV_CREST   5
+#define ENV_COLUMNS 6
+
+// trigger types (menu 40)
+#define TRIG_RISING  1
+#define TRIG_FALLING 2
+#define TRIG_LEVEL   3
+#define TRIG_WINDOW  4
+#define TRIG_PULSE   5
+#define TRIG_BLOCK   64            // samples tested together before looking closer
+#define TRIG_MAX_EVENTS 1000000
+#define TRIG_LIST    20            // events shown in the on-screen list
+
+#define SESS_FORMAT  2             // session file layout version
+#define SESS_ALIGN   4096          // sections start on page boundaries
+#define SESS_MAX_SECTIONS 128
+#define SESS_SAMPLES   1           // section types
+#define SESS_REFERENCE 2
+#define SESS_NAMED     3
+#define SESS_ROI_SUM   4
+#define SESS_ROI_SUMSQ 5
+#define SESS_ROI_MIN   6
+#define SESS_ROI_MAX   7
+#define SESS_ENVELOPE  8
+#define SESS_EVENTS    9
+#define SESS_TRIGGER   10
+#define SESS_RULES     11
+#define SESS_AUTOSAVE  "session.wfs"
+
+#define EXPR_TEXT      200     // longest formula accepted
+#define EXPR_MAX_CODE  128     // instructions in a compiled formula
+#define EXPR_MAX_STACK 32      // evaluation stack depth
+#define EXPR_BLOCK     256     // samples evaluated per block
+
+// formula instructions (stack machine)
+#define OP_CONST  0
+#define OP_X      1
+#define OP_INDEX  2
+#define OP_ADD    3
+#define OP_SUB    4
+#define OP_MUL    5
+#define OP_DIV    6
+#define OP_POW    7
+#define OP_NEG    8
+#define OP_MIN    9
+#define OP_MAX    10
+#define OP_ABS    11
+#define OP_SQRT   12
+#define OP_SIN    13
+#define OP_COS    14
+#define OP_TAN    15
+#define OP_EXP    16
+#define OP_LOG    17
+#define OP_LOG10  18
 
 #ifndef M_PI
 #define M_PI 3.14159265358979323846
 #endif
 
+// ---------- Types ----------
+
+// sensor calibration curve (menu 24), evaluated in volts
+typedef struct {
+    int    type;                      // CAL_POLY, CAL_STEINHART or CAL_TABLE
+    char   unit[16];
+    double vref;
+    int    bits;
+    double coeffs[CAL_MAX_COEFFS];    // y = c0 + c1*V + c2*V^2 + ...
+    int    nCoeffs;
+    double shA, shB, shC;             // 1/T = A + B*ln(R) + C*ln(R)^3
+    double rFixed, vSupply;           // thermistor to ground, rFixed to vSupply
+    double vMin, vMax;                // calibrated input range
+    double ptV[CAL_MAX_POINTS];       // tabulated points, V ascending
+    double ptY[CAL_MAX_POINTS];
+    int    nPoints;
+} CalCurve;
+
+// calibration curve compiled to a uniform table over ADC codes
+typedef struct {
+    double table[CAL_LUT_MAX + 3];    // guard node before, two after
+    int    nodes;
+    double codesPerNode;
+    double minCode, maxCode;          // codes covered (inputs are clamped)
+    int    cubic;                     // 0 = linear, 1 = Catmull-Rom
+    double maxError;                  // worst case over every ADC code
+    int    maxErrorCode;
+} CalLut;
+
+// complex number (frequency response, FFT)
+typedef struct {
+    double re, im;
+} Cplx;
+
+// body of a parallel loop: handles items [start, end)
+typedef void (*RangeFn)(void *ctx, long start, long end);
+
+// RC network swept by menu 20 option 4
+typedef struct {
+    int    nStages;
+    int    type[RC_MAX_STAGES];       // 1 = low-pass, 2 = high-pass
+    double R[RC_MAX_STAGES];
+    double C[RC_MAX_STAGES];
+    int    loaded;                    // 1 = passive ladder, 0 = buffered stages
+    double f1, f2;                    // sweep range (Hz)
+    long   points;
+    double *freq, *magDb, *phaseDeg;  // results
+} RcSweep;
+
+// one way of building an R/C pair from standard parts (menu 20 option 5)
+typedef struct {
+    double r1, r2;                    // r2 = 0 for a single resistor
+    int    rMode;                     // 0 single, 1 series, 2 parallel
+    double c1, c2;
+    int    cMode;
+    double fc;
+    double errPct;
+} RcChoice;
+
+// Monte Carlo tolerance run (menu 27)
+typedef struct {
+    int    circuit;                   // 1 series R, 2 parallel R, 3 RC cut-off
+    int    nParts;
+    double nominal[MC_MAX_PARTS];
+    double tol[MC_MAX_PARTS];         // fractional, e.g. 0.05
+    int    gaussian;                  // 0 uniform, 1 Gaussian (tol = 3 sigma)
+    long   trials;
+    unsigned long long seed;
+    double lo, hi;                    // result range covered by the histogram
+    long   *hist;                     // MC_BINS counts (merged)
+    double *streamSum, *streamSumSq;  // per-stream partial sums
+    double *streamMin, *streamMax;
+    int    failed;                    // a worker ran out of memory
+    pthread_mutex_t lock;
+} McRun;
+
+// session file mapped by menu 42; caches that point into it hold a
+// reference and the last one to let go unmaps it
+typedef struct {
+    void   *base;
+    size_t size;
+    int    refs;
+} SessionMap;
+
+// piece of a snapshot; identical chunks are shared between versions
+typedef struct {
+    int    refs;
+    int    len;
+    int    mark;                      // used while counting memory
+    SessionMap *map;                  // data lies in a restored session file
+    double *data;                     // store, or inside map
+    double store[];
+} SnapChunk;
+
+// saved copy of samples[] made of shared chunks (menu 28)
+typedef struct SnapVersion {
+    int    refs;
+    char   name[SNAP_NAME];           // what the version holds / why it was saved
+    int    count;
+    int    nChunks;
+    SnapChunk **chunks;
+    struct SnapVersion *ref;          // reference buffer too, if the change
+                                      // touched it (menu 35 swap), else NULL
+} SnapVersion;
+
+// single-producer / single-consumer ring of samples (menu 29)
+typedef struct {
+    double *data;
+    size_t mask;                      // capacity - 1 (capacity is a power of two)
+    _Atomic size_t head;              // next slot to write, owned by the reader
+    char   pad[64];                   // keep head and tail on separate cache lines
+    _Atomic size_t tail;              // next slot to read, owned by the analyser
+} SpscRing;
+
+// live acquisition shared between the reader thread and the analyser
+typedef struct {
+    SpscRing ring;
+    int    fd;
+    int    binary;                    // 0 text numbers, 1 raw doubles
+    int    follow;                    // keep polling at end of file
+    int    block;                     // 1 = wait when the ring is full, 0 = drop
+    atomic_int  stop;                 // set by the analyser
+    atomic_int  done;                 // set by the reader at end of input
+    atomic_long received;             // samples parsed from the source
+    atomic_long dropped;              // samples lost because the ring was full
+    atomic_long stalls;               // times the reader had to wait for space
+    atomic_long badTokens;            // text that was not a number
+    int    readError;
+} LiveRun;
+
+// statistics over one refresh interval of live data
+typedef struct {
+    long   n;
+    double min, max, sum, sumSq;
+    long   crossings;
+    double last;                      // previous sample, carried between blocks
+    int    haveLast;
+} LiveStats;
+
+// double-buffered reader: a background thread fills one buffer while the
+// caller analyses the other (menu 30)
+typedef struct {
+    int    fd;
+    int    seekable;                  // 1 = pread at offsets, 0 = read (pipes)
+    int    threaded;                  // 0 = read in the caller (no overlap)
+    off_t  offset;
+    size_t blockBytes;
+    double *buf[2];
+    size_t len[2];                    // bytes held by each buffer
+    int    full[2];
+    int    next;                      // buffer the caller takes next
+    int    held;                      // buffer the caller is using, or -1
+    int    eof, error, stop;
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    pthread_t thread;
+    double waitSeconds;               // caller time spent waiting for data
+    long long bytes;
+} BlockReader;
+
+// compressed capture file (menu 31): header, then per block a WfcBlock
+// followed by its bit-packed payload. Native byte order, like the other
+// binary files this tool writes.
+typedef struct {
+    char     magic[4];                // "WFC1"
+    uint32_t blockSamples;            // WFC_BLOCK
+    uint32_t lossless;                // 1 = XOR of double bits, 0 = quantised deltas
+    uint32_t reserved;
+    double   step;                    // quantisation step (0 when lossless)
+    uint64_t count;                   // samples in the file
+    uint64_t nBlocks;
+} WfcHeader;
+
+typedef struct {
+    uint32_t n;                       // samples in this block
+    uint32_t payloadBytes;
+    uint8_t  bits;                    // width of each packed value
+    uint8_t  shift;                   // lossless: trailing zero bits removed
+    uint8_t  pad[6];
+    int64_t  first;                   // value the first delta / XOR refers to
+    double   min, max, sum, sumSq;    // of the decoded samples
+} WfcBlock;
+
+// min / max / sum / sum of squares over a run of samples
+typedef struct {
+    double min, max, sum, sumSq;
+} SummaryNode;
+
+// multi-level summary of a capture file (menu 32). Level 0 has one node
+// per PYR_BASE samples, each level above combines PYR_FANOUT nodes.
+typedef struct {
+    char   path[100];
+    int    fd;                        // capture kept open for edge reads
+    long long count;                  // samples in the capture
+    int    levels;
+    long long nodes[PYR_MAX_LEVELS];
+    SummaryNode *level[PYR_MAX_LEVELS];
+} Pyramid;
+
+// header of the index saved next to the capture as <capture>.pyr
+typedef struct {
+    char     magic[4];                // "PYR1"
+    uint32_t base, fanout, levels;
+    uint64_t count;
+    int64_t  fileSize, fileTime;      // capture size and mtime when built
+} PyrFileHeader;
+
+// range index over samples[] (menu 33), built on first use and rebuilt
+// when sampleGeneration moves on
+typedef struct {
+    int    built;
+    unsigned long generation;         // sampleGeneration it was built for
+    int    n;
+    int    nBlocks, levels, sumLevels;
+    double *blockMin[ROI_MAX_LEVELS]; // sparse table over ROI_BLOCK-sample blocks:
+    double *blockMax[ROI_MAX_LEVELS]; // level k covers 2^k blocks from each index
+    double *blockSum[ROI_MAX_LEVELS]; // level 0: block totals; level h + 1: within
+    double *blockSumSq[ROI_MAX_LEVELS]; // each run of 2^(h+1) blocks, sums outwards
+                                      // from its middle (disjoint sparse table)
+    SessionMap *map;                  // tables lie in a restored session file
+} RoiIndex;
+
+// Goertzel tone-detector bank (menu 34): one resonator per target
+// frequency, all updated in the same pass over the samples
+typedef struct {
+    int    nTones;
+    double fs;
+    double freq[TONE_MAX];
+    double coeff[TONE_MAX];           // 2 cos(w)
+    double cosw[TONE_MAX], sinw[TONE_MAX];
+    double s1[TONE_MAX], s2[TONE_MAX];   // resonator state
+    long long n;                      // samples processed
+    double sumSq;                     // for each tone's share of the power
+} ToneBank;
+
+// result of cross-correlating the sample buffer with the reference (menu 35)
+typedef struct {
+    long   lag;                       // reference best matches samples[lag ...]
+    double subLag;                    // lag refined by a parabola through the peak
+    double peak;                      // correlation at lag (means removed)
+    double coeff;                     // normalised coefficient over the overlap
+    int    usedFft;
+} XcorrResult;
+
+// P-squared streaming estimate of one quantile (menu 30 streaming
+// statistics): five markers, no samples stored
+typedef struct {
+    double p;                         // quantile wanted, 0..1
+    double q[5];                      // marker heights
+    double pos[5];                    // marker positions
+    double want[5];                   // desired positions
+    double inc[5];                    // desired position step per sample
+    long long count;
+} P2Quantile;
+
+// one classification rule (menu 37): label when every condition holds
+typedef struct {
+    char label[FRAME_LABEL];
+    int nConds;
+    int feature[FRAME_MAX_CONDS];     // FEAT_*
+    int op[FRAME_MAX_CONDS];          // CMP_*
+    double value[FRAME_MAX_CONDS];
+} FrameRule;
+
+// frame feature extraction job, split across threads by frame
+typedef struct {
+    const double *x;
+    int frameLen;
+    int fftLen;                       // power of two >= frameLen
+    const Cplx *tw;
+    const double *window;             // Hann window, frameLen values
+    double fs;
+    double peakLevel;
+    double *feats;                    // FEAT_COUNT values per frame
+    int *labels;                      // rule index per frame, ruleCount = no rule
+    int memError;
+} FrameTask;
+
+// per-window statistics of the sample buffer (menu 38)
+typedef struct {
+    SummaryNode *win;                 // one summary per window
+    long count;
+    int window, hop;                  // in samples
+    double fs;
+    unsigned long generation;         // sampleGeneration it was computed from
+    SessionMap *map;                  // win lies in a restored session file
+} Envelope;
+
+// rolling min / max over the last `window` samples (menu 39): two
+// monotonic deques kept in rings, so each sample costs O(1) amortised
+typedef struct {
+    long window;
+    long mask;                        // ring size - 1 (power of two >= window)
+    double *minVal, *maxVal;
+    long long *minIdx, *maxIdx;
+    long minHead, minCount;
+    long maxHead, maxCount;
+    long long next;                   // index given to the next sample
+} SlidingExtrema;
+
+// sorted window for the running median (menu 9): an indexable skiplist,
+// where each link also stores how many elements it jumps over, so the
+// k-th smallest is found in O(log w) like an insert or a removal
+typedef struct {
+    int next;                         // node index
+    int width;                        // elements passed by following it
+} SkipLink;
+
+typedef struct {
+    double *value;                    // [0] head, [1] end marker, then the pool
+    int *level;
+    SkipLink *link;                   // `levels` links per node
+    int levels;                       // enough for the capacity
+    int *freeList;
+    int freeCount;
+    int size;
+    uint32_t rng;
+} SkipList;
+
+// trigger settings (menu 40); positions are sample indexes
+typedef struct {
+    int type;                         // TRIG_*
+    double level;                     // edge, level and pulse triggers
+    double low, high;                 // window trigger
+    long minWidth, maxWidth;          // pulse trigger: outside this fires
+    long holdoff;                     // samples after an event with no new event
+    long pre, post;                   // window kept around each event
+} TriggerSpec;
+
+// a sample slot (menu 41): the sample buffer, the reference buffer or a
+// named version from menu 28
+typedef struct {
+    char name[SNAP_NAME];
+    long count;
+    const double *flat;               // buffer or reference
+    const SnapVersion *version;       // or a chunked named version
+} SlotView;
+
+// partial sums for comparing two slots over one block
+typedef struct {
+    double sumD2;                     // sum of (a - b)^2
+    double maxAbs;                    // largest |a - b|
+    double sa, sb, saa, sbb, sab;     // sums of the shifted a and b
+} CompareSums;
+
+typedef struct {
+    const SlotView *a, *b;
+    long n;
+    double shiftA, shiftB;
+    CompareSums *partials;            // one per SNAP_CHUNK block
+} CompareTask;
+
+// session snapshot file (menu 42): header, a fixed section table, then
+// each section's data at a page-aligned offset in native layout, so any
+// section can be mapped and used where it lies
+typedef struct {
+    char     magic[8];                // "WFSESS1"
+    uint32_t version;
+    uint32_t sections;
+    uint64_t fileSize;
+} SessionHeader;
+
+typedef struct {
+    uint32_t type;                    // SESS_*
+    uint32_t current;                 // cached data matched the samples when saved
+    uint64_t offset;                  // from the start of the file
+    uint64_t bytes;
+    int64_t  count;                   // elements
+    int64_t  param[3];                // type specific (level, window, hop, ...)
+    double   value;                   // type specific (shift, sample rate)
+    char     name[48];
+} SessionSection;
+
+typedef struct {
+    FILE *fp;
+    SessionHeader head;
+    SessionSection table[SESS_MAX_SECTIONS];
+    uint64_t pos;                     // bytes written so far
+} SessionWriter;
+
+// formula compiled to stack-machine code (menu 26)
+typedef struct {
+    int    op;
+    double value;                     // OP_CONST only
+} ExprInstr;
+
+typedef struct {
+    ExprInstr code[EXPR_MAX_CODE];
+    int    length;
+    int    depth;                     // current stack depth while compiling
+    int    maxDepth;
+    const char *source;               // formula text (for error positions)
+    const char *text;                 // parser position while compiling
+    double mean, rms, min, max, n;    // buffer constants folded in
+    char   error[80];
+} ExprProgram;
+
+// ---------- Unit Tables ----------
+//
+// Fixed at compile time. A value in a unit is value * scale + offset in the
+// SI base unit of its dimension; only 'prefixable' units accept an SI prefix.
+
+static const char *const UNIT_DIMENSIONS[] = {
+    "voltage", "current", "resistance", "frequency", "length", "time",
+    "capacitance", "power", "mass", "temperature", "pressure"
+};
+
+static const struct {
+    const char *symbol;
+    double factor;
+} SI_PREFIXES[] = {
+    {"p", 1e-12}, {"n", 1e-9}, {"u", 1e-6}, {"m", 1e-3}, {"c", 1e-2},
+    {"k", 1e3},   {"M", 1e6},  {"G", 1e9}
+};
+
+static const struct {
+    const char *symbol;
+    int dimension;        // index into UNIT_DIMENSIONS
+    double scale;
+    double offset;
+    int prefixable;
+} UNITS[] = {
+    {"V",    0, 1.0,       0.0,     1},
+    {"A",    1, 1.0,       0.0,     1},
+    {"ohm",  2, 1.0,       0.0,     1},
+    {"Hz",   3, 1.0,       0.0,     1},
+    {"m",    4, 1.0,       0.0,     1},
+    {"in",   4, 0.0254,    0.0,     0},
+    {"ft",   4, 0.3048,    0.0,     0},
+    {"s",    5, 1.0,       0.0,     1},
+    {"min",  5, 60.0,      0.0,     0},
+    {"h",    5, 3600.0,    0.0,     0},
+    {"F",    6, 1.0,       0.0,     1},
+    {"W",    7, 1.0,       0.0,     1},
+    {"g",    8, 1e-3,      0.0,     1},
+    {"K",    9, 1.0,       0.0,     0},
+    {"degC", 9, 1.0,       273.15,  0},
+    {"degF", 9, 5.0 / 9.0, 255.3722222222222, 0},   // (F + 459.67) * 5/9
+    {"Pa",   10, 1.0,      0.0,     1},
+    {"bar",  10, 1e5,      0.0,     1},
+    {"psi",  10, 6894.757293168, 0.0, 0}
+};
+
 // ---------- Global Data ----------
-double samples[MAX_SAMPLES];
+double sampleStore[SAMPLE_BUF_SIZE];
+double *samples = sampleStore;   // or a restored session mapping (menu 42)
 int sampleCount = 0;
 int dataAvailable = 0;   // 0 = no data, 1 = data ready
+unsigned long sampleGeneration = 0;   // bumped whenever samples[] changes
 
 char signalType[40];     // description of the signal
 
+double *refSamples = NULL;   // reference waveform (menu 35), SAMPLE_BUF_SIZE once used
+int refCount = 0;
+
+CalCurve calCurve;       // loaded calibration curve (menu 24)
+CalLut   calLut;         // its compiled lookup table
+int calLoaded = 0;       // 1 once a curve is compiled
+
+SnapVersion *undoStack[SNAP_HISTORY];   // oldest first
+int undoCount = 0;
+SnapVersion *redoStack[SNAP_HISTORY];
+int redoCount = 0;
+SnapVersion *namedVersions[SNAP_NAMED];
+int namedCount = 0;
+SnapVersion *snapLatest = NULL;         // last version saved or restored
+
+Pyramid capturePyr;      // summary index of the open capture (menu 32)
+int pyrLoaded = 0;
+
+RoiIndex roiIndex;       // region index over samples[] (menu 33)
+FrameRule frameRules[FRAME_MAX_RULES];   // frame classification rules (menu 37)
+int frameRuleCount = -1;                 // -1 until the defaults are loaded
+const char *FEATURE_NAMES[FEAT_COUNT] = {
+    "dc", "rms", "crest", "zcr", "peaks", "centroid", "dcratio", "p2p"
+};
+Envelope envelope;       // last envelope series (menu 38)
+TriggerSpec trigSpec;    // last trigger scan (menu 40)
+long *trigEvents = NULL; // event positions, TRIG_MAX_EVENTS once used
+long trigCount = 0;
+unsigned long trigGeneration;
+int autosaveOn = 0;      // save the session when leaving (menu 42)
+int samplesMapped = 0;   // samples / refSamples are session_map_buffer() regions
+int refMapped = 0;
+char autosavePath[100] = SESS_AUTOSAVE;
+
 // ---------- Function Prototypes ----------
 
 // menu system
@@ -38,7 +674,7 @@ void menu_item_5(void);   // Crest factor
 void menu_item_6(void);   // Zero-crossings
 void menu_item_7(void);   // Save report to file
 void menu_item_8(void);   // Classify signal type
-void menu_item_9(void);   // Smooth waveform (moving average)
+void menu_item_9(void);   // Smooth waveform (moving average, median, Hampel)
 void menu_item_10(void);  // Detect peaks
 void menu_item_12(void);  // Generate test signal (sine wave)
 void menu_item_18(void);  // Signal frequency analyser
@@ -51,7 +687,30 @@ void menu_item_16(void);  // Quadratic Equation Solver
 void menu_item_17(void);  // Unit Converter with context
 void menu_item_19(void);  // Sensor data converter
 void menu_item_20(void);  // Filter design helper
+void menu_item_20_sweep(void);  // Frequency response sweep (menu 20 option 4)
+void menu_item_20_eseries(void);  // E-series R/C search (menu 20 option 5)
 void menu_item_21(void);  // AI-style assistant
+void menu_item_22(void);  // Batch quadratic solver (file)
+void menu_item_23(void);  // Packed 12-bit ADC dump decoder
+void menu_item_24(void);  // Calibration curve compiler (LUT)
+void menu_item_25(void);  // Batch unit conversion (columns)
+void menu_item_26(void);  // Formula transform (compiled expressions)
+void menu_item_27(void);  // Monte Carlo tolerance analysis
+void menu_item_28(void);  // Sample history (undo / redo / versions)
+void menu_item_29(void);  // Live acquisition (FIFO / pipe / growing file)
+void menu_item_30(void);  // Stream statistics from a large capture file
+void menu_item_31(void);  // Compressed capture files
+void menu_item_32(void);  // Capture summary index (range stats, overview)
+void menu_item_33(void);  // Region statistics (block tables)
+void menu_item_34(void);  // Tone detector (Goertzel bank)
+void menu_item_35(void);  // Reference buffer and cross-correlation
+void menu_item_36(void);  // Amplitude histogram and percentiles
+void menu_item_37(void);  // Frame features and classification
+void menu_item_38(void);  // Envelope series
+void menu_item_39(void);  // Rolling min / max / peak-to-peak
+void menu_item_40(void);  // Trigger and event extraction
+void menu_item_41(void);  // Compare sample slots
+void menu_item_42(void);  // Session snapshot
 
 // helper functions (analysis)
 double find_min(const double a[], int n);
@@ -60,8 +719,248 @@ double calc_average(const double a[], int n);
 double calc_rms(const double a[], int n);
 int    count_zero_crossings(const double a[], int n);
 int    detect_peaks(const double a[], int n);
-void   smooth_moving_average(double a[], int n, int windowSize);
+int    smooth_moving_average(double a[], int n, int windowSize);
 void   generate_sine_wave(double a[], int n, double amplitude, int periods);
+void   samples_changed(void);
+void   print_summary(const SummaryNode *r, long long n);
+
+// helper functions (maths)
+void   solve_quadratic_block(const double a[], const double b[], const double c[],
+                             double *restrict x1re, double *restrict x1im,
+                             double *restrict x2re, double *restrict x2im, int n);
+double elapsed_seconds(const struct timespec *start);
+
+// helper functions (sensor / ADC)
+double sensor_from_voltage(int sensor, double voltage);
+void   adc_linear_map(int sensor, double vref, double *scale, double *offset);
+void   unpack_adc12(const uint8_t *restrict in, int nPairs, uint16_t *restrict codes);
+void   adc_codes_to_units(const uint16_t *restrict codes, int n,
+                          double scale, double offset, double *restrict out);
+int    write_doubles(FILE *fp, const double a[], int n, int binary);
+
+// helper functions (calibration)
+int    cal_load_curve(const char *filename, CalCurve *cv);
+double cal_curve_eval(const CalCurve *cv, double volts);
+void   cal_compile(const CalCurve *cv, int nodes, int cubic, CalLut *lut);
+double cal_lookup(const CalLut *lut, double code);
+void   cal_apply(const CalLut *lut, const double in[], double out[], int n);
+
+// helper functions (units)
+int    unit_lookup(const char *text, double *scale, double *offset, int *dimension);
+int    unit_conversion(const char *from, const char *to, double *scale, double *offset);
+void   scale_offset_column(double a[], long rows, int stride, double scale, double offset);
+
+// helper functions (threads)
+int    worker_count(void);
+void   parallel_range(long n, long minChunk, RangeFn fn, void *ctx);
+void  *parallel_range_thread(void *arg);
+
+// helper functions (summation)
+double block_sum(const double *restrict a, long n, int squares);
+void   sum_blocks_range(void *ctx, long start, long end);
+double tree_sum(const double *partials, long lo, long hi,
+                const double a[], long n, int squares);
+double accurate_sum(const double a[], long n, int squares);
+
+// helper functions (frequency response)
+Cplx   cplx_make(double re, double im);
+Cplx   cplx_add(Cplx a, Cplx b);
+Cplx   cplx_mul(Cplx a, Cplx b);
+Cplx   cplx_div(Cplx a, Cplx b);
+void   rc_sweep_range(void *ctx, long start, long end);
+double interp_log_crossing(double f1, double y1, double f2, double y2, double level);
+double fit_slope_per_decade(const double freq[], const double magDb[], long from, long to);
+
+// helper functions (E-series)
+int    eseries_build(int series, double firstDecade, int decades, double out[]);
+int    nearest_index(const double t[], int n, double x);
+int    eseries_best(const double t[], int n, double x, int allowPairs,
+                    double *v1, double *v2, int *mode);
+double eseries_value(double v1, double v2, int mode);
+void   eseries_keep(RcChoice top[], int *count, const RcChoice *c);
+void   format_parts(double v1, double v2, int mode, const char *unit, char *buf, size_t sz);
+void   format_eng(double v, const char *unit, char *buf, size_t sz);
+
+// helper functions (Monte Carlo)
+unsigned long long splitmix64(unsigned long long *state);
+double xoshiro_uniform(unsigned long long s[4]);
+double mc_circuit_value(const McRun *run, const double parts[]);
+void   mc_range(void *ctx, long start, long end);
+double hist_percentile(const long hist[], int bins, double lo, double hi,
+                       long total, double p);
+
+// helper functions (snapshots)
+SnapVersion *snapshot_capture(const char *name);
+SnapVersion *snapshot_from_array(const char *name, const double x[], int count);
+void   snapshot_restore(SnapVersion *v);
+int    snapshot_restore_ref(const SnapVersion *v);
+void   snapshot_before_swap(const char *what);
+void   snapshot_release(SnapVersion *v);
+void   snapshot_set_latest(SnapVersion *v);
+void   snapshot_push(SnapVersion *stack[], int *count, SnapVersion *v);
+void   snapshot_before_change(const char *what);
+void   snapshot_memory(long *logicalBytes, long *storedBytes);
+
+// helper functions (live acquisition)
+int    spsc_init(SpscRing *r, size_t capacity);
+size_t spsc_push(SpscRing *r, const double *src, size_t n);
+size_t spsc_pop(SpscRing *r, double *dst, size_t max);
+size_t spsc_fill(SpscRing *r);
+void   pause_microseconds(long us);
+void   live_stats_reset(LiveStats *s);
+void   live_stats_add(LiveStats *s, const double *x, long n);
+void   live_stats_merge(LiveStats *total, const LiveStats *part);
+void   live_publish(LiveRun *run, const double *x, size_t n);
+int    live_is_separator(char c);
+size_t live_parse_text(LiveRun *run, char *text, size_t have, int final);
+void  *live_reader_thread(void *arg);
+void   live_print_stats(double t, const LiveStats *s, double seconds, size_t fill,
+                        size_t capacity, long dropped, long stalls);
+
+// helper functions (block reader)
+size_t block_reader_fill(BlockReader *r, double *buf);
+void  *block_reader_thread(void *arg);
+int    block_reader_open(BlockReader *r, const char *path, size_t blockBytes, int threaded);
+long   block_reader_next(BlockReader *r, const double **data);
+void   block_reader_close(BlockReader *r);
+
+// helper functions (compressed captures)
+int    bit_width(uint64_t v);
+void   wfc_put_bits(uint8_t *buf, uint64_t pos, uint64_t v, int w);
+uint64_t wfc_get_bits(const uint8_t *buf, uint64_t pos, int w, uint64_t mask);
+int    wfc_encode_block(const double *x, int n, double step, WfcBlock *hdr, uint8_t *payload);
+void   wfc_decode_block(const WfcBlock *hdr, const uint8_t *payload, double step,
+                        double *restrict out);
+int    wfc_begin(FILE *fp, WfcHeader *h, double step);
+int    wfc_write_block(FILE *fp, WfcHeader *h, const double *x, int n, uint8_t *scratch,
+                       WfcBlock *blk);
+int    wfc_finish(FILE *fp, const WfcHeader *h);
+int    wfc_read_header(FILE *fp, WfcHeader *h);
+int    wfc_read_block(FILE *fp, WfcBlock *blk, uint8_t *payload);
+
+// helper functions (summary pyramid)
+void   summary_reset(SummaryNode *s);
+void   summary_add_samples(SummaryNode *s, const double *x, long n);
+void   summary_merge(SummaryNode *s, const SummaryNode *t);
+int    pyramid_build_levels(Pyramid *p);
+int    pyramid_build(Pyramid *p);
+int    pyramid_save(const Pyramid *p, const struct stat *st);
+int    pyramid_load(Pyramid *p, const struct stat *st);
+void   pyramid_close(Pyramid *p);
+int    pyramid_open(Pyramid *p, const char *path, int *reused);
+int    pyramid_read_range(const Pyramid *p, long long start, long long end, SummaryNode *s);
+int    pyramid_query(const Pyramid *p, long long start, long long end, SummaryNode *out);
+void   pyramid_overview(const Pyramid *p, long long start, long long end, int width, int height);
+
+// helper functions (regions)
+void   roi_free(void);
+int    roi_sum_levels(long nBlocks);
+int    roi_prepare(void);
+void   roi_query(int start, int end, SummaryNode *out);
+void   roi_write_row(FILE *fp, int start, int end, const SummaryNode *r);
+
+// helper functions (tone detection)
+int    tone_parse_list(const char *text, double freqs[], int maxTones);
+void   tone_bank_init(ToneBank *bank, const double freqs[], int nTones, double fs);
+void   tone_bank_update(ToneBank *bank, const double *x, long n);
+void   tone_bank_result(const ToneBank *bank, int k, double *amplitude, double *phaseDeg);
+void   tone_bank_report(const ToneBank *bank);
+
+// helper functions (correlation)
+void   fft_twiddles(Cplx *tw, int n);
+void   fft_radix2(Cplx *a, int n, const Cplx *tw, int inverse);
+void   convolve_direct(const double *restrict x, long n, const double *restrict k, long m,
+                       double *restrict out);
+void   convolve_fft_range(void *ctx, long start, long end);
+int    convolve_fft(const double *x, long n, const double *k, long m, double *out);
+int    convolve_full(const double *x, long n, const double *k, long m, double *out, int *usedFft);
+int    xcorr_best(const double *x, long n, const double *h, long m, XcorrResult *res);
+
+// helper functions (distribution)
+int    parse_number_list(const char *text, double out[], int maxCount);
+void   hist_range(void *ctx, long start, long end);
+void   build_histogram(const double a[], long n, double lo, double hi, int bins, long hist[]);
+void   print_histogram(FILE *fp, const long hist[], int bins, double lo, double hi, long total);
+double select_kth(double a[], long lo, long hi, long k);
+double select_pivot_mom(double a[], long lo, long hi);
+int    percentiles_exact(const double a[], long n, const double p[], int np, double out[]);
+void   p2_init(P2Quantile *e, double p);
+void   p2_add(P2Quantile *e, double x);
+double p2_result(const P2Quantile *e);
+
+// helper functions (frame features)
+void   frame_rules_default(void);
+int    frame_rule_parse(const char *text, FrameRule *rule);
+void   frame_rule_print(int index, const FrameRule *rule);
+int    frame_classify(const double f[]);
+const char *frame_label(int index);
+void   frame_range(void *ctx, long start, long end);
+long   frame_extract(const double *x, long n, int frameLen, double fs, double peakLevel,
+                     double **feats, int **labels);
+void   frame_timeline(const int *labels, long nFrames, int frameLen, double fs);
+
+// helper functions (envelope)
+void   envelope_free(void);
+void   envelope_range(void *ctx, long start, long end);
+int    envelope_compute(int window, int hop, double fs);
+double envelope_value(long w, int column);
+double envelope_time(long w);
+
+// helper functions (sliding extrema)
+int    sliding_init(SlidingExtrema *s, long window);
+void   sliding_free(SlidingExtrema *s);
+int    sliding_push(SlidingExtrema *s, double x, double *mn, double *mx);
+long   sliding_series(const double *x, long n, long window, double *mn, double *mx);
+void   ripple_report(double largest, long long largestAt, double smallest, long long smallestAt,
+                     double sum, long long count, long window);
+
+// helper functions (running median)
+int    skip_init(SkipList *s, int capacity);
+void   skip_free(SkipList *s);
+void   skip_insert(SkipList *s, double value);
+void   skip_remove(SkipList *s, double value);
+double skip_get(const SkipList *s, int k);
+int    skip_rank(const SkipList *s, double value, int inclusive);
+long   median_filter(double a[], int n, int windowSize, double threshold);
+
+// helper functions (trigger)
+int    trigger_hit(const TriggerSpec *t, const double *x, long j);
+int    trigger_block_active(const TriggerSpec *t, const double *restrict x, long i, long end);
+long   trigger_scan(const TriggerSpec *t, const double *x, long n, long *events, long maxEvents,
+                    long long *total);
+void   trigger_window(long k, long *start, long *end);
+
+// helper functions (sample slots)
+int    slot_find(const char *name, SlotView *v);
+const double *slot_piece(const SlotView *v, long at, long *len);
+void   compare_block(const double *restrict a, const double *restrict b, long n,
+                     double shiftA, double shiftB, CompareSums *s);
+void   compare_range(void *ctx, long start, long end);
+int    compare_slots(const SlotView *a, const SlotView *b, long n, CompareSums *total, long *maxAt);
+
+// helper functions (session)
+size_t session_elem_size(uint32_t type);
+SessionSection *session_begin(SessionWriter *w, uint32_t type, const char *name, int64_t count);
+int    session_write(SessionWriter *w, SessionSection *s, const void *data, size_t bytes);
+SessionSection *session_put(SessionWriter *w, uint32_t type, const char *name,
+                            const void *data, size_t elemSize, int64_t count);
+int    session_save(const char *path);
+void   session_map_release(SessionMap *m);
+double *session_map_buffer(int fd, const SessionSection *s);
+SnapVersion *session_map_version(const char *name, const double *x, int count, SessionMap *map);
+int    session_check(const uint8_t *base, const SessionHeader *h, const SessionSection *table);
+int    session_restore(const char *path);
+void   session_autosave(void);
+
+// helper functions (formulas)
+int    expr_compile(const char *text, ExprProgram *prog);
+void   expr_evaluate(const ExprProgram *prog, const double in[], double out[], int n);
+int    expr_emit(ExprProgram *prog, int op, double value);
+int    expr_parse_sum(ExprProgram *prog);
+int    expr_parse_product(ExprProgram *prog);
+int    expr_parse_unary(ExprProgram *prog);
+int    expr_parse_power(ExprProgram *prog);
+int    expr_parse_primary(ExprProgram *prog);
 
 // helper functions (safe input)
 void flush_input_buffer(void);
@@ -69,6 +968,7 @@ int  is_integer_string(const char *s);
 int  safe_get_int(const char *prompt, int *out_value);
 int  safe_get_double(const char *prompt, double *out_value);
 int  safe_get_filename(const char *prompt, char *buf, size_t buf_sz);
+int  safe_get_text(const char *prompt, char *buf, size_t buf_sz);
 
 // ========== Main Function ==========
 int main(void)
@@ -119,7 +1019,29 @@ void select_menu_item(int input)
         case 19: menu_item_19(); break;
         case 20: menu_item_20(); break;
         case 21: menu_item_21(); break;
+        case 22: menu_item_22(); break;
+        case 23: menu_item_23(); break;
+        case 24: menu_item_24(); break;
+        case 25: menu_item_25(); break;
+        case 26: menu_item_26(); break;
+        case 27: menu_item_27(); break;
+        case 28: menu_item_28(); break;
+        case 29: menu_item_29(); break;
+        case 30: menu_item_30(); break;
+        case 31: menu_item_31(); break;
+        case 32: menu_item_32(); break;
+        case 33: menu_item_33(); break;
+        case 34: menu_item_34(); break;
+        case 35: menu_item_35(); break;
+        case 36: menu_item_36(); break;
+        case 37: menu_item_37(); break;
+        case 38: menu_item_38(); break;
+        case 39: menu_item_39(); break;
+        case 40: menu_item_40(); break;
+        case 41: menu_item_41(); break;
+        case 42: menu_item_42(); break;
         case 0:
+            session_autosave();
             printf("Exiting program...\n");
             exit(0);
         default:
@@ -138,7 +1060,7 @@ void print_main_menu(void)
     printf("\t6.  Count zero-crossings\n");
     printf("\t7.  Save analysis report to file\n");
     printf("\t8.  Classify signal type\n");
-    printf("\t9.  Smooth waveform (moving average)\n");
+    printf("\t9.  Smooth waveform (moving average, median, Hampel)\n");
     printf("\t10. Detect peaks\n");
     printf("\t12. Generate test signal (sine wave)\n");
     printf("\t13. Basic calculator\n");
@@ -150,6 +1072,27 @@ void print_main_menu(void)
     printf("\t19. Sensor data converter (ADC -> units)\n");
     printf("\t20. Filter design helper (RC)\n");
     printf("\t21. AI-style assistant (help & explanations)\n");
+    printf("\t22. Batch quadratic solver (coefficient file)\n");
+    printf("\t23. Decode packed 12-bit ADC dump\n");
+    printf("\t24. Sensor calibration curve (compile to LUT)\n");
+    printf("\t25. Batch unit conversion (buffer / CSV / binary columns)\n");
+    printf("\t26. Formula transform / calculator (e.g. sqrt(x*x + 1))\n");
+    printf("\t27. Monte Carlo tolerance analysis (resistors, RC)\n");
+    printf("\t28. Sample history (undo / redo / named versions)\n");
+    printf("\t29. Live acquisition (FIFO / pipe / growing file)\n");
+    printf("\t30. Stream statistics from a large capture file\n");
+    printf("\t31. Compressed capture files (save / load / header stats)\n");
+    printf("\t32. Capture summary index (range stats, overview waveform)\n");
+    printf("\t33. Region statistics (sample range, batch, window sweep)\n");
+    printf("\t34. Tone detector (Goertzel bank: 50 Hz, harmonics, test tones)\n");
+    printf("\t35. Reference buffer, cross-correlation and convolution\n");
+    printf("\t36. Amplitude histogram and percentiles\n");
+    printf("\t37. Frame features, rule classification and label timeline\n");
+    printf("\t38. Envelope series (per-window RMS, peak and DC)\n");
+    printf("\t39. Rolling min / max / peak-to-peak (ripple, drift)\n");
+    printf("\t40. Trigger and event extraction (edge, level, window, pulse)\n");
+    printf("\t41. Compare sample slots (buffer, reference, named versions)\n");
+    printf("\t42. Session snapshot (save / restore / autosave on exit)\n");
     printf("\t0.  Exit\n");
     printf("--------------------------------------------------------\n");
 }
@@ -160,6 +1103,10 @@ void go_back_to_main(void)
     do {
         printf("\nEnter 'b' or 'B' to go back to main menu: ");
         if (scanf(" %c", &input) != 1) {
+            if (feof(stdin)) {
+                printf("\nEnd of input. Exiting.\n");
+                exit(0);
+            }
             flush_input_buffer();
             continue;
         }
@@ -187,6 +1134,8 @@ void menu_item_1(void)
         return;
     }
 
+    snapshot_before_change("before manual entry");
+
     if (n < 1 || n > MAX_SAMPLES) {
         printf("Invalid number of samples.\n");
         sampleCount = 0;
@@ -311,6 +1260,10 @@ void menu_item_7(void)
 
     char filename[100];
     FILE *fp;
+    int bins;
+    static const double REPORT_PCT[] = { 1.0, 5.0, 25.0, 50.0, 75.0, 95.0, 99.0 };
+    double pct[sizeof(REPORT_PCT) / sizeof(REPORT_PCT[0])];
+    int havePct;
 
     printf("\n>> Menu 7: Save report to file\n");
 
@@ -320,6 +1273,12 @@ void menu_item_7(void)
         go_back_to_main();
         return;
     }
+    if (safe_get_int("Histogram bins in report (0 = none): ", &bins) != 0 ||
+        bins < 0 || bins > HIST_MAX_BINS) {
+        printf("Bins must be 0 to %d.\n", HIST_MAX_BINS);
+        go_back_to_main();
+        return;
+    }
 
     fp = fopen(filename, "w");
     if (fp == NULL) {
@@ -338,6 +1297,9 @@ void menu_item_7(void)
     double peak = (maxA > minA) ? maxA : minA;
     double crest = (rms != 0.0) ? peak / rms : 0.0;
     int zeroCount = count_zero_crossings(samples, sampleCount);
+    int npct = (int)(sizeof(REPORT_PCT) / sizeof(REPORT_PCT[0]));
+
+    havePct = (percentiles_exact(samples, sampleCount, REPORT_PCT, npct, pct) == 0);
 
     fprintf(fp, "Waveform Analysis Report\n");
     fprintf(fp, "========================\n");
@@ -350,6 +1312,37 @@ void menu_item_7(void)
     fprintf(fp, "Peak value        : %.4f\n", peak);
     fprintf(fp, "Crest factor      : %.4f\n", crest);
     fprintf(fp, "Zero-crossings    : %d\n", zeroCount);
+    if (havePct) {
+        for (int i = 0; i < npct; i++) {
+            fprintf(fp, "P%-2g               : %.4f%s\n", REPORT_PCT[i], pct[i],
+                    (REPORT_PCT[i] == 50.0) ? " (median)" : "");
+        }
+    }
+    if (bins > 0) {
+        long *hist = malloc((size_t)bins * sizeof(long));
+
+        if (hist != NULL) {
+            build_histogram(samples, sampleCount, min, max, bins, hist);
+            fprintf(fp, "\nAmplitude histogram (%d bins)\n", bins);
+            fprintf(fp, "       From ..          To      Count  Share\n");
+            print_histogram(fp, hist, bins, min, max, sampleCount);
+            free(hist);
+        }
+    }
+    if (envelope.count > 0 && envelope.generation == sampleGeneration) {
+        double rmsLo = INFINITY, rmsHi = 0.0, crestHi = 0.0;
+
+        for (long w = 0; w < envelope.count; w++) {
+            rmsLo = fmin(rmsLo, envelope_value(w, ENV_RMS));
+            rmsHi = fmax(rmsHi, envelope_value(w, ENV_RMS));
+            crestHi = fmax(crestHi, envelope_value(w, ENV_CREST));
+        }
+        fprintf(fp, "\nEnvelope (menu 38)\n");
+        fprintf(fp, "Windows           : %ld x %d samples, hop %d\n", envelope.count,
+                envelope.window, envelope.hop);
+        fprintf(fp, "RMS envelope      : %.4f to %.4f\n", rmsLo, rmsHi);
+        fprintf(fp, "Highest crest     : %.4f\n", crestHi);
+    }
 
     fclose(fp);
 
@@ -389,7 +1382,11 @@ void menu_item_8(void)
     go_back_to_main();
 }
 
-// 9) Smooth waveform (moving average)
+// 9) Smooth waveform (moving average, median or Hampel)
+//
+// The median and Hampel filters keep the window sorted in a skiplist, so
+// each sample costs O(log window) instead of sorting every window. They
+// remove spikes that a moving average would only smear out.
 void menu_item_9(void)
 {
     if (!dataAvailable) {
@@ -399,22 +1396,56 @@ void menu_item_9(void)
     }
 
     int window;
-    printf("\n>> Menu 9: Smooth waveform (moving average)\n");
+    int filter;
+    double threshold = 3.0;
+    printf("\n>> Menu 9: Smooth waveform (moving average / median / Hampel)\n");
 
-    if (safe_get_int("Enter window size (odd, e.g. 3 or 5): ", &window) != 0) {
+    if (safe_get_int("Filter (1 = moving average, 2 = median, 3 = Hampel outlier removal): ",
+                     &filter) != 0 ||
+        safe_get_int("Enter window size (odd, e.g. 3 or 5): ", &window) != 0) {
         printf("Input error.\n");
         go_back_to_main();
         return;
     }
 
+    if (filter < 1 || filter > 3) {
+        printf("Invalid filter.\n");
+        go_back_to_main();
+        return;
+    }
     if (window < 1 || window > sampleCount || window % 2 == 0) {
         printf("Invalid window size.\n");
         go_back_to_main();
         return;
     }
+    if (filter == 3 &&
+        (safe_get_double("Threshold in MADs (e.g. 3): ", &threshold) != 0 || threshold < 0.0)) {
+        printf("Threshold must be zero or more.\n");
+        go_back_to_main();
+        return;
+    }
 
-    smooth_moving_average(samples, sampleCount, window);
-    printf("Waveform smoothed in-place.\n");
+    snapshot_before_change("before smoothing");
+    if (filter == 1) {
+        if (smooth_moving_average(samples, sampleCount, window) != 0) {
+            printf("Not enough memory to smooth the waveform.\n");
+        } else {
+            printf("Waveform smoothed in-place.\n");
+        }
+    } else {
+        // skiplist median: O(log window) per sample
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        long changed = median_filter(samples, sampleCount, window,
+                                     (filter == 2) ? -1.0 : threshold);
+        if (changed < 0) {
+            printf("Not enough memory to filter the waveform.\n");
+        } else {
+            printf("%s applied in-place: %ld samples changed (%.4f s).\n",
+                   (filter == 2) ? "Median filter" : "Hampel filter", changed,
+                   elapsed_seconds(&start));
+        }
+    }
 
     go_back_to_main();
 }
@@ -474,6 +1505,7 @@ void menu_item_12(void)
         return;
     }
 
+    snapshot_before_change("before sine generation");
     generate_sine_wave(samples, n, amplitude, periods);
 
     sampleCount = n;
@@ -705,25 +1737,29 @@ void menu_item_16(void)
     }
 
     double discriminant = b * b - 4.0 * a * c;
+    double x1re, x1im, x2re, x2im;
+
+    // same stable formula as the batch solver (menu 22)
+    solve_quadratic_block(&a, &b, &c, &x1re, &x1im, &x2re, &x2im, 1);
+
+    // keep this menu's order: x1 is the (-b + sqrt(D)) / 2a root. The solver's
+    // q / a is that root only when b is negative; otherwise it is c / q.
+    // Its imaginary parts are >= 0, where this menu's follow the sign of a.
+    double plusRoot = signbit(b) ? x1re : x2re;
+    double minusRoot = signbit(b) ? x2re : x1re;
+    double imagPart = (a > 0.0) ? x1im : -x1im;
 
     if (discriminant > 0.0) {
-        double sqrtD = sqrt(discriminant);
-        double x1 = (-b + sqrtD) / (2.0 * a);
-        double x2 = (-b - sqrtD) / (2.0 * a);
         printf("Two distinct real roots:\n");
-        printf(" x1 = %.6f\n", x1);
-        printf(" x2 = %.6f\n", x2);
+        printf(" x1 = %.6f\n", plusRoot);
+        printf(" x2 = %.6f\n", minusRoot);
     } else if (discriminant == 0.0) {
-        double x = -b / (2.0 * a);
         printf("One repeated real root:\n");
-        printf(" x = %.6f\n", x);
+        printf(" x = %.6f\n", x1re);
     } else {
-        double sqrtD = sqrt(-discriminant);
-        double realPart = -b / (2.0 * a);
-        double imagPart = sqrtD / (2.0 * a);
         printf("Two complex roots:\n");
-        printf(" x1 = %.6f + %.6fi\n", realPart, imagPart);
-        printf(" x2 = %.6f - %.6fi\n", realPart, imagPart);
+        printf(" x1 = %.6f + %.6fi\n", x1re, imagPart);
+        printf(" x2 = %.6f - %.6fi\n", x2re, imagPart);
     }
 
     go_back_to_main();
@@ -743,9 +1779,10 @@ void menu_item_17(void)
         printf(" 2) Resistance (ohm <-> kilo-ohm)\n");
         printf(" 3) Frequency (Hz <-> kHz)\n");
         printf(" 4) Length (m <-> mm)\n");
+        printf(" 5) Any units with SI prefixes (e.g. mV -> kV, degC -> degF)\n");
         printf(" 0) Return to main menu\n");
 
-        if (safe_get_int("Enter choice (0–4): ", &category) != 0) {
+        if (safe_get_int("Enter choice (0–5): ", &category) != 0) {
             printf("Input error.\n");
             continue;
         }
@@ -843,8 +1880,28 @@ void menu_item_17(void)
                 }
                 break;
 
+            case 5: {
+                char from[UNIT_TEXT], to[UNIT_TEXT];
+                double scale, offset;
+                if (safe_get_text("From unit: ", from, sizeof(from)) != 0 ||
+                    safe_get_text("To unit: ", to, sizeof(to)) != 0) {
+                    printf("Input error.\n");
+                    break;
+                }
+                if (unit_conversion(from, to, &scale, &offset) != 0) {
+                    break;
+                }
+                if (safe_get_double("Enter value: ", &value) != 0) {
+                    printf("Input error.\n");
+                    break;
+                }
+                printf("Result: %.6g %s = %.6g %s\n", value, from,
+                       value * scale + offset, to);
+                break;
+            }
+
             default:
-                printf("Please enter a number from 0 to 4.\n");
+                printf("Please enter a number from 0 to 5.\n");
                 break;
         }
     }
@@ -922,7 +1979,7 @@ void menu_item_19(void)
         if (adc == -1) {
             break;
         }
-        if (adc < 0 || adc > 4095) {
+        if (adc < 0 || adc > ADC_MAX) {
             printf("ADC reading must be between 0 and 4095.\n");
             continue;
         }
@@ -936,7 +1993,7 @@ void menu_item_19(void)
             continue;
         }
 
-        double voltage = (double)adc * vref / 4095.0;
+        double voltage = (double)adc * vref / ADC_MAX;
         printf("ADC voltage = %.6f V\n", voltage);
 
         printf("\nChoose sensor mapping:\n");
@@ -957,17 +2014,17 @@ void menu_item_19(void)
 
         switch (sensorChoice) {
             case 1: {
-                double tempC = voltage / 0.01; // 10 mV/°C = 0.01 V/°C
+                double tempC = sensor_from_voltage(1, voltage);
                 printf("Approx temperature: %.2f °C (LM35 model)\n", tempC);
                 break;
             }
             case 2: {
-                double pressure = (voltage / 5.0) * 100.0;
+                double pressure = sensor_from_voltage(2, voltage);
                 printf("Approx pressure: %.2f kPa (0–5 V -> 0–100 kPa model)\n", pressure);
                 break;
             }
             case 3: {
-                double accel = (voltage - 1.65) / 0.3;
+                double accel = sensor_from_voltage(3, voltage);
                 printf("Approx acceleration: %.2f g (1.65 V at 0 g, 0.3 V/g model)\n", accel);
                 break;
             }
@@ -1013,8 +2070,10 @@ void menu_item_20(void)
         printf(" 1) fc given R and C\n");
         printf(" 2) C given R and fc\n");
         printf(" 3) R given C and fc\n");
+        printf(" 4) Frequency sweep (magnitude / phase, multi-stage)\n");
+        printf(" 5) Standard E-series R and C for a target fc\n");
 
-        if (safe_get_int("Enter choice (1–3): ", &mode) != 0) {
+        if (safe_get_int("Enter choice (1–5): ", &mode) != 0) {
             printf("Input error.\n");
             continue;
         }
@@ -1062,6 +2121,14 @@ void menu_item_20(void)
                 printf("Required resistance R = %.3f ohms\n", R);
                 break;
 
+            case 4:
+                menu_item_20_sweep();
+                break;
+
+            case 5:
+                menu_item_20_eseries();
+                break;
+
             default:
                 printf("Invalid mode.\n");
                 break;
@@ -1071,6 +2138,252 @@ void menu_item_20(void)
     go_back_to_main();
 }
 
+// 20, option 4) Frequency sweep of an RC network
+//
+// Computes magnitude and phase at log-spaced frequencies, split across
+// worker threads, then reports the -3 dB point(s) and the roll-off slope
+// at both ends of the sweep. Stages are either buffered (responses
+// multiply) or a passive ladder (ABCD matrices chained, output unloaded).
+void menu_item_20_sweep(void)
+{
+    RcSweep sw;
+    int loaded, outFormat, pointsIn;
+    long points;
+    char outName[100];
+
+    memset(&sw, 0, sizeof(sw));
+
+    if (safe_get_int("Number of stages (1–8): ", &sw.nStages) != 0) {
+        printf("Input error.\n");
+        return;
+    }
+    if (sw.nStages < 1 || sw.nStages > RC_MAX_STAGES) {
+        printf("Invalid number of stages.\n");
+        return;
+    }
+
+    for (int k = 0; k < sw.nStages; k++) {
+        char prompt[60];
+        printf("Stage %d:\n", k + 1);
+        snprintf(prompt, sizeof(prompt), " type (1 = low-pass, 2 = high-pass): ");
+        if (safe_get_int(prompt, &sw.type[k]) != 0 ||
+            safe_get_double(" R (ohms): ", &sw.R[k]) != 0 ||
+            safe_get_double(" C (farads): ", &sw.C[k]) != 0) {
+            printf("Input error.\n");
+            return;
+        }
+        if ((sw.type[k] != 1 && sw.type[k] != 2) || sw.R[k] <= 0.0 || sw.C[k] <= 0.0) {
+            printf("Stage type must be 1 or 2, and R and C must be positive.\n");
+            return;
+        }
+    }
+
+    if (sw.nStages > 1) {
+        printf("Connection between stages:\n");
+        printf(" 1) Buffered (each stage drives the next without loading)\n");
+        printf(" 2) Passive ladder (stages load each other)\n");
+        if (safe_get_int("Enter choice (1–2): ", &loaded) != 0) {
+            printf("Input error.\n");
+            return;
+        }
+        sw.loaded = (loaded == 2);
+    }
+
+    if (safe_get_double("Start frequency (Hz): ", &sw.f1) != 0 ||
+        safe_get_double("Stop frequency (Hz): ", &sw.f2) != 0 ||
+        safe_get_int("Number of points (2–2000000): ", &pointsIn) != 0) {
+        printf("Input error.\n");
+        return;
+    }
+    points = pointsIn;
+    if (sw.f1 <= 0.0 || sw.f2 <= sw.f1 || points < 2 || points > SWEEP_MAX_POINTS) {
+        printf("Need 0 < start < stop and 2 to %d points.\n", SWEEP_MAX_POINTS);
+        return;
+    }
+    sw.points = points;
+
+    printf("Write results to:\n");
+    printf(" 1) CSV file (freq_hz,mag_db,phase_deg)\n");
+    printf(" 2) Binary file (freq, mag_db, phase_deg doubles)\n");
+    printf(" 3) No file, summary only\n");
+    if (safe_get_int("Enter choice (1–3): ", &outFormat) != 0 ||
+        (outFormat != 3 && (outFormat < 1 || outFormat > 3 ||
+         safe_get_filename("Output filename: ", outName, sizeof(outName)) != 0))) {
+        printf("Input error.\n");
+        return;
+    }
+
+    sw.freq = malloc((size_t)points * sizeof(double));
+    sw.magDb = malloc((size_t)points * sizeof(double));
+    sw.phaseDeg = malloc((size_t)points * sizeof(double));
+    if (sw.freq == NULL || sw.magDb == NULL || sw.phaseDeg == NULL) {
+        printf("Not enough memory for the sweep.\n");
+        free(sw.freq);
+        free(sw.magDb);
+        free(sw.phaseDeg);
+        return;
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    parallel_range(points, 4096, rc_sweep_range, &sw);
+    double seconds = elapsed_seconds(&start);
+
+    // phase comes from atan2() and wraps at ±180°, unwrap it
+    for (long k = 1; k < points; k++) {
+        while (sw.phaseDeg[k] - sw.phaseDeg[k - 1] > 180.0) sw.phaseDeg[k] -= 360.0;
+        while (sw.phaseDeg[k] - sw.phaseDeg[k - 1] < -180.0) sw.phaseDeg[k] += 360.0;
+    }
+
+    long peak = 0;
+    for (long k = 1; k < points; k++) {
+        if (sw.magDb[k] > sw.magDb[peak]) peak = k;
+    }
+    double level = sw.magDb[peak] - 10.0 * log10(2.0);   // half power, -3.01 dB
+
+    printf("\nSweep: %ld points, %.3g Hz to %.3g Hz, %d thread(s), %.3f s\n",
+           points, sw.f1, sw.f2, worker_count(), seconds);
+    printf("Peak gain        : %.3f dB at %.3f Hz\n", sw.magDb[peak], sw.freq[peak]);
+
+    int found = 0;
+    for (long k = 1; k < points; k++) {
+        int below0 = sw.magDb[k - 1] < level, below1 = sw.magDb[k] < level;
+        if (below0 != below1) {
+            double f3 = interp_log_crossing(sw.freq[k - 1], sw.magDb[k - 1],
+                                            sw.freq[k], sw.magDb[k], level);
+            printf("-3 dB point      : %.3f Hz (%s)\n", f3, below1 ? "falling" : "rising");
+            found++;
+        }
+    }
+    if (!found) {
+        printf("-3 dB point      : not inside the sweep range\n");
+    }
+
+    // slopes over the first and last decade (or the whole sweep if shorter)
+    double decadeRatio = log10(sw.f2 / sw.f1);
+    long perDecade = (decadeRatio > 1.0) ? (long)((points - 1) / decadeRatio) : points - 1;
+    printf("Low-end slope    : %.2f dB/decade\n",
+           fit_slope_per_decade(sw.freq, sw.magDb, 0, perDecade));
+    printf("High-end slope   : %.2f dB/decade\n",
+           fit_slope_per_decade(sw.freq, sw.magDb, points - 1 - perDecade, points - 1));
+
+    if (outFormat != 3) {
+        FILE *fp = fopen(outName, (outFormat == 2) ? "wb" : "w");
+        int ok = (fp != NULL);
+        if (ok && outFormat == 1) {
+            fprintf(fp, "freq_hz,mag_db,phase_deg\n");
+            for (long k = 0; k < points && ok; k++) {
+                ok = fprintf(fp, "%.8g,%.6f,%.4f\n", sw.freq[k], sw.magDb[k], sw.phaseDeg[k]) > 0;
+            }
+        } else if (ok) {
+            for (long k = 0; k < points && ok; k++) {
+                double row[3] = { sw.freq[k], sw.magDb[k], sw.phaseDeg[k] };
+                ok = fwrite(row, sizeof(double), 3, fp) == 3;
+            }
+        }
+        if (fp != NULL && fclose(fp) != 0) ok = 0;
+        printf(ok ? "Sweep written to %s\n" : "Could not write %s\n", outName);
+    }
+
+    free(sw.freq);
+    free(sw.magDb);
+    free(sw.phaseDeg);
+}
+
+// 20, option 5) Standard E-series R and C for a target fc
+//
+// Resistors span 1 ohm – 10 M-ohm and capacitors 1 pF – 10 uF. For every
+// standard C the ideal R is matched from the sorted R table by binary
+// search (single part, or two in series / parallel), and the same is done
+// for every standard R against the C table. The best choices are listed.
+void menu_item_20_eseries(void)
+{
+    static double rTable[ESERIES_MAX], cTable[ESERIES_MAX];
+    static const int SERIES[] = { 6, 12, 24, 48, 96, 192 };
+    int rSeries, cSeries, pairs, nR, nC;
+    double fc;
+    RcChoice top[ESERIES_TOP];
+    int count = 0;
+
+    if (safe_get_double("Target fc (Hz): ", &fc) != 0 ||
+        safe_get_int("Resistor series (12, 24, 48, 96 or 192): ", &rSeries) != 0 ||
+        safe_get_int("Capacitor series (6, 12 or 24): ", &cSeries) != 0 ||
+        safe_get_int("Allow two-part series/parallel combinations (1 = yes, 0 = no): ",
+                     &pairs) != 0) {
+        printf("Input error.\n");
+        return;
+    }
+    if (fc <= 0.0 || rSeries < 12 || rSeries > 192 || cSeries > 24) {
+        printf("fc must be positive; check the series numbers.\n");
+        return;
+    }
+
+    nR = 0;
+    nC = 0;
+    for (size_t k = 0; k < sizeof(SERIES) / sizeof(SERIES[0]); k++) {
+        if (SERIES[k] == rSeries) nR = eseries_build(rSeries, 1.0, 7, rTable);
+        if (SERIES[k] == cSeries) nC = eseries_build(cSeries, 1e-12, 7, cTable);
+    }
+    if (nR == 0 || nC == 0) {
+        printf("Unknown E-series.\n");
+        return;
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // fixed standard C, build the ideal R; then fixed standard R, build C
+    for (int pass = 0; pass < 2; pass++) {
+        const double *fixed = (pass == 0) ? cTable : rTable;
+        const double *other = (pass == 0) ? rTable : cTable;
+        int nFixed = (pass == 0) ? nC : nR;
+        int nOther = (pass == 0) ? nR : nC;
+
+        for (int i = 0; i < nFixed; i++) {
+            double ideal = 1.0 / (2.0 * M_PI * fc * fixed[i]);
+            RcChoice c;
+            double v1, v2;
+            int mode;
+
+            if (ideal < other[0] / 2.0 || ideal > other[nOther - 1] * 2.0) {
+                continue;   // cannot be built from this table
+            }
+            if (eseries_best(other, nOther, ideal, pairs, &v1, &v2, &mode) != 0) {
+                continue;
+            }
+
+            memset(&c, 0, sizeof(c));
+            if (pass == 0) {
+                c.c1 = fixed[i];
+                c.r1 = v1; c.r2 = v2; c.rMode = mode;
+            } else {
+                c.r1 = fixed[i];
+                c.c1 = v1; c.c2 = v2; c.cMode = mode;
+            }
+            c.fc = 1.0 / (2.0 * M_PI * eseries_value(c.r1, c.r2, c.rMode) *
+                          eseries_value(c.c1, c.c2, c.cMode));
+            c.errPct = (c.fc - fc) / fc * 100.0;
+            eseries_keep(top, &count, &c);
+        }
+    }
+
+    double seconds = elapsed_seconds(&start);
+
+    printf("\nBest standard parts for fc = %.3f Hz (E%d resistors, E%d capacitors):\n",
+           fc, rSeries, cSeries);
+    for (int k = 0; k < count; k++) {
+        char rText[48], cText[48];
+        format_parts(top[k].r1, top[k].r2, top[k].rMode, "ohm", rText, sizeof(rText));
+        format_parts(top[k].c1, top[k].c2, top[k].cMode, "F", cText, sizeof(cText));
+        printf("%2d) R = %-24s C = %-22s fc = %10.3f Hz  error %+.4f%%\n",
+               k + 1, rText, cText, top[k].fc, top[k].errPct);
+    }
+    if (count == 0) {
+        printf("No combination found in range.\n");
+    }
+    printf("Search time: %.2f ms\n", seconds * 1e3);
+}
+
 // 21) AI-style assistant (simple help system)
 void menu_item_21(void)
 {
@@ -1136,137 +2449,7981 @@ void menu_item_21(void)
     go_back_to_main();
 }
 
-// ========== Helper Functions (analysis) ==========
-
-double find_min(const double a[], int n)
+// 22) Batch quadratic solver (coefficient file)
+//
+// Reads rows of a, b, c from a text file (one equation per line, comma or
+// space separated) or a binary file of doubles (a, b, c, a, b, c, ...).
+// Roots are written as x1_re, x1_im, x2_re, x2_im per row, again as text
+// or as raw doubles. Rows are solved in blocks of BATCH_BLOCK.
+void menu_item_22(void)
 {
-    int i;
-    double min = a[0];
-    for (i = 1; i < n; i++) {
-        if (a[i] < min)
-            min = a[i];
-    }
-    return min;
-}
+    char inName[100], outName[100];
+    int binaryIn, binaryOut;
+    FILE *in, *out;
 
-double find_max(const double a[], int n)
-{
-    int i;
-    double max = a[0];
-    for (i = 1; i < n; i++) {
-        if (a[i] > max)
-            max = a[i];
-    }
-    return max;
-}
+    printf("\n>> Menu 22: Batch quadratic solver (ax^2 + bx + c = 0)\n");
+    printf("Input format:\n");
+    printf(" 1) Text (a b c per line)\n");
+    printf(" 2) Binary doubles (a, b, c repeated)\n");
 
-double calc_average(const double a[], int n)
-{
-    int i;
-    double sum = 0.0;
-    for (i = 0; i < n; i++) {
-        sum += a[i];
+    if (safe_get_int("Enter choice (1–2): ", &binaryIn) != 0 ||
+        safe_get_filename("Input filename: ", inName, sizeof(inName)) != 0) {
+        printf("Input error.\n");
+        go_back_to_main();
+        return;
     }
-    return sum / n;
-}
 
-double calc_rms(const double a[], int n)
-{
-    int i;
-    double sumSq = 0.0;
-    for (i = 0; i < n; i++) {
-        sumSq += a[i] * a[i];
-    }
-    return sqrt(sumSq / n);
-}
+    printf("Output format:\n");
+    printf(" 1) Text CSV (x1_re,x1_im,x2_re,x2_im)\n");
+    printf(" 2) Binary doubles (x1_re, x1_im, x2_re, x2_im repeated)\n");
 
-int count_zero_crossings(const double a[], int n)
-{
-    int count = 0;
-    for (int i = 1; i < n; i++) {
-        if ((a[i - 1] > 0 && a[i] < 0) ||
-            (a[i - 1] < 0 && a[i] > 0)) {
-            count++;
-        }
+    if (safe_get_int("Enter choice (1–2): ", &binaryOut) != 0 ||
+        safe_get_filename("Output filename: ", outName, sizeof(outName)) != 0) {
+        printf("Input error.\n");
+        go_back_to_main();
+        return;
     }
-    return count;
-}
-
-// simple peak detection: a peak is higher than both neighbours
-int detect_peaks(const double a[], int n)
-{
-    int count = 0;
 
-    if (n < 3) {
-        return 0; // need at least 3 points
+    if ((binaryIn != 1 && binaryIn != 2) || (binaryOut != 1 && binaryOut != 2)) {
+        printf("Invalid format choice.\n");
+        go_back_to_main();
+        return;
     }
+    binaryIn  = (binaryIn == 2);
+    binaryOut = (binaryOut == 2);
 
-    for (int i = 1; i < n - 1; i++) {
-        if (a[i] > a[i - 1] && a[i] > a[i + 1]) {
-            printf("Peak at index %d, value = %.4f\n", i, a[i]);
-            count++;
-        }
+    in = fopen(inName, binaryIn ? "rb" : "r");
+    if (in == NULL) {
+        printf("Could not open input file.\n");
+        go_back_to_main();
+        return;
+    }
+    out = fopen(outName, binaryOut ? "wb" : "w");
+    if (out == NULL) {
+        printf("Could not open output file for writing.\n");
+        fclose(in);
+        go_back_to_main();
+        return;
     }
 
-    return count;
-}
+    static double a[BATCH_BLOCK], b[BATCH_BLOCK], c[BATCH_BLOCK];
+    static double x1re[BATCH_BLOCK], x1im[BATCH_BLOCK];
+    static double x2re[BATCH_BLOCK], x2im[BATCH_BLOCK];
+    static double packed[4 * BATCH_BLOCK];
+    long total = 0, skipped = 0, complexCount = 0;
+    double solveTime = 0.0;
+    struct timespec startAll, startSolve;
+    int n;
 
-// moving average smoothing (in-place)
-void smooth_moving_average(double a[], int n, int windowSize)
-{
-    double temp[MAX_SAMPLES];
-    int half = windowSize / 2;
+    clock_gettime(CLOCK_MONOTONIC, &startAll);
 
-    for (int i = 0; i < n; i++) {
-        temp[i] = a[i];
+    if (!binaryOut) {
+        fprintf(out, "x1_re,x1_im,x2_re,x2_im\n");
     }
 
-    for (int i = 0; i < n; i++) {
-        double sum = 0.0;
-        int count = 0;
+    do {
+        // fill one block of coefficients
+        n = 0;
+        if (binaryIn) {
+            size_t got = fread(packed, sizeof(double), 3 * BATCH_BLOCK, in);
+            n = (int)(got / 3);
+            for (int i = 0; i < n; i++) {
+                a[i] = packed[3 * i];
+                b[i] = packed[3 * i + 1];
+                c[i] = packed[3 * i + 2];
+            }
+        } else {
+            char line[256];
+            while (n < BATCH_BLOCK && fgets(line, sizeof(line), in) != NULL) {
+                double v[3];
+                char *p = line, *end;
+                int k;
+                for (k = 0; k < 3; k++) {
+                    while (*p == ' ' || *p == '\t' || *p == ',') p++;
+                    v[k] = strtod(p, &end);
+                    if (end == p) break;
+                    p = end;
+                }
+                if (k < 3) {
+                    skipped++;   // header or malformed row
+                    continue;
+                }
+                a[n] = v[0];
+                b[n] = v[1];
+                c[n] = v[2];
+                n++;
+            }
+        }
 
-        int start = i - half;
-        int end   = i + half;
+        if (n == 0) break;
 
-        if (start < 0) start = 0;
-        if (end >= n) end = n - 1;
+        clock_gettime(CLOCK_MONOTONIC, &startSolve);
+        solve_quadratic_block(a, b, c, x1re, x1im, x2re, x2im, n);
+        solveTime += elapsed_seconds(&startSolve);
 
-        for (int j = start; j <= end; j++) {
-            sum += temp[j];
-            count++;
+        for (int i = 0; i < n; i++) {
+            complexCount += (x1im[i] != 0.0);
         }
 
-        a[i] = sum / count;
-    }
-}
+        if (binaryOut) {
+            for (int i = 0; i < n; i++) {
+                packed[4 * i]     = x1re[i];
+                packed[4 * i + 1] = x1im[i];
+                packed[4 * i + 2] = x2re[i];
+                packed[4 * i + 3] = x2im[i];
+            }
+            fwrite(packed, sizeof(double), 4 * (size_t)n, out);
+        } else {
+            for (int i = 0; i < n; i++) {
+                fprintf(out, "%.10g,%.10g,%.10g,%.10g\n",
+                        x1re[i], x1im[i], x2re[i], x2im[i]);
+            }
+        }
 
-// generate a simple sine wave
-void generate_sine_wave(double a[], int n, double amplitude, int periods)
-{
-    const double TWO_PI = 6.28318530717958647692;
-    for (int i = 0; i < n; i++) {
-        double t = (double)i / (double)n;  // 0 to 1
-        a[i] = amplitude * sin(TWO_PI * periods * t);
-    }
-}
+        total += n;
+    } while (n == BATCH_BLOCK || !binaryIn);
 
-// ========== Helper Functions (safe input) ==========
+    double totalTime = elapsed_seconds(&startAll);
 
-void flush_input_buffer(void)
-{
-    int ch;
-    while ((ch = getchar()) != '\n' && ch != EOF) {
-        /* discard */
+    fclose(in);
+    if (fclose(out) != 0) {
+        printf("Error while writing output file.\n");
+    }
+
+    printf("Equations solved : %ld\n", total);
+    printf("Complex pairs    : %ld\n", complexCount);
+    if (skipped > 0) {
+        printf("Rows skipped     : %ld (not three numbers)\n", skipped);
+    }
+    if (total > 0) {
+        printf("Solve time       : %.2f ns/equation\n", solveTime * 1e9 / total);
+        printf("Total time       : %.3f s (including file I/O)\n", totalTime);
     }
+    printf("Roots written to %s\n", outName);
+
+    go_back_to_main();
 }
 
-int is_integer_string(const char *s)
+// 23) Packed 12-bit ADC dump decoder
+//
+// Logger dumps hold two 12-bit samples in every 3 bytes (b0, b1, b2):
+//   sample0 = b0 | (b1 & 0x0F) << 8
+//   sample1 = (b1 >> 4) | b2 << 4
+// Each block is unpacked to codes, then scaled by Vref and the chosen
+// sensor model in one multiply-add pass (all menu 19 models are linear).
+// A menu 24 calibration curve is expanded to one value per code instead.
+void menu_item_23(void)
 {
-    if (s == NULL || *s == '\0') {
-        return 0;
-    }
+    char inName[100], outName[100];
+    int sensor, dest;
+    double vref, scale, offset;
+    FILE *in, *out = NULL;
 
-    const char *p = s;
+    printf("\n>> Menu 23: Packed 12-bit ADC dump decoder\n");
+
+    if (safe_get_filename("Dump filename: ", inName, sizeof(inName)) != 0 ||
+        safe_get_double("Enter ADC reference voltage Vref (e.g. 3.3): ", &vref) != 0) {
+        printf("Input error.\n");
+        go_back_to_main();
+        return;
+    }
+    if (vref <= 0.0) {
+        printf("Vref must be positive.\n");
+        go_back_to_main();
+        return;
+    }
+
+    printf("Convert to:\n");
+    printf(" 0) Voltage (V)\n");
+    printf(" 1) Temperature (LM35: 10 mV/°C)\n");
+    printf(" 2) Pressure (0–5 V -> 0–100 kPa)\n");
+    printf(" 3) Acceleration (0 g at 1.65 V, 0.3 V per g)\n");
+    printf(" 4) Calibration curve loaded in menu 24\n");
+    if (safe_get_int("Enter choice (0–4): ", &sensor) != 0) {
+        printf("Input error.\n");
+        go_back_to_main();
+        return;
+    }
+    if (sensor < 0 || sensor > 4) {
+        printf("Invalid choice.\n");
+        go_back_to_main();
+        return;
+    }
+    if (sensor == 4 && (!calLoaded || calCurve.bits != 12)) {
+        printf("No 12-bit calibration curve loaded. Use menu 24 first.\n");
+        go_back_to_main();
+        return;
+    }
+    if (sensor == 4) {
+        printf("Using Vref = %.4f V from the calibration file.\n", calCurve.vref);
+    }
+
+    printf("Send results to:\n");
+    printf(" 1) Sample buffer (for menus 3–10, 18)\n");
+    printf(" 2) Binary file of doubles\n");
+    printf(" 3) Text file (one value per line)\n");
+    if (safe_get_int("Enter choice (1–3): ", &dest) != 0) {
+        printf("Input error.\n");
+        go_back_to_main();
+        return;
+    }
+    if (dest < 1 || dest > 3) {
+        printf("Invalid choice.\n");
+        go_back_to_main();
+        return;
+    }
+    if (dest != 1) {
+        if (safe_get_filename("Output filename: ", outName, sizeof(outName)) != 0) {
+            printf("Filename error.\n");
+            go_back_to_main();
+            return;
+        }
+    }
+
+    in = fopen(inName, "rb");
+    if (in == NULL) {
+        printf("Could not open dump file.\n");
+        go_back_to_main();
+        return;
+    }
+    if (dest != 1) {
+        out = fopen(outName, (dest == 2) ? "wb" : "w");
+        if (out == NULL) {
+            printf("Could not open output file for writing.\n");
+            fclose(in);
+            go_back_to_main();
+            return;
+        }
+    }
+
+    static uint8_t raw[3 * ADC_BLOCK_PAIRS];
+    static uint16_t codes[2 * ADC_BLOCK_PAIRS];
+    static double values[2 * ADC_BLOCK_PAIRS];
+    static double codeTable[ADC_MAX + 1];
+    long decoded = 0, dropped = 0;
+    size_t got, leftover = 0;
+    int writeError = 0;
+    struct timespec start;
+
+    adc_linear_map(sensor, vref, &scale, &offset);
+    if (sensor == 4) {
+        // nonlinear curve: one table entry per code turns it into a gather
+        for (int i = 0; i <= ADC_MAX; i++) {
+            codeTable[i] = cal_lookup(&calLut, i);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    if (dest == 1) {
+        snapshot_before_change("before ADC dump load");
+        sampleCount = 0;
+    }
+
+    while ((got = fread(raw, 1, sizeof(raw), in)) > 0) {
+        int nPairs = (int)(got / 3);
+        int n = 2 * nPairs;
+        leftover = got % 3;   // only possible on the last read
+
+        unpack_adc12(raw, nPairs, codes);
+
+        if (dest == 1) {
+            // decode straight into the sample buffer
+            int room = SAMPLE_BUF_SIZE - sampleCount;
+            int keep = (n < room) ? n : room;
+            if (sensor == 4) {
+                for (int i = 0; i < keep; i++) {
+                    samples[sampleCount + i] = codeTable[codes[i]];
+                }
+            } else {
+                adc_codes_to_units(codes, keep, scale, offset, &samples[sampleCount]);
+            }
+            sampleCount += keep;
+            dropped += n - keep;
+        } else {
+            if (sensor == 4) {
+                for (int i = 0; i < n; i++) {
+                    values[i] = codeTable[codes[i]];
+                }
+            } else {
+                adc_codes_to_units(codes, n, scale, offset, values);
+            }
+            if (write_doubles(out, values, n, dest == 2) != 0) {
+                writeError = 1;
+                break;
+            }
+        }
+        decoded += n;
+    }
+
+    double seconds = elapsed_seconds(&start);
+
+    fclose(in);
+    if (out != NULL && fclose(out) != 0) {
+        writeError = 1;
+    }
+
+    if (dest == 1) {
+        dataAvailable = (sampleCount > 0);
+    }
+
+    printf("Samples decoded : %ld\n", decoded);
+    if (leftover > 0) {
+        printf("Trailing bytes  : %zu ignored (incomplete sample pair)\n", leftover);
+    }
+    if (seconds > 0.0) {
+        printf("Throughput      : %.1f MB/s of packed data\n",
+               (double)decoded * 1.5 / seconds / 1e6);
+    }
+    if (dest == 1) {
+        printf("Samples stored  : %d\n", sampleCount);
+        if (dropped > 0) {
+            printf("Warning: buffer full, %ld samples not stored.\n", dropped);
+        }
+    } else if (writeError) {
+        printf("Error while writing output file.\n");
+    } else {
+        printf("Values written to %s\n", outName);
+    }
+
+    go_back_to_main();
+}
+
+// 24) Calibration curve compiler
+//
+// Curve file (one keyword per line, '#' starts a comment):
+//   type poly | steinhart | table
+//   unit degC                   label printed with results
+//   vref 3.3                    ADC reference voltage
+//   bits 12                     ADC resolution
+//   range Vmin Vmax             calibrated input range (default 0..vref;
+//                               steinhart needs 0 < Vmin < Vmax < Vsupply)
+//   coeffs c0 c1 c2 ...         poly: y = c0 + c1*V + c2*V^2 + ...
+//   steinhart A B C             thermistor, result in °C
+//   divider Rfixed Vsupply      thermistor to ground, Rfixed to Vsupply
+//   point V y                   table: one point per line, V ascending
+void menu_item_24(void)
+{
+    int running = 1;
+    int choice;
+
+    printf("\n>> Menu 24: Sensor calibration curve (compile to LUT)\n");
+
+    while (running) {
+        printf("\nChoose an option:\n");
+        printf(" 1) Load and compile a curve file\n");
+        printf(" 2) Convert one ADC code (exact vs LUT)\n");
+        printf(" 3) Convert sample buffer (ADC codes -> units, in-place)\n");
+        printf(" 0) Return to main menu\n");
+
+        if (safe_get_int("Enter choice (0–3): ", &choice) != 0) {
+            printf("Input error.\n");
+            continue;
+        }
+
+        if (choice == 0) {
+            running = 0;
+            break;
+        }
+
+        if (choice == 1) {
+            char filename[100];
+            int step, interp;
+            CalCurve cv;
+
+            if (safe_get_filename("Curve filename: ", filename, sizeof(filename)) != 0) {
+                printf("Filename error.\n");
+                continue;
+            }
+            if (cal_load_curve(filename, &cv) != 0) {
+                continue;
+            }
+            if (safe_get_int("ADC codes per LUT step (1, 2, 4, ... 256): ", &step) != 0 ||
+                safe_get_int("Interpolation (1 = linear, 2 = cubic): ", &interp) != 0) {
+                printf("Input error.\n");
+                continue;
+            }
+            if (step < 1 || step > 256 || (step & (step - 1)) != 0) {
+                printf("Step must be a power of two from 1 to 256.\n");
+                continue;
+            }
+            if (interp != 1 && interp != 2) {
+                printf("Invalid interpolation choice.\n");
+                continue;
+            }
+
+            double span = (cv.vMax - cv.vMin) / cv.vref * ((1 << cv.bits) - 1);
+            int nodes = (int)ceil(span / step) + 1;
+            if (nodes < 4) {
+                nodes = 4;
+            }
+
+            calCurve = cv;
+            cal_compile(&calCurve, nodes, interp == 2, &calLut);
+            calLoaded = 1;
+
+            printf("Curve compiled: %d-bit ADC, Vref = %.4f V, range %.4f–%.4f V\n",
+                   cv.bits, cv.vref, cv.vMin, cv.vMax);
+            printf("LUT nodes          : %d (%.2f codes apart, %s)\n", calLut.nodes,
+                   calLut.codesPerNode, calLut.cubic ? "cubic" : "linear");
+            printf("LUT size           : %.1f kB\n",
+                   calLut.nodes * sizeof(double) / 1024.0);
+            printf("Worst-case error   : %.6g %s (at code %d, within range)\n", calLut.maxError,
+                   calCurve.unit, calLut.maxErrorCode);
+        } else if (choice == 2) {
+            int code;
+            if (!calLoaded) {
+                printf("No calibration curve loaded.\n");
+                continue;
+            }
+            if (safe_get_int("ADC code: ", &code) != 0) {
+                printf("Input error.\n");
+                continue;
+            }
+            int fullScale = (1 << calCurve.bits) - 1;
+            if (code < 0 || code > fullScale) {
+                printf("Code must be between 0 and %d.\n", fullScale);
+                continue;
+            }
+            double volts = code * calCurve.vref / fullScale;
+            printf("Voltage       : %.6f V\n", volts);
+            printf("Exact curve   : %.6f %s\n", cal_curve_eval(&calCurve, volts), calCurve.unit);
+            printf("LUT result    : %.6f %s\n", cal_lookup(&calLut, code), calCurve.unit);
+        } else if (choice == 3) {
+            if (!calLoaded) {
+                printf("No calibration curve loaded.\n");
+                continue;
+            }
+            if (!dataAvailable) {
+                printf("No waveform data available. Please enter samples first.\n");
+                continue;
+            }
+            snapshot_before_change("before calibration");
+            cal_apply(&calLut, samples, samples, sampleCount);
+            printf("%d samples converted to %s.\n", sampleCount, calCurve.unit);
+        } else {
+            printf("Invalid choice.\n");
+        }
+    }
+
+    go_back_to_main();
+}
+
+// 25) Batch unit conversion (columns)
+//
+// Converts a whole column in one multiply-add pass using the unit tables.
+// Sources: the sample buffer (in-place), one column of a CSV file, or one
+// column of a binary file of doubles with a fixed number of columns.
+void menu_item_25(void)
+{
+    char from[UNIT_TEXT], to[UNIT_TEXT];
+    char inName[100], outName[100];
+    char line[1024];                  // one CSV row
+    double scale, offset;
+    int source, column = 1, nCols = 1;
+    FILE *in, *out;
+
+    printf("\n>> Menu 25: Batch unit conversion\n");
+    printf("Convert what?\n");
+    printf(" 1) Sample buffer (in-place)\n");
+    printf(" 2) Column of a CSV file\n");
+    printf(" 3) Column of a binary file of doubles\n");
+
+    if (safe_get_int("Enter choice (1–3): ", &source) != 0 ||
+        safe_get_text("From unit (e.g. mV): ", from, sizeof(from)) != 0 ||
+        safe_get_text("To unit (e.g. V): ", to, sizeof(to)) != 0) {
+        printf("Input error.\n");
+        go_back_to_main();
+        return;
+    }
+    if (source < 1 || source > 3) {
+        printf("Invalid choice.\n");
+        go_back_to_main();
+        return;
+    }
+    if (unit_conversion(from, to, &scale, &offset) != 0) {
+        go_back_to_main();
+        return;
+    }
+    printf("Conversion: %s = %.10g * %s + %.10g\n", to, scale, from, offset);
+
+    if (source == 1) {
+        if (!dataAvailable) {
+            printf("No waveform data available. Please enter samples first.\n");
+        } else {
+            snapshot_before_change("before unit conversion");
+            scale_offset_column(samples, sampleCount, 1, scale, offset);
+            printf("%d samples converted from %s to %s.\n", sampleCount, from, to);
+        }
+        go_back_to_main();
+        return;
+    }
+
+    if (safe_get_filename("Input filename: ", inName, sizeof(inName)) != 0 ||
+        (source == 3 && safe_get_int("Columns per row: ", &nCols) != 0) ||
+        safe_get_int("Column to convert (1 = first): ", &column) != 0 ||
+        safe_get_filename("Output filename: ", outName, sizeof(outName)) != 0) {
+        printf("Input error.\n");
+        go_back_to_main();
+        return;
+    }
+    if (nCols < 1 || column < 1 || (source == 3 && column > nCols)) {
+        printf("Invalid column.\n");
+        go_back_to_main();
+        return;
+    }
+
+    in = fopen(inName, (source == 3) ? "rb" : "r");
+    if (in == NULL) {
+        printf("Could not open input file.\n");
+        go_back_to_main();
+        return;
+    }
+    out = fopen(outName, (source == 3) ? "wb" : "w");
+    if (out == NULL) {
+        printf("Could not open output file for writing.\n");
+        fclose(in);
+        go_back_to_main();
+        return;
+    }
+
+    long converted = 0, passed = 0, lineNo = 0;
+    int writeFailed = 0, tooLong = 0;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    if (source == 3) {
+        // whole rows per block so the column stride stays fixed
+        static double block[1 << 18];   // 2 MB
+        size_t rowsPerBlock = sizeof(block) / sizeof(double) / (size_t)nCols;
+        size_t got;
+        if (rowsPerBlock == 0) {
+            printf("Too many columns.\n");
+        }
+        while (rowsPerBlock > 0 &&
+               (got = fread(block, sizeof(double) * (size_t)nCols, rowsPerBlock, in)) > 0) {
+            scale_offset_column(&block[column - 1], (long)got, nCols, scale, offset);
+            if (fwrite(block, sizeof(double) * (size_t)nCols, got, out) != got) {
+                writeFailed = 1;
+                break;
+            }
+            converted += (long)got;
+        }
+    } else {
+        while (fgets(line, sizeof(line), in) != NULL) {
+            char *field = line;
+            int col = 1, done = 0;
+
+            // a row that does not fit would be split into two rows
+            lineNo++;
+            if (strchr(line, '\n') == NULL && !feof(in)) {
+                tooLong = 1;
+                break;
+            }
+            line[strcspn(line, "\r\n")] = '\0';
+
+            // copy fields through, converting only the chosen column
+            while (!done) {
+                char *comma = strchr(field, ',');
+                if (comma != NULL) *comma = '\0'; else done = 1;
+
+                char *end;
+                double v = strtod(field, &end);
+                while (*end == ' ' || *end == '\t') end++;
+                if (col == column && end != field && *end == '\0') {
+                    fprintf(out, "%.10g", v * scale + offset);
+                    converted++;
+                } else {
+                    if (col == column) passed++;   // header or text cell
+                    fputs(field, out);
+                }
+                if (!done) {
+                    fputc(',', out);
+                    field = comma + 1;
+                    col++;
+                }
+            }
+            if (fputc('\n', out) == EOF) {
+                writeFailed = 1;
+                break;
+            }
+        }
+    }
+
+    double seconds = elapsed_seconds(&start);
+    fclose(in);
+    if (ferror(out)) {
+        writeFailed = 1;
+    }
+    if (fclose(out) != 0) {
+        writeFailed = 1;
+    }
+    if (writeFailed) {
+        printf("Error while writing output file: %s is incomplete.\n", outName);
+    }
+    if (tooLong) {
+        printf("Line %ld is longer than %d characters: stopped there, output is incomplete.\n",
+               lineNo, (int)sizeof(line) - 2);
+    }
+
+    printf("Values converted : %ld\n", converted);
+    if (passed > 0) {
+        printf("Cells copied     : %ld (not numbers, e.g. headers)\n", passed);
+    }
+    printf("Time             : %.3f s\n", seconds);
+    if (!writeFailed && !tooLong) {
+        printf("Output written to %s\n", outName);
+    }
+
+    go_back_to_main();
+}
+
+// 26) Formula transform / calculator
+//
+// The formula is compiled once to stack-machine code, then run over the
+// sample buffer EXPR_BLOCK samples at a time (each instruction is a tight
+// loop over the block). Variables: x (sample), i (index). Constants:
+// pi, n, mean, rms, min, max (taken from the buffer before the transform).
+void menu_item_26(void)
+{
+    char text[EXPR_TEXT];
+    int mode;
+    ExprProgram prog;
+
+    printf("\n>> Menu 26: Formula transform / calculator\n");
+    printf("Operators: + - * / ^ and ( )\n");
+    printf("Functions: abs sqrt sin cos tan exp log log10 min(a,b) max(a,b)\n");
+    printf("Variables: x = sample value, i = sample index\n");
+    printf("Constants: pi n mean rms min max (from the current samples)\n");
+    printf(" 1) Apply formula to every sample (in-place)\n");
+    printf(" 2) Evaluate once for a given x (calculator)\n");
+
+    if (safe_get_int("Enter choice (1–2): ", &mode) != 0 ||
+        safe_get_text("Formula: ", text, sizeof(text)) != 0) {
+        printf("Input error.\n");
+        go_back_to_main();
+        return;
+    }
+    if (mode != 1 && mode != 2) {
+        printf("Invalid choice.\n");
+        go_back_to_main();
+        return;
+    }
+    if (mode == 1 && !dataAvailable) {
+        printf("No waveform data available. Please enter samples first.\n");
+        go_back_to_main();
+        return;
+    }
+
+    memset(&prog, 0, sizeof(prog));
+    if (dataAvailable) {
+        prog.mean = calc_average(samples, sampleCount);
+        prog.rms  = calc_rms(samples, sampleCount);
+        prog.min  = find_min(samples, sampleCount);
+        prog.max  = find_max(samples, sampleCount);
+        prog.n    = sampleCount;
+    }
+
+    if (expr_compile(text, &prog) != 0) {
+        printf("Formula error: %s\n", prog.error);
+        go_back_to_main();
+        return;
+    }
+    printf("Compiled to %d instructions (stack depth %d).\n", prog.length, prog.maxDepth);
+
+    if (mode == 2) {
+        double x, result;
+        if (safe_get_double("Enter x: ", &x) != 0) {
+            printf("Input error.\n");
+        } else {
+            expr_evaluate(&prog, &x, &result, 1);
+            printf("Result: %.6f\n", result);
+        }
+        go_back_to_main();
+        return;
+    }
+
+    snapshot_before_change("before formula");
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    expr_evaluate(&prog, samples, samples, sampleCount);
+    double seconds = elapsed_seconds(&start);
+
+    printf("%d samples transformed (%.2f ns/sample).\n", sampleCount,
+           seconds * 1e9 / sampleCount);
+
+    go_back_to_main();
+}
+
+// 27) Monte Carlo tolerance analysis
+//
+// Each part is drawn from a uniform (±tol) or Gaussian (tol = 3 sigma,
+// clipped at ±2 tol) distribution. Trials are grouped into fixed streams of
+// MC_STREAM trials with their own xoshiro256+ seed, so the result does not
+// depend on how many threads share the work. Percentiles come from a
+// MC_BINS histogram over the range the parts can reach, so no trial is
+// stored and 10^8 trials need no extra memory.
+void menu_item_27(void)
+{
+    McRun run;
+    int circuit, dist, trialsIn;
+    double tolPct;
+
+    printf("\n>> Menu 27: Monte Carlo tolerance analysis\n");
+    printf(" 1) Resistors in series\n");
+    printf(" 2) Resistors in parallel\n");
+    printf(" 3) RC filter cut-off frequency\n");
+
+    memset(&run, 0, sizeof(run));
+
+    if (safe_get_int("Enter choice (1–3): ", &circuit) != 0) {
+        printf("Input error.\n");
+        go_back_to_main();
+        return;
+    }
+    if (circuit < 1 || circuit > 3) {
+        printf("Invalid choice.\n");
+        go_back_to_main();
+        return;
+    }
+    run.circuit = circuit;
+
+    if (circuit == 3) {
+        run.nParts = 2;
+        if (safe_get_double("R (ohms): ", &run.nominal[0]) != 0 ||
+            safe_get_double("R tolerance (%, e.g. 1, 5, 10): ", &tolPct) != 0) {
+            printf("Input error.\n");
+            go_back_to_main();
+            return;
+        }
+        run.tol[0] = tolPct / 100.0;
+        if (safe_get_double("C (farads): ", &run.nominal[1]) != 0 ||
+            safe_get_double("C tolerance (%, e.g. 5, 10, 20): ", &tolPct) != 0) {
+            printf("Input error.\n");
+            go_back_to_main();
+            return;
+        }
+        run.tol[1] = tolPct / 100.0;
+    } else {
+        if (safe_get_int("How many resistors (1–20)? ", &run.nParts) != 0) {
+            printf("Input error.\n");
+            go_back_to_main();
+            return;
+        }
+        if (run.nParts < 1 || run.nParts > MC_MAX_PARTS) {
+            printf("Invalid number of resistors.\n");
+            go_back_to_main();
+            return;
+        }
+        for (int i = 0; i < run.nParts; i++) {
+            char prompt[50];
+            snprintf(prompt, sizeof(prompt), "R%d (ohms): ", i + 1);
+            if (safe_get_double(prompt, &run.nominal[i]) != 0) {
+                printf("Input error.\n");
+                go_back_to_main();
+                return;
+            }
+        }
+        if (safe_get_double("Tolerance for all resistors (%, e.g. 1, 5, 10): ", &tolPct) != 0) {
+            printf("Input error.\n");
+            go_back_to_main();
+            return;
+        }
+        for (int i = 0; i < run.nParts; i++) {
+            run.tol[i] = tolPct / 100.0;
+        }
+    }
+
+    for (int i = 0; i < run.nParts; i++) {
+        if (run.nominal[i] <= 0.0 || run.tol[i] < 0.0 || run.tol[i] >= 0.5) {
+            printf("Values must be positive and tolerances below 50%%.\n");
+            go_back_to_main();
+            return;
+        }
+    }
+
+    printf("Distribution:\n");
+    printf(" 1) Uniform (anywhere within ±tol)\n");
+    printf(" 2) Gaussian (tol = 3 sigma)\n");
+    if (safe_get_int("Enter choice (1–2): ", &dist) != 0 ||
+        safe_get_int("Number of trials (1–100000000): ", &trialsIn) != 0) {
+        printf("Input error.\n");
+        go_back_to_main();
+        return;
+    }
+    if ((dist != 1 && dist != 2) || trialsIn < 1 || trialsIn > 100000000) {
+        printf("Invalid distribution or number of trials.\n");
+        go_back_to_main();
+        return;
+    }
+    run.gaussian = (dist == 2);
+    run.trials = trialsIn;
+    run.seed = 0x2645ULL;
+
+    // every circuit output is monotonic in each part, so the extreme part
+    // values give the histogram range
+    double spread = run.gaussian ? 2.0 : 1.0;
+    double lowParts[MC_MAX_PARTS], highParts[MC_MAX_PARTS], nominal;
+    for (int i = 0; i < run.nParts; i++) {
+        lowParts[i] = run.nominal[i] * (1.0 - spread * run.tol[i]);
+        highParts[i] = run.nominal[i] * (1.0 + spread * run.tol[i]);
+    }
+    run.lo = mc_circuit_value(&run, lowParts);
+    run.hi = mc_circuit_value(&run, highParts);
+    nominal = mc_circuit_value(&run, run.nominal);
+    if (run.lo > run.hi) {
+        double t = run.lo; run.lo = run.hi; run.hi = t;
+    }
+    if (run.hi <= run.lo) {
+        run.hi = run.lo + fabs(run.lo) * 1e-12 + 1e-300;   // zero tolerance
+    }
+
+    long nStreams = (run.trials + MC_STREAM - 1) / MC_STREAM;
+    run.hist = calloc(MC_BINS, sizeof(long));
+    run.streamSum = malloc((size_t)nStreams * sizeof(double));
+    run.streamSumSq = malloc((size_t)nStreams * sizeof(double));
+    run.streamMin = malloc((size_t)nStreams * sizeof(double));
+    run.streamMax = malloc((size_t)nStreams * sizeof(double));
+    if (run.hist == NULL || run.streamSum == NULL || run.streamSumSq == NULL ||
+        run.streamMin == NULL || run.streamMax == NULL) {
+        printf("Not enough memory.\n");
+    } else {
+        struct timespec start;
+        pthread_mutex_init(&run.lock, NULL);
+        run.failed = 0;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        parallel_range(nStreams, 1, mc_range, &run);
+        double seconds = elapsed_seconds(&start);
+        pthread_mutex_destroy(&run.lock);
+
+        if (run.failed) {
+            printf("Not enough memory for the simulation.\n");
+        } else {
+            // combine streams in a fixed order
+            double sum = 0.0, sumSq = 0.0, mn = run.streamMin[0], mx = run.streamMax[0];
+            for (long b = 0; b < nStreams; b++) {
+                sum += run.streamSum[b];
+                sumSq += run.streamSumSq[b];
+                if (run.streamMin[b] < mn) mn = run.streamMin[b];
+                if (run.streamMax[b] > mx) mx = run.streamMax[b];
+            }
+            double mean = sum / run.trials;
+            double var = sumSq / run.trials - mean * mean;
+            double sd = (var > 0.0) ? sqrt(var) : 0.0;
+            const char *unit = (circuit == 3) ? "Hz" : "ohms";
+
+            printf("\nTrials            : %ld (%d thread(s), %.3f s)\n", run.trials,
+                   worker_count(), seconds);
+            printf("Nominal value     : %.6g %s\n", nominal, unit);
+            printf("Mean              : %.6g %s\n", mean, unit);
+            printf("Std deviation     : %.6g %s (%.3f%% of mean)\n", sd, unit, sd / mean * 100.0);
+            printf("Min / max seen    : %.6g / %.6g %s\n", mn, mx, unit);
+
+            static const double PCT[] = { 0.1, 1.0, 5.0, 50.0, 95.0, 99.0, 99.9 };
+            for (size_t k = 0; k < sizeof(PCT) / sizeof(PCT[0]); k++) {
+                printf("P%-5g            : %.6g %s\n", PCT[k],
+                       hist_percentile(run.hist, MC_BINS, run.lo, run.hi, run.trials, PCT[k]),
+                       unit);
+            }
+
+            // 20-bar text histogram between the observed min and max
+            long bars[20] = { 0 }, tallest = 1;
+            double binW = (run.hi - run.lo) / MC_BINS;
+            for (int b = 0; b < MC_BINS; b++) {
+                double centre = run.lo + (b + 0.5) * binW;
+                int bar = (mx > mn) ? (int)((centre - mn) / (mx - mn) * 20.0) : 0;
+                if (run.hist[b] == 0) continue;
+                if (bar < 0) bar = 0;
+                if (bar > 19) bar = 19;
+                bars[bar] += run.hist[b];
+            }
+            for (int k = 0; k < 20; k++) {
+                if (bars[k] > tallest) tallest = bars[k];
+            }
+            printf("\nDistribution:\n");
+            for (int k = 0; k < 20; k++) {
+                int len = (int)(bars[k] * 50 / tallest);
+                printf("%12.6g | ", mn + (k + 0.5) * (mx - mn) / 20.0);
+                for (int j = 0; j < len; j++) putchar('#');
+                printf(" %ld\n", bars[k]);
+            }
+        }
+    }
+
+    free(run.hist);
+    free(run.streamSum);
+    free(run.streamSumSq);
+    free(run.streamMin);
+    free(run.streamMax);
+    go_back_to_main();
+}
+
+// 28) Sample history (undo / redo / named versions)
+//
+// Menus that overwrite samples[] save the old contents first. Versions are
+// stored as SNAP_CHUNK-sample chunks, and a chunk equal to the same chunk of
+// the previous version is shared instead of copied, so keeping the raw,
+// smoothed and filtered versions of a capture costs little more than the
+// chunks that actually differ.
+void menu_item_28(void)
+{
+    int running = 1;
+    int choice;
+
+    printf("\n>> Menu 28: Sample history\n");
+
+    while (running) {
+        printf("\nChoose an option:\n");
+        printf(" 1) Undo last change\n");
+        printf(" 2) Redo\n");
+        printf(" 3) Save current samples as a named version\n");
+        printf(" 4) Restore a named version\n");
+        printf(" 5) Delete a named version\n");
+        printf(" 6) List history and memory use\n");
+        printf(" 0) Return to main menu\n");
+
+        if (safe_get_int("Enter choice (0–6): ", &choice) != 0) {
+            printf("Input error.\n");
+            continue;
+        }
+
+        switch (choice) {
+            case 0:
+                running = 0;
+                break;
+
+            case 1:
+            case 2: {
+                SnapVersion **from = (choice == 1) ? undoStack : redoStack;
+                SnapVersion **to = (choice == 1) ? redoStack : undoStack;
+                int *fromCount = (choice == 1) ? &undoCount : &redoCount;
+                int *toCount = (choice == 1) ? &redoCount : &undoCount;
+
+                if (*fromCount == 0) {
+                    printf("Nothing to %s.\n", (choice == 1) ? "undo" : "redo");
+                    break;
+                }
+                SnapVersion *current = snapshot_capture("current samples");
+                SnapVersion *target = from[--(*fromCount)];
+                if (current != NULL && target->ref != NULL) {
+                    // the entry also holds the reference: swap that back too
+                    current->ref = snapshot_from_array("reference", refSamples, refCount);
+                    if (current->ref == NULL) {
+                        snapshot_release(current);
+                        current = NULL;
+                    }
+                }
+                if (current == NULL ||
+                    (target->ref != NULL && snapshot_restore_ref(target->ref) != 0)) {
+                    printf("Not enough memory.\n");
+                    snapshot_release(current);
+                    (*fromCount)++;
+                    break;
+                }
+                snapshot_push(to, toCount, current);
+                snapshot_restore(target);
+                printf("%s: restored %d samples (%s).\n", (choice == 1) ? "Undo" : "Redo",
+                       target->count, target->name);
+                if (target->ref != NULL) {
+                    printf("Reference restored too: %d samples.\n", refCount);
+                }
+                snapshot_release(target);
+                break;
+            }
+
+            case 3: {
+                char name[SNAP_NAME];
+                if (!dataAvailable) {
+                    printf("No waveform data available. Please enter samples first.\n");
+                    break;
+                }
+                if (safe_get_text("Version name: ", name, sizeof(name)) != 0) {
+                    printf("Input error.\n");
+                    break;
+                }
+                SnapVersion *v = snapshot_capture(name);
+                if (v == NULL) {
+                    printf("Not enough memory.\n");
+                    break;
+                }
+                int slot = -1;
+                for (int k = 0; k < namedCount; k++) {
+                    if (strcmp(namedVersions[k]->name, name) == 0) slot = k;
+                }
+                if (slot >= 0) {
+                    snapshot_release(namedVersions[slot]);
+                    namedVersions[slot] = v;
+                    printf("Version '%s' replaced.\n", name);
+                } else if (namedCount < SNAP_NAMED) {
+                    namedVersions[namedCount++] = v;
+                    printf("Version '%s' saved (%d samples).\n", name, v->count);
+                } else {
+                    snapshot_release(v);
+                    printf("Too many named versions (max %d). Delete one first.\n", SNAP_NAMED);
+                }
+                break;
+            }
+
+            case 4:
+            case 5: {
+                char name[SNAP_NAME];
+                int slot = -1;
+                if (safe_get_text("Version name: ", name, sizeof(name)) != 0) {
+                    printf("Input error.\n");
+                    break;
+                }
+                for (int k = 0; k < namedCount; k++) {
+                    if (strcmp(namedVersions[k]->name, name) == 0) slot = k;
+                }
+                if (slot < 0) {
+                    printf("No version called '%s'.\n", name);
+                    break;
+                }
+                if (choice == 4) {
+                    snapshot_before_change("before restoring a version");
+                    snapshot_restore(namedVersions[slot]);
+                    printf("Version '%s' restored (%d samples).\n", name, sampleCount);
+                } else {
+                    snapshot_release(namedVersions[slot]);
+                    namedVersions[slot] = namedVersions[--namedCount];
+                    printf("Version '%s' deleted.\n", name);
+                }
+                break;
+            }
+
+            case 6: {
+                long logical, stored;
+                printf("Undo history (newest last):\n");
+                for (int k = 0; k < undoCount; k++) {
+                    printf("  %2d) %-30s %d samples\n", k + 1, undoStack[k]->name,
+                           undoStack[k]->count);
+                }
+                printf("Redo entries: %d\n", redoCount);
+                printf("Named versions:\n");
+                for (int k = 0; k < namedCount; k++) {
+                    printf("  %-32s %d samples\n", namedVersions[k]->name,
+                           namedVersions[k]->count);
+                }
+                snapshot_memory(&logical, &stored);
+                printf("Versions hold %.1f kB of samples, stored in %.1f kB of chunks.\n",
+                       logical / 1e3, stored / 1e3);
+                break;
+            }
+
+            default:
+                printf("Invalid choice.\n");
+                break;
+        }
+    }
+
+    go_back_to_main();
+}
+
+// 29) Live acquisition
+//
+// A reader thread pulls numbers from a FIFO, pipe or growing file and pushes
+// them into a lock-free single-producer / single-consumer ring. This thread
+// drains the ring, keeps statistics for each refresh interval and prints
+// them at a fixed rate, so a slow terminal never blocks the reader. When
+// the ring is full the reader either waits (back-pressure, counted as
+// stalls) or drops the new samples (counted as dropped).
+void menu_item_29(void)
+{
+    char path[100];
+    int format, atEnd, whenFull, keep;
+    double refreshHz, duration;
+    LiveRun *run;
+    pthread_t reader;
+    LiveStats interval, total;
+    double block[LIVE_BLOCK];
+    struct timespec start;
+    double nextRefresh, lastRefresh = 0.0;
+    size_t maxFill = 0;
+    long kept = 0;
+
+    printf("\n>> Menu 29: Live acquisition\n");
+
+    if (safe_get_filename("Source (FIFO, pipe or file): ", path, sizeof(path)) != 0) {
+        printf("Input error.\n");
+        go_back_to_main();
+        return;
+    }
+
+    printf("Data format:\n");
+    printf(" 1) Text numbers (space, comma or newline separated)\n");
+    printf(" 2) Binary doubles\n");
+    if (safe_get_int("Enter choice (1–2): ", &format) != 0) {
+        printf("Input error.\n");
+        go_back_to_main();
+        return;
+    }
+
+    printf("At end of data:\n");
+    printf(" 1) Stop (FIFO / pipe / finished file)\n");
+    printf(" 2) Keep waiting for more (file being appended)\n");
+    if (safe_get_int("Enter choice (1–2): ", &atEnd) != 0) {
+        printf("Input error.\n");
+        go_back_to_main();
+        return;
+    }
+
+    printf("When the buffer is full:\n");
+    printf(" 1) Make the reader wait (back-pressure)\n");
+    printf(" 2) Drop new samples\n");
+    if (safe_get_int("Enter choice (1–2): ", &whenFull) != 0) {
+        printf("Input error.\n");
+        go_back_to_main();
+        return;
+    }
+
+    if (safe_get_double("Refresh rate (Hz, e.g. 2): ", &refreshHz) != 0 ||
+        safe_get_double("Run time (s, 0 = until end of data): ", &duration) != 0 ||
+        safe_get_int("Keep captured samples in the buffer (1 = yes, 0 = no): ", &keep) != 0) {
+        printf("Input error.\n");
+        go_back_to_main();
+        return;
+    }
+
+    if ((format != 1 && format != 2) || (atEnd != 1 && atEnd != 2) ||
+        (whenFull != 1 && whenFull != 2)) {
+        printf("Invalid choice.\n");
+        go_back_to_main();
+        return;
+    }
+    if (refreshHz <= 0.0 || refreshHz > 100.0 || duration < 0.0) {
+        printf("Refresh rate must be in (0, 100] Hz and run time must not be negative.\n");
+        go_back_to_main();
+        return;
+    }
+    if (atEnd == 2 && duration == 0.0) {
+        printf("Waiting for more data needs a run time.\n");
+        go_back_to_main();
+        return;
+    }
+
+    run = calloc(1, sizeof(LiveRun));
+    if (run == NULL || spsc_init(&run->ring, LIVE_RING) != 0) {
+        printf("Not enough memory.\n");
+        if (run != NULL) free(run->ring.data);
+        free(run);
+        go_back_to_main();
+        return;
+    }
+    run->binary = (format == 2);
+    run->follow = (atEnd == 2);
+    run->block = (whenFull == 1);
+
+    printf("Opening %s (a FIFO waits here for a writer)...\n", path);
+    run->fd = open(path, O_RDONLY);
+    if (run->fd < 0) {
+        printf("Could not open source: %s\n", strerror(errno));
+        free(run->ring.data);
+        free(run);
+        go_back_to_main();
+        return;
+    }
+
+    if (keep) {
+        snapshot_before_change("before live capture");
+    }
+
+    if (pthread_create(&reader, NULL, live_reader_thread, run) != 0) {
+        printf("Could not start the reader thread.\n");
+        close(run->fd);
+        free(run->ring.data);
+        free(run);
+        go_back_to_main();
+        return;
+    }
+
+    live_stats_reset(&interval);
+    interval.haveLast = 0;
+    live_stats_reset(&total);
+    total.haveLast = 0;
+
+    printf("\n%7s %9s %10s %10s %10s %6s %6s %6s %9s %7s\n", "time(s)", "rate/s",
+           "min", "max", "RMS", "crest", "zc", "fill", "dropped", "stalls");
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    nextRefresh = 1.0 / refreshHz;
+
+    while (1) {
+        int finished = atomic_load(&run->done);
+        size_t fill = spsc_fill(&run->ring);
+        size_t got = spsc_pop(&run->ring, block, LIVE_BLOCK);
+        double t;
+
+        if (fill > maxFill) maxFill = fill;
+        if (got > 0) {
+            live_stats_add(&interval, block, (long)got);
+            if (keep && kept < SAMPLE_BUF_SIZE) {
+                long room = SAMPLE_BUF_SIZE - kept;
+                long len = ((long)got < room) ? (long)got : room;
+                memcpy(&samples[kept], block, (size_t)len * sizeof(double));
+                kept += len;
+            }
+        }
+
+        t = elapsed_seconds(&start);
+        finished = finished && got == 0;
+        if (duration > 0.0 && t >= duration) {
+            finished = 1;
+        }
+
+        if (t >= nextRefresh || finished) {
+            live_print_stats(t, &interval, t - lastRefresh, fill, LIVE_RING,
+                             atomic_load(&run->dropped), atomic_load(&run->stalls));
+            live_stats_merge(&total, &interval);
+            live_stats_reset(&interval);
+            lastRefresh = t;
+            nextRefresh += 1.0 / refreshHz;
+            if (nextRefresh < t) nextRefresh = t + 1.0 / refreshHz;
+        }
+
+        if (finished) {
+            break;
+        }
+        if (got == 0) {
+            pause_microseconds(1000);
+        }
+    }
+
+    atomic_store(&run->stop, 1);
+    pthread_join(reader, NULL);
+    close(run->fd);
+
+    printf("\nLive acquisition finished after %.2f s.\n", elapsed_seconds(&start));
+    if (run->readError != 0) {
+        printf("Read error: %s\n", strerror(run->readError));
+    }
+    printf("Samples received  : %ld\n", atomic_load(&run->received));
+    printf("Samples analysed  : %ld\n", total.n);
+    printf("Samples dropped   : %ld\n", atomic_load(&run->dropped));
+    printf("Reader stalls     : %ld (waits for buffer space)\n", atomic_load(&run->stalls));
+    printf("Peak buffer fill  : %.1f%% of %d samples\n", 100.0 * maxFill / LIVE_RING, LIVE_RING);
+    if (atomic_load(&run->badTokens) > 0) {
+        printf("Skipped text      : %ld tokens that were not numbers\n",
+               atomic_load(&run->badTokens));
+    }
+    if (total.n > 0) {
+        double rms = sqrt(total.sumSq / total.n);
+        printf("Overall min / max : %.4f / %.4f\n", total.min, total.max);
+        printf("Overall DC / RMS  : %.4f / %.4f\n", total.sum / total.n, rms);
+        printf("Zero-crossings    : %ld\n", total.crossings);
+    }
+
+    if (keep && kept > 0) {
+        sampleCount = (int)kept;
+        dataAvailable = 1;
+        printf("%ld samples kept in the buffer%s.\n", kept,
+               (kept < total.n) ? " (buffer full, later samples not kept)" : "");
+    }
+
+    free(run->ring.data);
+    free(run);
+    go_back_to_main();
+}
+
+// 30) Stream statistics from a large capture file
+//
+// Works on binary doubles of any size, including FIFOs and pipes that
+// cannot be mapped into memory. With read-ahead on, a background thread
+// reads block N+1 while block N goes through the normal analysis helpers,
+// so the run takes about max(I/O, compute) instead of their sum. The
+// plain mode reads and analyses in turn, for comparison.
+void menu_item_30(void)
+{
+    char path[100];
+    int readAhead, blockKb;
+    BlockReader reader;
+    const double *block;
+    long n;
+    long long total = 0;
+    double mn = INFINITY, mx = -INFINITY, sum = 0.0, sumSq = 0.0;
+    long long crossings = 0;
+    double last = 0.0;
+    double computeSeconds = 0.0, totalSeconds;
+    struct timespec start, t0;
+    int quantiles;
+    static const double STREAM_PCT[STREAM_QUANTILES] = { 1.0, 5.0, 50.0, 95.0, 99.0 };
+    P2Quantile est[STREAM_QUANTILES];
+
+    printf("\n>> Menu 30: Stream statistics from a capture file (binary doubles)\n");
+
+    if (safe_get_filename("Capture file, FIFO or pipe: ", path, sizeof(path)) != 0 ||
+        safe_get_int("Block size (KiB, e.g. 1024): ", &blockKb) != 0 ||
+        safe_get_int("Read ahead on a background thread (1 = yes, 0 = no): ", &readAhead) != 0 ||
+        safe_get_int("Estimate percentiles while streaming (1 = yes, 0 = no): ", &quantiles) != 0) {
+        printf("Input error.\n");
+        go_back_to_main();
+        return;
+    }
+    if (blockKb < 4 || blockKb > 262144) {
+        printf("Block size must be 4 to 262144 KiB.\n");
+        go_back_to_main();
+        return;
+    }
+
+    for (int k = 0; k < STREAM_QUANTILES; k++) {
+        p2_init(&est[k], STREAM_PCT[k] / 100.0);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (block_reader_open(&reader, path, (size_t)blockKb * 1024, readAhead != 0) != 0) {
+        printf("Could not open %s: %s\n", path, strerror(errno));
+        go_back_to_main();
+        return;
+    }
+
+    while ((n = block_reader_next(&reader, &block)) > 0) {
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+
+        double blockMin = find_min(block, (int)n);
+        double blockMax = find_max(block, (int)n);
+        double blockRms = calc_rms(block, (int)n);
+
+        if (blockMin < mn) mn = blockMin;
+        if (blockMax > mx) mx = blockMax;
+        sum += calc_average(block, (int)n) * n;
+        sumSq += blockRms * blockRms * n;
+        crossings += count_zero_crossings(block, (int)n);
+        if (total > 0 && ((last > 0 && block[0] < 0) || (last < 0 && block[0] > 0))) {
+            crossings++;   // crossing between two blocks
+        }
+        last = block[n - 1];
+        total += n;
+        if (quantiles) {
+            // P-squared: five markers per level, nothing else is stored
+            for (long i = 0; i < n; i++) {
+                for (int k = 0; k < STREAM_QUANTILES; k++) p2_add(&est[k], block[i]);
+            }
+        }
+
+        computeSeconds += elapsed_seconds(&t0);
+    }
+    block_reader_close(&reader);
+    totalSeconds = elapsed_seconds(&start);
+
+    if (reader.error != 0) {
+        printf("Read error: %s\n", strerror(reader.error));
+    }
+    if (total == 0) {
+        printf("No samples read.\n");
+        go_back_to_main();
+        return;
+    }
+
+    double dc = sum / total;
+    double rms = sqrt(sumSq / total);
+    double peak = fmax(fabs(mn), fabs(mx));
+
+    printf("Samples           : %lld (%s)\n", total,
+           reader.seekable ? "file, pread" : "pipe / FIFO, read");
+    printf("Min / Max         : %.4f / %.4f\n", mn, mx);
+    printf("Peak-to-peak      : %.4f\n", mx - mn);
+    printf("DC / RMS          : %.4f / %.4f\n", dc, rms);
+    printf("Crest factor      : %.4f\n", (rms > 0.0) ? peak / rms : 0.0);
+    printf("Zero-crossings    : %lld\n", crossings);
+    if (quantiles) {
+        for (int k = 0; k < STREAM_QUANTILES; k++) {
+            printf("P%-2g (estimate)    : %.4f\n", STREAM_PCT[k], p2_result(&est[k]));
+        }
+    }
+    if (reader.bytes % sizeof(double) != 0) {
+        printf("Ignored %lld trailing bytes (not a whole double).\n",
+               reader.bytes % (long long)sizeof(double));
+    }
+    printf("Waiting for data  : %.3f s\n", reader.waitSeconds);
+    printf("Analysis          : %.3f s\n", computeSeconds);
+    printf("Total             : %.3f s (%.1f MB/s)\n", totalSeconds,
+           reader.bytes / 1e6 / (totalSeconds > 0.0 ? totalSeconds : 1e-9));
+
+    go_back_to_main();
+}
+
+// 31) Compressed capture files
+//
+// Samples are stored in blocks of WFC_BLOCK. With a quantisation step each
+// sample becomes an integer multiple of the step, and the differences
+// between neighbours are zigzag coded and bit-packed at the smallest width
+// that fits the block. With step 0 the XOR of neighbouring doubles is
+// packed instead, which is exact. Every block header carries min, max, sum
+// and sum of squares, so whole-file statistics need no decoding at all.
+void menu_item_31(void)
+{
+    int running = 1;
+    int choice;
+    uint8_t *payload = malloc(WFC_MAX_PAYLOAD);
+
+    printf("\n>> Menu 31: Compressed capture files\n");
+
+    if (payload == NULL) {
+        printf("Not enough memory.\n");
+        go_back_to_main();
+        return;
+    }
+
+    while (running) {
+        char filename[100];
+        WfcHeader h;
+        WfcBlock blk;
+        FILE *fp;
+        struct timespec start;
+
+        printf("\nChoose an option:\n");
+        printf(" 1) Save sample buffer to a compressed file\n");
+        printf(" 2) Load a compressed file into the sample buffer\n");
+        printf(" 3) Statistics from block headers (no decoding)\n");
+        printf(" 4) Compress a binary doubles file (any size)\n");
+        printf(" 0) Return to main menu\n");
+
+        if (safe_get_int("Enter choice (0–4): ", &choice) != 0) {
+            printf("Input error.\n");
+            continue;
+        }
+
+        switch (choice) {
+            case 0:
+                running = 0;
+                break;
+
+            case 1:
+            case 4: {
+                char inName[100];
+                double step;
+                double maxErr = 0.0;
+                BlockReader reader;
+                int status = 0;
+
+                if (choice == 1 && !dataAvailable) {
+                    printf("No waveform data available. Please enter samples first.\n");
+                    break;
+                }
+                if (choice == 4 &&
+                    safe_get_filename("Binary doubles file: ", inName, sizeof(inName)) != 0) {
+                    printf("Input error.\n");
+                    break;
+                }
+                if (safe_get_filename("Compressed output file (e.g. capture.wfc): ",
+                                      filename, sizeof(filename)) != 0 ||
+                    safe_get_double("Quantisation step (0 = lossless, e.g. 0.001): ", &step) != 0) {
+                    printf("Input error.\n");
+                    break;
+                }
+                if (step < 0.0) {
+                    printf("Step must not be negative.\n");
+                    break;
+                }
+                if (choice == 4 && block_reader_open(&reader, inName,
+                                                     (size_t)WFC_BLOCK * 32 * sizeof(double), 1) != 0) {
+                    printf("Could not open %s: %s\n", inName, strerror(errno));
+                    break;
+                }
+
+                fp = fopen(filename, "wb");
+                if (fp == NULL || wfc_begin(fp, &h, step) != 0) {
+                    printf("Could not create output file.\n");
+                    if (fp != NULL) fclose(fp);
+                    if (choice == 4) block_reader_close(&reader);
+                    break;
+                }
+
+                clock_gettime(CLOCK_MONOTONIC, &start);
+                if (choice == 1) {
+                    for (int i = 0; i < sampleCount && status == 0; i += WFC_BLOCK) {
+                        int len = (sampleCount - i < WFC_BLOCK) ? sampleCount - i : WFC_BLOCK;
+                        double check[WFC_BLOCK];
+
+                        status = wfc_write_block(fp, &h, &samples[i], len, payload, &blk);
+                        if (status == 0) {
+                            wfc_decode_block(&blk, payload, h.step, check);
+                            for (int k = 0; k < len; k++) {
+                                double err = fabs(check[k] - samples[i + k]);
+                                if (err > maxErr) maxErr = err;
+                            }
+                        }
+                    }
+                } else {
+                    const double *data;
+                    long n;
+                    while (status == 0 && (n = block_reader_next(&reader, &data)) > 0) {
+                        for (long i = 0; i < n && status == 0; i += WFC_BLOCK) {
+                            int len = (n - i < WFC_BLOCK) ? (int)(n - i) : WFC_BLOCK;
+                            status = wfc_write_block(fp, &h, data + i, len, payload, &blk);
+                        }
+                    }
+                    if (reader.error != 0) {
+                        printf("Read error: %s\n", strerror(reader.error));
+                    }
+                    block_reader_close(&reader);
+                }
+                if (status == 0 && wfc_finish(fp, &h) != 0) {
+                    status = -1;
+                }
+                double seconds = elapsed_seconds(&start);
+                long fileBytes = (fseek(fp, 0, SEEK_END) == 0) ? ftell(fp) : 0;
+                fclose(fp);
+
+                if (status == -2) {
+                    printf("A sample is not finite or too large for step %g; use step 0.\n", step);
+                    break;
+                }
+                if (status != 0) {
+                    printf("Error writing %s.\n", filename);
+                    break;
+                }
+
+                double rawBytes = (double)h.count * sizeof(double);
+                printf("Samples           : %llu in %llu blocks (%s)\n",
+                       (unsigned long long)h.count, (unsigned long long)h.nBlocks,
+                       h.lossless ? "lossless" : "quantised");
+                printf("Raw / compressed  : %.0f / %ld bytes (%.2fx, %.2f bits per sample)\n",
+                       rawBytes, fileBytes, (fileBytes > 0) ? rawBytes / fileBytes : 0.0,
+                       (h.count > 0) ? fileBytes * 8.0 / h.count : 0.0);
+                if (choice == 1) {
+                    printf("Max error         : %g\n", maxErr);
+                }
+                printf("Encode time       : %.3f s (%.1f MB/s of samples)\n", seconds,
+                       rawBytes / 1e6 / (seconds > 0.0 ? seconds : 1e-9));
+                break;
+            }
+
+            case 2:
+            case 3: {
+                double mn = INFINITY, mx = -INFINITY, sum = 0.0, sumSq = 0.0;
+                double decodeSeconds = 0.0;
+                long long total = 0;
+                int bad = 0;
+
+                if (safe_get_filename("Compressed file: ", filename, sizeof(filename)) != 0) {
+                    printf("Input error.\n");
+                    break;
+                }
+                fp = fopen(filename, "rb");
+                if (fp == NULL) {
+                    printf("Could not open %s.\n", filename);
+                    break;
+                }
+                if (wfc_read_header(fp, &h) != 0) {
+                    fclose(fp);
+                    break;
+                }
+                if (choice == 2) {
+                    snapshot_before_change("before loading a compressed file");
+                }
+
+                clock_gettime(CLOCK_MONOTONIC, &start);
+                for (uint64_t b = 0; b < h.nBlocks; b++) {
+                    if (choice == 2 && total + WFC_BLOCK > SAMPLE_BUF_SIZE) {
+                        break;   // buffer full
+                    }
+                    if (wfc_read_block(fp, &blk, (choice == 2) ? payload : NULL) != 0) {
+                        bad = 1;
+                        break;
+                    }
+                    if (choice == 2) {
+                        struct timespec t0;
+                        clock_gettime(CLOCK_MONOTONIC, &t0);
+                        wfc_decode_block(&blk, payload, h.step, &samples[total]);
+                        decodeSeconds += elapsed_seconds(&t0);
+                    }
+                    if (blk.min < mn) mn = blk.min;
+                    if (blk.max > mx) mx = blk.max;
+                    sum += blk.sum;
+                    sumSq += blk.sumSq;
+                    total += blk.n;
+                }
+                double seconds = elapsed_seconds(&start);
+                fclose(fp);
+
+                if (bad) {
+                    printf("File is truncated or damaged after %lld samples.\n", total);
+                }
+                if (total == 0) {
+                    printf("No samples in file.\n");
+                    break;
+                }
+                if (choice == 2) {
+                    sampleCount = (int)total;
+                    dataAvailable = 1;
+                    printf("Loaded %lld samples%s.\n", total,
+                           (total < (long long)h.count && !bad) ? " (buffer full, rest not loaded)" : "");
+                    printf("Decode time       : %.3f s (%.2f GB/s of samples)\n", decodeSeconds,
+                           total * 8.0 / 1e9 / (decodeSeconds > 0.0 ? decodeSeconds : 1e-9));
+                    printf("Total load time   : %.3f s\n", seconds);
+                } else {
+                    printf("Samples           : %lld in %llu blocks\n", total,
+                           (unsigned long long)h.nBlocks);
+                    printf("Min / Max         : %.4f / %.4f\n", mn, mx);
+                    printf("Peak-to-peak      : %.4f\n", mx - mn);
+                    printf("DC / RMS          : %.4f / %.4f\n", sum / total, sqrt(sumSq / total));
+                    printf("Time              : %.4f s (headers only)\n", seconds);
+                }
+                break;
+            }
+
+            default:
+                printf("Invalid choice.\n");
+                break;
+        }
+    }
+
+    free(payload);
+    go_back_to_main();
+}
+
+// 32) Capture summary index
+//
+// Opens a capture of binary doubles of any size and builds a summary
+// pyramid over it: level 0 keeps min, max, sum and sum of squares per
+// PYR_BASE samples and each level above combines PYR_FANOUT nodes. A range
+// query reads at most two partial blocks from the file and a few nodes per
+// level, so stats for any window of a 10^9-sample capture come back at
+// once. The index is saved as <capture>.pyr and reused while the capture
+// is unchanged.
+void menu_item_32(void)
+{
+    int running = 1;
+    int choice;
+
+    printf("\n>> Menu 32: Capture summary index\n");
+
+    while (running) {
+        printf("\nChoose an option:\n");
+        printf(" 1) Open a capture file (binary doubles)\n");
+        printf(" 2) Statistics for a sample range\n");
+        printf(" 3) Overview waveform\n");
+        printf(" 0) Return to main menu\n");
+
+        if (safe_get_int("Enter choice (0–3): ", &choice) != 0) {
+            printf("Input error.\n");
+            continue;
+        }
+
+        if (choice == 0) {
+            running = 0;
+        } else if (choice == 1) {
+            char path[100];
+            struct timespec start;
+            int reused = 0;
+
+            if (safe_get_filename("Capture file: ", path, sizeof(path)) != 0) {
+                printf("Input error.\n");
+                continue;
+            }
+            if (pyrLoaded) {
+                pyramid_close(&capturePyr);
+                pyrLoaded = 0;
+            }
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            if (pyramid_open(&capturePyr, path, &reused) != 0) {
+                continue;
+            }
+            pyrLoaded = 1;
+            printf("%lld samples, %d levels (%s in %.3f s)\n", capturePyr.count,
+                   capturePyr.levels, reused ? "index reused" : "index built and saved",
+                   elapsed_seconds(&start));
+        } else if (choice == 2 || choice == 3) {
+            double from, to;
+            long long s, e;
+            SummaryNode r;
+            struct timespec start;
+
+            if (!pyrLoaded) {
+                printf("Open a capture file first.\n");
+                continue;
+            }
+            printf("Range [start, end) in samples, 0 0 = whole capture (%lld samples)\n",
+                   capturePyr.count);
+            if (safe_get_double("Start sample: ", &from) != 0 ||
+                safe_get_double("End sample: ", &to) != 0) {
+                printf("Input error.\n");
+                continue;
+            }
+            s = (long long)from;
+            e = (long long)to;
+            if (s == 0 && e == 0) {
+                e = capturePyr.count;
+            }
+            if (s < 0 || e > capturePyr.count || s >= e) {
+                printf("Range must satisfy 0 <= start < end <= %lld.\n", capturePyr.count);
+                continue;
+            }
+
+            if (choice == 3) {
+                pyramid_overview(&capturePyr, s, e, PYR_OVERVIEW_WIDTH, 16);
+                continue;
+            }
+
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            if (pyramid_query(&capturePyr, s, e, &r) != 0) {
+                printf("Read error.\n");
+                continue;
+            }
+            double seconds = elapsed_seconds(&start);
+            print_summary(&r, e - s);
+            printf("Query time        : %.6f s\n", seconds);
+        } else {
+            printf("Invalid choice.\n");
+        }
+    }
+
+    go_back_to_main();
+}
+
+// 33) Region statistics
+//
+// Gives the menu 3/4/5 results (min, max, peak-to-peak, DC, RMS, crest
+// factor) for any range [start, end) of the sample buffer. Sum, sum of
+// squares, min and max tables over 64-sample blocks are built the first
+// time a region is asked for, after which every region costs the same
+// however long it is. The sums are never the difference of two running
+// totals, so a quiet region after a loud one keeps its precision. Regions can be typed
+// in, read from a file (start end per line) or swept as equal windows.
+void menu_item_33(void)
+{
+    int running = 1;
+    int choice;
+
+    printf("\n>> Menu 33: Region statistics\n");
+
+    if (!dataAvailable) {
+        printf("No waveform data available. Please enter samples first.\n");
+        go_back_to_main();
+        return;
+    }
+
+    while (running) {
+        printf("\nChoose an option (buffer holds %d samples):\n", sampleCount);
+        printf(" 1) Statistics for one region\n");
+        printf(" 2) Batch: regions from a file (start end per line) -> CSV\n");
+        printf(" 3) Sweep equal windows -> CSV\n");
+        printf(" 0) Return to main menu\n");
+
+        if (safe_get_int("Enter choice (0–3): ", &choice) != 0) {
+            printf("Input error.\n");
+            continue;
+        }
+        if (choice == 0) {
+            running = 0;
+            continue;
+        }
+        if (choice < 1 || choice > 3) {
+            printf("Invalid choice.\n");
+            continue;
+        }
+        if (!dataAvailable) {
+            printf("No waveform data available.\n");
+            continue;
+        }
+
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if (roi_prepare() != 0) {
+            printf("Not enough memory for the region index.\n");
+            continue;
+        }
+        double buildSeconds = elapsed_seconds(&start);
+
+        if (choice == 1) {
+            int s, e;
+            SummaryNode r;
+
+            if (safe_get_int("Start sample (from 0): ", &s) != 0 ||
+                safe_get_int("End sample (exclusive): ", &e) != 0) {
+                printf("Input error.\n");
+                continue;
+            }
+            if (s < 0 || e > sampleCount || s >= e) {
+                printf("Range must satisfy 0 <= start < end <= %d.\n", sampleCount);
+                continue;
+            }
+            roi_query(s, e, &r);
+            print_summary(&r, e - s);
+            continue;
+        }
+
+        char inName[100], outName[100];
+        FILE *in = NULL, *out;
+        int window = 0, hop = 0;
+        long regions = 0, skipped = 0;
+
+        if (choice == 2) {
+            if (safe_get_filename("Regions file: ", inName, sizeof(inName)) != 0) {
+                printf("Input error.\n");
+                continue;
+            }
+            in = fopen(inName, "r");
+            if (in == NULL) {
+                printf("Could not open %s.\n", inName);
+                continue;
+            }
+        } else {
+            if (safe_get_int("Window length (samples): ", &window) != 0 ||
+                safe_get_int("Hop between windows (samples): ", &hop) != 0) {
+                printf("Input error.\n");
+                continue;
+            }
+            if (window < 1 || window > sampleCount || hop < 1) {
+                printf("Window must be 1 to %d samples and hop at least 1.\n", sampleCount);
+                continue;
+            }
+        }
+        if (safe_get_filename("Output CSV file: ", outName, sizeof(outName)) != 0 ||
+            (out = fopen(outName, "w")) == NULL) {
+            printf("Could not create output file.\n");
+            if (in != NULL) fclose(in);
+            continue;
+        }
+
+        fprintf(out, "start,end,n,min,max,p2p,dc,rms,crest\n");
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if (choice == 2) {
+            char line[INPUT_BUF];
+            while (fgets(line, sizeof(line), in) != NULL) {
+                long s, e;
+                SummaryNode r;
+                char *p = line, *endp;
+
+                if (line[0] == '#' || line[strspn(line, " \t\r\n")] == '\0') continue;
+                s = strtol(p, &endp, 10);
+                p = endp + strspn(endp, " ,\t");
+                e = strtol(p, &endp, 10);
+                if (endp == p || s < 0 || e > sampleCount || s >= e) {
+                    skipped++;
+                    continue;
+                }
+                roi_query((int)s, (int)e, &r);
+                roi_write_row(out, (int)s, (int)e, &r);
+                regions++;
+            }
+            fclose(in);
+        } else {
+            for (int s = 0; s + window <= sampleCount; s += hop) {
+                SummaryNode r;
+                roi_query(s, s + window, &r);
+                roi_write_row(out, s, s + window, &r);
+                regions++;
+            }
+        }
+        double seconds = elapsed_seconds(&start);
+        fclose(out);
+
+        printf("%ld regions written to %s", regions, outName);
+        if (skipped > 0) printf(" (%ld lines skipped: bad or out of range)", skipped);
+        printf("\nIndex build %.4f s, queries + output %.4f s\n", buildSeconds, seconds);
+    }
+
+    go_back_to_main();
+}
+
+// 34) Tone detector (Goertzel bank)
+//
+// Measures the amplitude and phase at a few chosen frequencies (mains,
+// test tones, harmonics) without a full spectrum. Each frequency gets a
+// Goertzel resonator and all of them advance together in one pass, so the
+// cost is O(n * tones) and the state is two numbers per tone. A capture
+// file is streamed block by block through the same bank.
+void menu_item_34(void)
+{
+    int source;
+    double fs;
+    char list[200];
+    double freqs[TONE_MAX];
+    int nTones;
+    ToneBank bank;
+
+    printf("\n>> Menu 34: Tone detector (Goertzel bank)\n");
+    printf(" 1) Sample buffer\n");
+    printf(" 2) Binary doubles file (streamed, any size)\n");
+
+    if (safe_get_int("Enter choice (1–2): ", &source) != 0 ||
+        safe_get_double("Sampling frequency fs (Hz): ", &fs) != 0 ||
+        safe_get_text("Frequencies (e.g. 50, 120 or 50x5 for harmonics): ",
+                      list, sizeof(list)) != 0) {
+        printf("Input error.\n");
+        go_back_to_main();
+        return;
+    }
+    if (source != 1 && source != 2) {
+        printf("Invalid choice.\n");
+        go_back_to_main();
+        return;
+    }
+    if (fs <= 0.0) {
+        printf("Sampling frequency must be positive.\n");
+        go_back_to_main();
+        return;
+    }
+
+    nTones = tone_parse_list(list, freqs, TONE_MAX);
+    if (nTones <= 0) {
+        if (nTones == 0) printf("No frequencies given.\n");
+        go_back_to_main();
+        return;
+    }
+    for (int k = 0; k < nTones; k++) {
+        if (freqs[k] > fs / 2.0) {
+            printf("%.3f Hz is above fs / 2 = %.3f Hz.\n", freqs[k], fs / 2.0);
+            go_back_to_main();
+            return;
+        }
+    }
+
+    tone_bank_init(&bank, freqs, nTones, fs);
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    if (source == 1) {
+        if (!dataAvailable) {
+            printf("No waveform data available. Please enter samples first.\n");
+            go_back_to_main();
+            return;
+        }
+        tone_bank_update(&bank, samples, sampleCount);
+    } else {
+        char path[100];
+        BlockReader reader;
+        const double *block;
+        long n;
+
+        if (safe_get_filename("Capture file: ", path, sizeof(path)) != 0) {
+            printf("Input error.\n");
+            go_back_to_main();
+            return;
+        }
+        if (block_reader_open(&reader, path, (size_t)1 << 20, 1) != 0) {
+            printf("Could not open %s: %s\n", path, strerror(errno));
+            go_back_to_main();
+            return;
+        }
+        while ((n = block_reader_next(&reader, &block)) > 0) {
+            tone_bank_update(&bank, block, n);
+        }
+        block_reader_close(&reader);
+        if (reader.error != 0) {
+            printf("Read error: %s\n", strerror(reader.error));
+        }
+    }
+
+    if (bank.n == 0) {
+        printf("No samples.\n");
+        go_back_to_main();
+        return;
+    }
+    tone_bank_report(&bank);
+    printf("Time: %.4f s for %d tones\n", elapsed_seconds(&start), nTones);
+
+    go_back_to_main();
+}
+
+// 35) Reference buffer and cross-correlation
+//
+// A second buffer holds a reference waveform. Cross-correlation finds the
+// lag where the reference best matches the sample buffer, refined to a
+// fraction of a sample, with the correlation coefficient at that lag. The
+// same machinery convolves the buffer with the reference as FIR taps.
+// Short references are done directly; longer ones use FFT overlap-save,
+// which costs O(n log m) instead of O(n m).
+void menu_item_35(void)
+{
+    int running = 1;
+    int choice;
+
+    printf("\n>> Menu 35: Reference buffer and cross-correlation\n");
+
+    while (running) {
+        printf("\nSample buffer: %d samples, reference: %d samples\n",
+               dataAvailable ? sampleCount : 0, refCount);
+        printf("Choose an option:\n");
+        printf(" 1) Copy sample buffer to the reference\n");
+        printf(" 2) Load reference from a binary doubles file\n");
+        printf(" 3) Swap sample buffer and reference\n");
+        printf(" 4) Cross-correlate (find delay and similarity)\n");
+        printf(" 5) Convolve sample buffer with reference (FIR filter, in-place)\n");
+        printf(" 0) Return to main menu\n");
+
+        if (safe_get_int("Enter choice (0–5): ", &choice) != 0) {
+            printf("Input error.\n");
+            continue;
+        }
+
+        if (choice == 0) {
+            running = 0;
+        } else if (choice == 1 || choice == 3) {
+            if (choice == 1 && !dataAvailable) {
+                printf("No waveform data available. Please enter samples first.\n");
+                continue;
+            }
+            if (refSamples == NULL) {
+                refSamples = malloc(SAMPLE_BUF_SIZE * sizeof(double));
+                if (refSamples == NULL) {
+                    printf("Not enough memory.\n");
+                    continue;
+                }
+            }
+            if (choice == 1) {
+                memcpy(refSamples, samples, (size_t)sampleCount * sizeof(double));
+                refCount = sampleCount;
+                printf("Reference now holds %d samples.\n", refCount);
+            } else {
+                int n = dataAvailable ? sampleCount : 0;
+                int larger = (n > refCount) ? n : refCount;
+
+                snapshot_before_swap("before swap with reference");
+                for (int i = 0; i < larger; i++) {
+                    double t = samples[i];
+                    samples[i] = refSamples[i];
+                    refSamples[i] = t;
+                }
+                sampleCount = refCount;
+                dataAvailable = (refCount > 0);
+                refCount = n;
+                printf("Swapped: buffer %d samples, reference %d samples.\n",
+                       sampleCount, refCount);
+            }
+        } else if (choice == 2) {
+            char path[100];
+            FILE *fp;
+            size_t got;
+
+            if (safe_get_filename("Reference file: ", path, sizeof(path)) != 0) {
+                printf("Input error.\n");
+                continue;
+            }
+            fp = fopen(path, "rb");
+            if (fp == NULL) {
+                printf("Could not open %s.\n", path);
+                continue;
+            }
+            if (refSamples == NULL) {
+                refSamples = malloc(SAMPLE_BUF_SIZE * sizeof(double));
+            }
+            if (refSamples == NULL) {
+                printf("Not enough memory.\n");
+                fclose(fp);
+                continue;
+            }
+            got = fread(refSamples, sizeof(double), SAMPLE_BUF_SIZE, fp);
+            if (!feof(fp) && got == SAMPLE_BUF_SIZE) {
+                printf("File longer than %d samples; the rest is ignored.\n", SAMPLE_BUF_SIZE);
+            }
+            fclose(fp);
+            refCount = (int)got;
+            printf("Reference now holds %d samples.\n", refCount);
+        } else if (choice == 4 || choice == 5) {
+            struct timespec start;
+            double fs = 0.0;
+
+            if (!dataAvailable || refCount == 0) {
+                printf("Both the sample buffer and the reference need data.\n");
+                continue;
+            }
+
+            if (choice == 4) {
+                XcorrResult res;
+
+                if (safe_get_double("Sampling frequency (Hz, 0 = report in samples): ", &fs) != 0) {
+                    printf("Input error.\n");
+                    continue;
+                }
+                clock_gettime(CLOCK_MONOTONIC, &start);
+                if (xcorr_best(samples, sampleCount, refSamples, refCount, &res) != 0) {
+                    printf("Not enough memory.\n");
+                    continue;
+                }
+                double seconds = elapsed_seconds(&start);
+
+                printf("Best lag          : %ld samples (reference matches samples[%ld...])\n",
+                       res.lag, res.lag);
+                printf("Sub-sample lag    : %.3f samples\n", res.subLag);
+                if (fs > 0.0) {
+                    printf("Delay             : %.6g s\n", res.subLag / fs);
+                }
+                printf("Correlation coeff : %.4f\n", res.coeff);
+                printf("Method            : %s, %.4f s\n",
+                       res.usedFft ? "FFT overlap-save" : "direct", seconds);
+            } else {
+                long total = (long)sampleCount + refCount - 1;
+                double *out = malloc((size_t)total * sizeof(double));
+                int usedFft;
+
+                if (out == NULL) {
+                    printf("Not enough memory.\n");
+                    continue;
+                }
+                clock_gettime(CLOCK_MONOTONIC, &start);
+                if (convolve_full(samples, sampleCount, refSamples, refCount, out, &usedFft) != 0) {
+                    printf("Not enough memory.\n");
+                    free(out);
+                    continue;
+                }
+                snapshot_before_change("before convolution");
+                memcpy(samples, out, (size_t)sampleCount * sizeof(double));   // causal part
+                free(out);
+                printf("Buffer filtered with %d taps (%s, %.4f s).\n", refCount,
+                       usedFft ? "FFT overlap-save" : "direct", elapsed_seconds(&start));
+            }
+        } else {
+            printf("Invalid choice.\n");
+        }
+    }
+
+    go_back_to_main();
+}
+
+// 36) Amplitude histogram and percentiles
+//
+// The histogram is counted by every worker thread into its own table and
+// the tables are added together at the end. Percentiles are exact: each
+// one is found by selection on a scratch copy of the buffer (no sort), and
+// the requested levels are handled in ascending order so each search only
+// looks at the samples above the previous one.
+void menu_item_36(void)
+{
+    int running = 1;
+    int choice;
+
+    printf("\n>> Menu 36: Amplitude histogram and percentiles\n");
+
+    if (!dataAvailable) {
+        printf("\nNo waveform data available. Please enter samples first.\n");
+        go_back_to_main();
+        return;
+    }
+
+    while (running) {
+        printf("\nChoose an option:\n");
+        printf(" 1) Histogram of the sample buffer\n");
+        printf(" 2) Exact percentiles of the sample buffer\n");
+        printf(" 0) Return to main menu\n");
+
+        if (safe_get_int("Enter choice (0–2): ", &choice) != 0) {
+            printf("Input error.\n");
+            continue;
+        }
+
+        if (choice == 0) {
+            running = 0;
+        } else if (choice == 1) {
+            int bins;
+            long *hist;
+            double lo = find_min(samples, sampleCount);
+            double hi = find_max(samples, sampleCount);
+            struct timespec start;
+
+            if (safe_get_int("Number of bins (1-1000): ", &bins) != 0 ||
+                bins < 1 || bins > HIST_MAX_BINS) {
+                printf("Bins must be 1 to %d.\n", HIST_MAX_BINS);
+                continue;
+            }
+            hist = malloc((size_t)bins * sizeof(long));
+            if (hist == NULL) {
+                printf("Not enough memory.\n");
+                continue;
+            }
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            build_histogram(samples, sampleCount, lo, hi, bins, hist);
+            double seconds = elapsed_seconds(&start);
+
+            printf("\n       From ..          To      Count  Share\n");
+            print_histogram(stdout, hist, bins, lo, hi, sampleCount);
+            printf("Counted %d samples in %.4f s\n", sampleCount, seconds);
+            free(hist);
+        } else if (choice == 2) {
+            char text[INPUT_BUF];
+            double p[PCT_MAX], value[PCT_MAX];
+            int np;
+            struct timespec start;
+
+            if (safe_get_text("Percentiles, 0-100 (e.g. 1 5 25 50 75 95 99): ",
+                              text, sizeof(text)) != 0) {
+                printf("Input error.\n");
+                continue;
+            }
+            np = parse_number_list(text, p, PCT_MAX);
+            if (np <= 0) {
+                printf("No percentiles given.\n");
+                continue;
+            }
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            if (percentiles_exact(samples, sampleCount, p, np, value) != 0) {
+                printf("Not enough memory.\n");
+                continue;
+            }
+            double seconds = elapsed_seconds(&start);
+
+            for (int i = 0; i < np; i++) {
+                printf("P%-8g         : %.6g\n", p[i], value[i]);
+            }
+            printf("Selected in %.4f s\n", seconds);
+        } else {
+            printf("Invalid choice.\n");
+        }
+    }
+
+    go_back_to_main();
+}
+
+// 37) Frame features and classification
+//
+// The buffer is cut into frames and every frame gets a feature vector in
+// one pass over its samples (plus an FFT for the spectral centroid). Frames
+// are then labelled by a list of rules, the first matching rule winning,
+// and the labels are shown as a timeline. Frames are spread over threads.
+void menu_item_37(void)
+{
+    int running = 1;
+    int choice;
+
+    printf("\n>> Menu 37: Frame features and classification\n");
+
+    if (!dataAvailable) {
+        printf("\nNo waveform data available. Please enter samples first.\n");
+        go_back_to_main();
+        return;
+    }
+    if (frameRuleCount < 0) {
+        frame_rules_default();
+    }
+
+    while (running) {
+        printf("\nFeatures: dc rms crest zcr (crossings per sample) peaks centroid "
+               "dcratio (|dc|/rms) p2p\n");
+        printf("Choose an option:\n");
+        printf(" 1) Show classification rules\n");
+        printf(" 2) Add a rule (checked before the existing ones)\n");
+        printf(" 3) Restore default rules\n");
+        printf(" 4) Classify frames and show the label timeline\n");
+        printf(" 5) Save frame features and labels to CSV\n");
+        printf(" 0) Return to main menu\n");
+
+        if (safe_get_int("Enter choice (0–5): ", &choice) != 0) {
+            printf("Input error.\n");
+            continue;
+        }
+
+        if (choice == 0) {
+            running = 0;
+        } else if (choice == 1) {
+            for (int r = 0; r < frameRuleCount; r++) {
+                frame_rule_print(r, &frameRules[r]);
+            }
+            printf(" .) %s: no rule matched\n", FRAME_FALLBACK);
+        } else if (choice == 2) {
+            char text[INPUT_BUF];
+            FrameRule rule;
+
+            if (frameRuleCount == FRAME_MAX_RULES) {
+                printf("At most %d rules.\n", FRAME_MAX_RULES);
+                continue;
+            }
+            if (safe_get_text("Rule (e.g. glitch: crest > 4 and rms > 0.1): ",
+                              text, sizeof(text)) != 0 ||
+                frame_rule_parse(text, &rule) != 0) {
+                printf("Rule not added.\n");
+                continue;
+            }
+            memmove(&frameRules[1], &frameRules[0], (size_t)frameRuleCount * sizeof(FrameRule));
+            frameRules[0] = rule;
+            frameRuleCount++;
+            printf("Rule added.\n");
+        } else if (choice == 3) {
+            frame_rules_default();
+            printf("Default rules restored.\n");
+        } else if (choice == 4 || choice == 5) {
+            int frameLen;
+            double fs, peakLevel;
+            double *feats;
+            int *labels;
+            char filename[100];
+            struct timespec start;
+
+            if (safe_get_int("Frame length (samples): ", &frameLen) != 0 ||
+                safe_get_double("Sample rate (Hz, 1 = per sample): ", &fs) != 0 ||
+                safe_get_double("Peak level (local maxima above it are counted): ",
+                                &peakLevel) != 0) {
+                printf("Input error.\n");
+                continue;
+            }
+            if (frameLen < 4 || frameLen > sampleCount || frameLen > FRAME_MAX_LEN) {
+                printf("Frame length must be 4 to %d samples and fit the buffer.\n",
+                       FRAME_MAX_LEN);
+                continue;
+            }
+            if (fs <= 0.0) {
+                printf("Sample rate must be positive.\n");
+                continue;
+            }
+            if (choice == 5 &&
+                safe_get_filename("CSV filename: ", filename, sizeof(filename)) != 0) {
+                printf("Filename error.\n");
+                continue;
+            }
+
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            long nFrames = frame_extract(samples, sampleCount, frameLen, fs, peakLevel,
+                                         &feats, &labels);
+            double seconds = elapsed_seconds(&start);
+            if (nFrames < 0) {
+                printf("Not enough memory.\n");
+                continue;
+            }
+
+            if (choice == 4) {
+                frame_timeline(labels, nFrames, frameLen, fs);
+            } else {
+                FILE *fp = fopen(filename, "w");
+                if (fp == NULL) {
+                    printf("Could not open file for writing.\n");
+                } else {
+                    fprintf(fp, "frame,start_s");
+                    for (int f = 0; f < FEAT_COUNT; f++) fprintf(fp, ",%s", FEATURE_NAMES[f]);
+                    fprintf(fp, ",label\n");
+                    for (long fr = 0; fr < nFrames; fr++) {
+                        fprintf(fp, "%ld,%.6f", fr, (double)fr * frameLen / fs);
+                        for (int f = 0; f < FEAT_COUNT; f++) {
+                            fprintf(fp, ",%.6g", feats[fr * FEAT_COUNT + f]);
+                        }
+                        fprintf(fp, ",%s\n", frame_label(labels[fr]));
+                    }
+                    fclose(fp);
+                    printf("Wrote %ld frames to %s\n", nFrames, filename);
+                }
+            }
+            if (sampleCount % frameLen != 0) {
+                printf("Last %d samples (less than a frame) ignored.\n", sampleCount % frameLen);
+            }
+            printf("Features and labels for %ld frames in %.4f s\n", nFrames, seconds);
+            free(feats);
+            free(labels);
+        } else {
+            printf("Invalid choice.\n");
+        }
+    }
+
+    go_back_to_main();
+}
+
+// 38) Envelope series
+//
+// DC, RMS, min, max, peak and crest factor for every window of a sliding
+// (usually overlapping) window. Sums and min / max come from the block
+// tables of the region index, so a window costs the same whatever the
+// overlap, and a quiet window keeps its precision after a loud section. The result is a new series that can be saved,
+// loaded into the sample buffer or copied to the reference buffer.
+void menu_item_38(void)
+{
+    int running = 1;
+    int choice;
+
+    printf("\n>> Menu 38: Envelope series (per-window RMS, peak and DC)\n");
+
+    while (running) {
+        if (envelope.count > 0) {
+            printf("\nEnvelope: %ld windows of %d samples, hop %d%s\n", envelope.count,
+                   envelope.window, envelope.hop,
+                   (envelope.generation == sampleGeneration) ? "" : " (samples changed since)");
+        }
+        printf("\nChoose an option:\n");
+        printf(" 1) Compute envelope of the sample buffer\n");
+        printf(" 2) Save envelope to CSV\n");
+        printf(" 3) Replace sample buffer with one envelope column\n");
+        printf(" 4) Copy one envelope column to the reference buffer\n");
+        printf(" 0) Return to main menu\n");
+
+        if (safe_get_int("Enter choice (0–4): ", &choice) != 0) {
+            printf("Input error.\n");
+            continue;
+        }
+
+        if (choice == 0) {
+            running = 0;
+        } else if (choice == 1) {
+            double fs, windowMs, hopMs;
+            struct timespec start;
+
+            if (!dataAvailable) {
+                printf("No waveform data available. Please enter samples first.\n");
+                continue;
+            }
+            if (safe_get_double("Sample rate (Hz): ", &fs) != 0 ||
+                safe_get_double("Window length (ms): ", &windowMs) != 0 ||
+                safe_get_double("Hop between windows (ms): ", &hopMs) != 0) {
+                printf("Input error.\n");
+                continue;
+            }
+            if (fs <= 0.0 || windowMs <= 0.0 || hopMs <= 0.0) {
+                printf("Sample rate, window and hop must be positive.\n");
+                continue;
+            }
+
+            double window = floor(windowMs * fs / 1000.0 + 0.5);
+            double hop = floor(hopMs * fs / 1000.0 + 0.5);
+            if (window < 1.0 || window > sampleCount || hop < 1.0) {
+                printf("Window must be 1 to %d samples and hop at least 1 sample.\n",
+                       sampleCount);
+                continue;
+            }
+
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            if (envelope_compute((int)window, (int)fmin(hop, (double)sampleCount), fs) != 0) {
+                printf("Not enough memory.\n");
+                continue;
+            }
+            double seconds = elapsed_seconds(&start);
+
+            double rmsLo = INFINITY, rmsHi = 0.0, peakHi = 0.0;
+            for (long w = 0; w < envelope.count; w++) {
+                double r = envelope_value(w, ENV_RMS);
+                rmsLo = fmin(rmsLo, r);
+                rmsHi = fmax(rmsHi, r);
+                peakHi = fmax(peakHi, envelope_value(w, ENV_PEAK));
+            }
+            printf("Windows           : %ld (%d samples, hop %d)\n", envelope.count,
+                   envelope.window, envelope.hop);
+            printf("RMS envelope      : %.4f to %.4f\n", rmsLo, rmsHi);
+            printf("Highest peak      : %.4f\n", peakHi);
+            printf("Computed in %.4f s\n", seconds);
+        } else if (choice >= 2 && choice <= 4) {
+            if (envelope.count == 0) {
+                printf("Compute an envelope first (option 1).\n");
+                continue;
+            }
+            if (choice == 2) {
+                char filename[100];
+                FILE *fp;
+
+                if (safe_get_filename("CSV filename: ", filename, sizeof(filename)) != 0 ||
+                    (fp = fopen(filename, "w")) == NULL) {
+                    printf("Could not create output file.\n");
+                    continue;
+                }
+                fprintf(fp, "time_s,dc,rms,min,max,peak,crest\n");
+                for (long w = 0; w < envelope.count; w++) {
+                    fprintf(fp, "%.6f", envelope_time(w));
+                    for (int c = 0; c < ENV_COLUMNS; c++) {
+                        fprintf(fp, ",%.6g", envelope_value(w, c));
+                    }
+                    fprintf(fp, "\n");
+                }
+                fclose(fp);
+                printf("Wrote %ld windows to %s\n", envelope.count, filename);
+            } else {
+                int column;
+                long n = envelope.count;
+                double *dst;
+
+                if (safe_get_int("Column (1 DC, 2 RMS, 3 min, 4 max, 5 peak, 6 crest): ",
+                                 &column) != 0 || column < 1 || column > ENV_COLUMNS) {
+                    printf("Column must be 1 to %d.\n", ENV_COLUMNS);
+                    continue;
+                }
+                if (n > SAMPLE_BUF_SIZE) n = SAMPLE_BUF_SIZE;
+                if (choice == 3) {
+                    snapshot_before_change("before envelope series");
+                    dst = samples;
+                } else {
+                    if (refSamples == NULL) {
+                        refSamples = malloc(SAMPLE_BUF_SIZE * sizeof(double));
+                        if (refSamples == NULL) {
+                            printf("Not enough memory.\n");
+                            continue;
+                        }
+                    }
+                    dst = refSamples;
+                }
+                for (long w = 0; w < n; w++) {
+                    dst[w] = envelope_value(w, column - 1);
+                }
+                if (choice == 3) {
+                    sampleCount = (int)n;
+                    dataAvailable = 1;
+                    printf("Sample buffer now holds %d envelope values (undo in menu 28).\n",
+                           sampleCount);
+                } else {
+                    refCount = (int)n;
+                    printf("Reference now holds %d envelope values.\n", refCount);
+                }
+            }
+        } else {
+            printf("Invalid choice.\n");
+        }
+    }
+
+    go_back_to_main();
+}
+
+// 39) Rolling min / max / peak-to-peak
+//
+// Ripple and drift monitoring: min, max and peak-to-peak over a sliding
+// window. Each extreme is kept in a monotonic deque (values that can never
+// be the extreme again are dropped as a new sample arrives), so the cost
+// per sample does not depend on the window length. The same code runs on
+// the sample buffer and on a file streamed block by block.
+void menu_item_39(void)
+{
+    int running = 1;
+    int choice;
+
+    printf("\n>> Menu 39: Rolling min / max / peak-to-peak\n");
+
+    while (running) {
+        int window;
+        struct timespec start;
+
+        printf("\nChoose an option:\n");
+        printf(" 1) Rolling peak-to-peak of the sample buffer (summary)\n");
+        printf(" 2) Save rolling min / max / peak-to-peak to CSV\n");
+        printf(" 3) Replace sample buffer with rolling peak-to-peak\n");
+        printf(" 4) Stream a binary doubles file (summary, optional output file)\n");
+        printf(" 0) Return to main menu\n");
+
+        if (safe_get_int("Enter choice (0–4): ", &choice) != 0) {
+            printf("Input error.\n");
+            continue;
+        }
+        if (choice == 0) {
+            running = 0;
+            continue;
+        }
+        if (choice < 1 || choice > 4) {
+            printf("Invalid choice.\n");
+            continue;
+        }
+        if (choice != 4 && !dataAvailable) {
+            printf("No waveform data available. Please enter samples first.\n");
+            continue;
+        }
+        if (safe_get_int("Window length (samples): ", &window) != 0 || window < 1 ||
+            (choice != 4 && window > sampleCount)) {
+            printf("Window must be at least 1 sample%s.\n",
+                   (choice != 4) ? " and fit the buffer" : "");
+            continue;
+        }
+
+        if (choice == 4) {
+            char path[100], outName[100];
+            int writeOut;
+            FILE *out = NULL;
+            BlockReader reader;
+            SlidingExtrema s;
+            const double *block;
+            long n;
+            double largest = -INFINITY, smallest = INFINITY, sum = 0.0;
+            long long largestAt = 0, smallestAt = 0, count = 0;
+            double *p2p = malloc(LIVE_BLOCK * sizeof(double));
+            int have = 0;
+
+            if (safe_get_filename("Capture file: ", path, sizeof(path)) != 0 ||
+                safe_get_int("Write rolling peak-to-peak to a binary file (1 = yes, 0 = no): ",
+                             &writeOut) != 0 ||
+                (writeOut && safe_get_filename("Output file: ", outName, sizeof(outName)) != 0)) {
+                printf("Input error.\n");
+                free(p2p);
+                continue;
+            }
+            if (p2p == NULL || sliding_init(&s, window) != 0) {
+                printf("Not enough memory.\n");
+                free(p2p);
+                continue;
+            }
+            if (writeOut && (out = fopen(outName, "wb")) == NULL) {
+                printf("Could not create %s.\n", outName);
+                sliding_free(&s);
+                free(p2p);
+                continue;
+            }
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            if (block_reader_open(&reader, path, (size_t)1 << 20, 1) != 0) {
+                printf("Could not open %s: %s\n", path, strerror(errno));
+                if (out != NULL) fclose(out);
+                sliding_free(&s);
+                free(p2p);
+                continue;
+            }
+            while ((n = block_reader_next(&reader, &block)) > 0) {
+                for (long i = 0; i < n; i++) {
+                    double mn, mx;
+                    if (!sliding_push(&s, block[i], &mn, &mx)) continue;
+
+                    double r = mx - mn;
+                    if (r > largest) { largest = r; largestAt = count; }
+                    if (r < smallest) { smallest = r; smallestAt = count; }
+                    sum += r;
+                    count++;
+                    if (out != NULL) {
+                        p2p[have++] = r;
+                        if (have == LIVE_BLOCK) {
+                            fwrite(p2p, sizeof(double), (size_t)have, out);
+                            have = 0;
+                        }
+                    }
+                }
+            }
+            block_reader_close(&reader);
+            if (out != NULL) {
+                fwrite(p2p, sizeof(double), (size_t)have, out);
+                fclose(out);
+            }
+            sliding_free(&s);
+            free(p2p);
+
+            if (reader.error != 0) {
+                printf("Read error: %s\n", strerror(reader.error));
+            }
+            if (count == 0) {
+                printf("Fewer samples than one window.\n");
+                continue;
+            }
+            ripple_report(largest, largestAt, smallest, smallestAt, sum, count, window);
+            if (out != NULL) {
+                printf("Wrote %lld values to %s\n", count, outName);
+            }
+            printf("Streamed in %.4f s\n", elapsed_seconds(&start));
+            continue;
+        }
+
+        double *mn = malloc((size_t)sampleCount * sizeof(double));
+        double *mx = malloc((size_t)sampleCount * sizeof(double));
+        if (mn == NULL || mx == NULL) {
+            printf("Not enough memory.\n");
+            free(mn);
+            free(mx);
+            continue;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        long count = sliding_series(samples, sampleCount, window, mn, mx);
+        double seconds = elapsed_seconds(&start);
+        if (count < 0) {
+            printf("Not enough memory.\n");
+            free(mn);
+            free(mx);
+            continue;
+        }
+
+        if (choice == 1) {
+            double largest = -INFINITY, smallest = INFINITY, sum = 0.0;
+            long long largestAt = 0, smallestAt = 0;
+
+            for (long k = 0; k < count; k++) {
+                double r = mx[k] - mn[k];
+                if (r > largest) { largest = r; largestAt = k; }
+                if (r < smallest) { smallest = r; smallestAt = k; }
+                sum += r;
+            }
+            ripple_report(largest, largestAt, smallest, smallestAt, sum, count, window);
+        } else if (choice == 2) {
+            char filename[100];
+            FILE *fp;
+
+            if (safe_get_filename("CSV filename: ", filename, sizeof(filename)) != 0 ||
+                (fp = fopen(filename, "w")) == NULL) {
+                printf("Could not create output file.\n");
+            } else {
+                fprintf(fp, "end,min,max,p2p\n");
+                for (long k = 0; k < count; k++) {
+                    fprintf(fp, "%ld,%.6g,%.6g,%.6g\n", k + window - 1, mn[k], mx[k],
+                            mx[k] - mn[k]);
+                }
+                fclose(fp);
+                printf("Wrote %ld windows to %s\n", count, filename);
+            }
+        } else {
+            snapshot_before_change("before rolling peak-to-peak");
+            for (long k = 0; k < count; k++) {
+                samples[k] = mx[k] - mn[k];
+            }
+            sampleCount = (int)count;
+            printf("Sample buffer now holds %d peak-to-peak values (undo in menu 28).\n",
+                   sampleCount);
+        }
+        printf("Rolling extrema in %.4f s\n", seconds);
+        free(mn);
+        free(mx);
+    }
+
+    go_back_to_main();
+}
+
+// 40) Trigger and event extraction
+//
+// Works like an oscilloscope trigger over the whole buffer: edge, level,
+// window or pulse-width conditions with a holdoff, and a pre / post window
+// kept around every event. The scan tests blocks of samples with
+// branch-free compares (SIMD with the Makefile flags) and only looks at
+// single samples inside blocks where something fired. Event statistics
+// come from the menu 33 region index, so each costs the same at any width.
+void menu_item_40(void)
+{
+    int running = 1;
+    int choice;
+
+    printf("\n>> Menu 40: Trigger and event extraction\n");
+
+    while (running) {
+        if (trigCount > 0) {
+            printf("\nEvents: %ld stored%s\n", trigCount,
+                   (trigGeneration == sampleGeneration) ? "" : " (samples changed since)");
+        }
+        printf("\nChoose an option:\n");
+        printf(" 1) Set up a trigger and scan the sample buffer\n");
+        printf(" 2) List events with statistics\n");
+        printf(" 3) Statistics for one event\n");
+        printf(" 4) Save events with statistics to CSV\n");
+        printf(" 5) Copy one event window to the reference buffer\n");
+        printf(" 0) Return to main menu\n");
+
+        if (safe_get_int("Enter choice (0–5): ", &choice) != 0) {
+            printf("Input error.\n");
+            continue;
+        }
+        if (choice == 0) {
+            running = 0;
+            continue;
+        }
+        if (choice < 1 || choice > 5) {
+            printf("Invalid choice.\n");
+            continue;
+        }
+        if (!dataAvailable) {
+            printf("No waveform data available. Please enter samples first.\n");
+            continue;
+        }
+
+        if (choice == 1) {
+            TriggerSpec t;
+            int type, holdoff, pre, post;
+            struct timespec start;
+
+            memset(&t, 0, sizeof(t));
+            printf("Trigger types: 1 rising edge, 2 falling edge, 3 level (at or above),\n"
+                   "               4 window (outside low..high), 5 pulse width (outside min..max)\n");
+            if (safe_get_int("Trigger type (1-5): ", &type) != 0 || type < 1 || type > 5) {
+                printf("Invalid trigger type.\n");
+                continue;
+            }
+            t.type = type;
+            if (type == TRIG_WINDOW) {
+                if (safe_get_double("Low limit: ", &t.low) != 0 ||
+                    safe_get_double("High limit: ", &t.high) != 0 || t.high < t.low) {
+                    printf("Limits must satisfy low <= high.\n");
+                    continue;
+                }
+            } else if (safe_get_double("Trigger level: ", &t.level) != 0) {
+                printf("Input error.\n");
+                continue;
+            }
+            if (type == TRIG_PULSE) {
+                int minW, maxW;
+                if (safe_get_int("Shortest normal pulse (samples): ", &minW) != 0 ||
+                    safe_get_int("Longest normal pulse (samples): ", &maxW) != 0 ||
+                    minW < 1 || maxW < minW) {
+                    printf("Pulse widths must satisfy 1 <= shortest <= longest.\n");
+                    continue;
+                }
+                t.minWidth = minW;
+                t.maxWidth = maxW;
+            }
+            if (safe_get_int("Holdoff (samples, 0 = none): ", &holdoff) != 0 ||
+                safe_get_int("Samples kept before each event: ", &pre) != 0 ||
+                safe_get_int("Samples kept after each event: ", &post) != 0 ||
+                holdoff < 0 || pre < 0 || post < 0) {
+                printf("Holdoff and windows must be zero or more.\n");
+                continue;
+            }
+            t.holdoff = holdoff;
+            t.pre = pre;
+            t.post = post;
+
+            if (trigEvents == NULL) {
+                trigEvents = malloc(TRIG_MAX_EVENTS * sizeof(long));
+                if (trigEvents == NULL) {
+                    printf("Not enough memory.\n");
+                    continue;
+                }
+            }
+
+            long long total;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            trigCount = trigger_scan(&t, samples, sampleCount, trigEvents, TRIG_MAX_EVENTS,
+                                     &total);
+            double seconds = elapsed_seconds(&start);
+            trigSpec = t;
+            trigGeneration = sampleGeneration;
+
+            printf("Events            : %lld", total);
+            if (total > trigCount) printf(" (first %ld kept)", trigCount);
+            printf("\nScanned %d samples in %.4f s (%.0f Msamples/s)\n", sampleCount, seconds,
+                   sampleCount / 1e6 / (seconds > 0.0 ? seconds : 1e-9));
+            continue;
+        }
+
+        if (trigCount == 0) {
+            printf("No events. Scan with option 1 first.\n");
+            continue;
+        }
+        if (trigGeneration != sampleGeneration) {
+            printf("The samples changed since the scan. Scan again with option 1.\n");
+            continue;
+        }
+        if (roi_prepare() != 0) {
+            printf("Not enough memory for the region index.\n");
+            continue;
+        }
+
+        if (choice == 2) {
+            long shown = (trigCount < TRIG_LIST) ? trigCount : TRIG_LIST;
+
+            printf("\n   Event      Sample       Min       Max       P2P        DC       RMS\n");
+            for (long k = 0; k < shown; k++) {
+                long s, e;
+                SummaryNode r;
+                trigger_window(k, &s, &e);
+                roi_query((int)s, (int)e, &r);
+                printf("%8ld %11ld %9.4f %9.4f %9.4f %9.4f %9.4f\n", k + 1, trigEvents[k],
+                       r.min, r.max, r.max - r.min, r.sum / (e - s), sqrt(r.sumSq / (e - s)));
+            }
+            if (trigCount > shown) {
+                printf("... %ld more (option 4 saves them all)\n", trigCount - shown);
+            }
+        } else if (choice == 3 || choice == 5) {
+            int k;
+            long s, e;
+
+            if (safe_get_int("Event number: ", &k) != 0 || k < 1 || k > trigCount) {
+                printf("Event must be 1 to %ld.\n", trigCount);
+                continue;
+            }
+            trigger_window(k - 1, &s, &e);
+            if (choice == 3) {
+                SummaryNode r;
+                roi_query((int)s, (int)e, &r);
+                printf("Event %d at sample %ld, window %ld to %ld\n", k, trigEvents[k - 1], s,
+                       e - 1);
+                print_summary(&r, e - s);
+            } else {
+                if (refSamples == NULL) {
+                    refSamples = malloc(SAMPLE_BUF_SIZE * sizeof(double));
+                    if (refSamples == NULL) {
+                        printf("Not enough memory.\n");
+                        continue;
+                    }
+                }
+                memcpy(refSamples, &samples[s], (size_t)(e - s) * sizeof(double));
+                refCount = (int)(e - s);
+                printf("Reference now holds %d samples (event %d).\n", refCount, k);
+            }
+        } else {
+            char filename[100];
+            FILE *fp;
+
+            if (safe_get_filename("CSV filename: ", filename, sizeof(filename)) != 0 ||
+                (fp = fopen(filename, "w")) == NULL) {
+                printf("Could not create output file.\n");
+                continue;
+            }
+            fprintf(fp, "event,trigger,start,end,n,min,max,p2p,dc,rms,crest\n");
+            for (long k = 0; k < trigCount; k++) {
+                long s, e;
+                SummaryNode r;
+                trigger_window(k, &s, &e);
+                roi_query((int)s, (int)e, &r);
+                fprintf(fp, "%ld,%ld,", k + 1, trigEvents[k]);
+                roi_write_row(fp, (int)s, (int)e, &r);
+            }
+            fclose(fp);
+            printf("Wrote %ld events to %s\n", trigCount, filename);
+        }
+    }
+
+    go_back_to_main();
+}
+
+// 41) Compare sample slots
+//
+// Slots are the sample buffer ("buffer"), the reference buffer ("ref")
+// and every named version saved in menu 28. Two slots are compared in one
+// pass that produces all the error and similarity sums together, without
+// building a difference buffer; named versions are read in place from
+// their chunks.
+void menu_item_41(void)
+{
+    int running = 1;
+    int choice;
+
+    printf("\n>> Menu 41: Compare sample slots\n");
+
+    while (running) {
+        printf("\nChoose an option:\n");
+        printf(" 1) List slots\n");
+        printf(" 2) Compare two slots (MSE, RMS error, max error, SNR, correlation)\n");
+        printf(" 3) Copy a slot to the reference buffer\n");
+        printf(" 0) Return to main menu\n");
+
+        if (safe_get_int("Enter choice (0–3): ", &choice) != 0) {
+            printf("Input error.\n");
+            continue;
+        }
+
+        if (choice == 0) {
+            running = 0;
+        } else if (choice == 1) {
+            printf("  %-32s %d samples\n", "buffer", dataAvailable ? sampleCount : 0);
+            printf("  %-32s %d samples\n", "ref", (refSamples != NULL) ? refCount : 0);
+            for (int k = 0; k < namedCount; k++) {
+                printf("  %-32s %d samples\n", namedVersions[k]->name, namedVersions[k]->count);
+            }
+            printf("(save more named slots with menu 28, option 3)\n");
+        } else if (choice == 2) {
+            char nameA[SNAP_NAME], nameB[SNAP_NAME];
+            SlotView a, b;
+            CompareSums s;
+            long maxAt;
+            struct timespec start;
+
+            if (safe_get_text("First slot (reference / golden): ", nameA, sizeof(nameA)) != 0 ||
+                safe_get_text("Second slot (under test): ", nameB, sizeof(nameB)) != 0) {
+                printf("Input error.\n");
+                continue;
+            }
+            if (slot_find(nameA, &a) != 0 || slot_find(nameB, &b) != 0) {
+                printf("No such slot (use buffer, ref or a menu 28 version name).\n");
+                continue;
+            }
+            long n = (a.count < b.count) ? a.count : b.count;
+            if (n == 0) {
+                printf("A slot is empty.\n");
+                continue;
+            }
+
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            if (compare_slots(&a, &b, n, &s, &maxAt) != 0) {
+                printf("Not enough memory.\n");
+                continue;
+            }
+            double seconds = elapsed_seconds(&start);
+
+            long len;
+            double shiftA = *slot_piece(&a, 0, &len);
+            double powerA = s.saa + 2.0 * shiftA * s.sa + n * shiftA * shiftA;   // sum of a^2
+            double covAB = s.sab - s.sa * s.sb / n;
+            double varA = s.saa - s.sa * s.sa / n;
+            double varB = s.sbb - s.sb * s.sb / n;
+
+            if (a.count != b.count) {
+                printf("Lengths differ (%ld and %ld): comparing the first %ld samples.\n",
+                       a.count, b.count, n);
+            }
+            printf("Samples           : %ld\n", n);
+            printf("MSE               : %.6g\n", s.sumD2 / n);
+            printf("RMS error         : %.6g\n", sqrt(s.sumD2 / n));
+            printf("Max abs error     : %.6g (sample %ld)\n", s.maxAbs, maxAt);
+            if (s.sumD2 > 0.0) {
+                printf("SNR               : %.2f dB\n", 10.0 * log10(powerA / s.sumD2));
+            } else {
+                printf("SNR               : infinite (identical)\n");
+            }
+            if (varA > 0.0 && varB > 0.0) {
+                printf("Correlation       : %.9f\n", covAB / sqrt(varA * varB));
+            } else {
+                printf("Correlation       : undefined (a slot is constant)\n");
+            }
+            printf("Compared in %.4f s\n", seconds);
+        } else if (choice == 3) {
+            char name[SNAP_NAME];
+            SlotView v;
+
+            if (safe_get_text("Slot to copy: ", name, sizeof(name)) != 0 ||
+                slot_find(name, &v) != 0 || strcmp(name, "ref") == 0) {
+                printf("No such slot (use buffer or a menu 28 version name).\n");
+                continue;
+            }
+            if (refSamples == NULL) {
+                refSamples = malloc(SAMPLE_BUF_SIZE * sizeof(double));
+                if (refSamples == NULL) {
+                    printf("Not enough memory.\n");
+                    continue;
+                }
+            }
+            for (long at = 0; at < v.count; ) {
+                long len;
+                const double *p = slot_piece(&v, at, &len);
+                memcpy(&refSamples[at], p, (size_t)len * sizeof(double));
+                at += len;
+            }
+            refCount = (int)v.count;
+            printf("Reference now holds %d samples from '%s'.\n", refCount, name);
+        } else {
+            printf("Invalid choice.\n");
+        }
+    }
+
+    go_back_to_main();
+}
+
+// 42) Session snapshot
+//
+// Saves everything the session has built up (sample and reference
+// buffers, named versions, the region index, the envelope series, trigger
+// events and frame rules) to one binary file, and restores it later.
+// Sections are page aligned in native layout, so restoring maps the file
+// and works on the sections where they lie; nothing is parsed, copied or
+// recomputed. The undo history and capture pyramids (.pyr) are not saved.
+void menu_item_42(void)
+{
+    int running = 1;
+    int choice;
+
+    printf("\n>> Menu 42: Session snapshot\n");
+
+    while (running) {
+        printf("\nChoose an option:\n");
+        printf(" 1) Save session\n");
+        printf(" 2) Restore session\n");
+        printf(" 3) Autosave on exit (currently %s)\n",
+               autosaveOn ? autosavePath : "off");
+        printf(" 0) Return to main menu\n");
+
+        if (safe_get_int("Enter choice (0–3): ", &choice) != 0) {
+            printf("Input error.\n");
+            continue;
+        }
+
+        if (choice == 0) {
+            running = 0;
+        } else if (choice == 1) {
+            char filename[100];
+            struct timespec start;
+            struct stat st;
+
+            if (safe_get_filename("Session file to write (e.g. work.wfs): ",
+                                  filename, sizeof(filename)) != 0) {
+                printf("Input error.\n");
+                continue;
+            }
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            if (session_save(filename) != 0) {
+                printf("Could not write %s: %s\n", filename, strerror(errno));
+                continue;
+            }
+            double seconds = elapsed_seconds(&start);
+            if (stat(filename, &st) == 0) {
+                printf("Saved %s (%.1f MB) in %.3f s\n", filename,
+                       st.st_size / 1048576.0, seconds);
+            }
+        } else if (choice == 2) {
+            char filename[100];
+            struct timespec start;
+
+            if (safe_get_filename("Session file to restore: ", filename, sizeof(filename)) != 0) {
+                printf("Input error.\n");
+                continue;
+            }
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            int rc = session_restore(filename);
+            double seconds = elapsed_seconds(&start);
+
+            if (rc == -1) {
+                printf("Could not open %s: %s\n", filename, strerror(errno));
+                continue;
+            }
+            if (rc == -2) {
+                printf("%s is not a session file from this version.\n", filename);
+                continue;
+            }
+            if (rc == -3) {
+                printf("Not enough memory: the session was only partly restored.\n");
+            }
+            printf("Restored in %.3f s (menu 28 can undo the buffer change):\n", seconds);
+            printf("  buffer    : %d samples%s%s\n", dataAvailable ? sampleCount : 0,
+                   signalType[0] != '\0' ? ", " : "", signalType);
+            printf("  reference : %d samples\n", refCount);
+            printf("  versions  : %d named\n", namedCount);
+            printf("  region idx: %s\n", roiIndex.built ? "ready" : "not saved");
+            printf("  envelope  : %ld windows%s\n", envelope.count,
+                   (envelope.count > 0 && envelope.generation != sampleGeneration) ? " (stale)" : "");
+            printf("  triggers  : %ld events%s\n", trigCount,
+                   (trigCount > 0 && trigGeneration != sampleGeneration) ? " (stale)" : "");
+            printf("  frame rules: %d\n", frameRuleCount < 0 ? 0 : frameRuleCount);
+        } else if (choice == 3) {
+            int on;
+
+            if (safe_get_int("Autosave when leaving with option 0 (1 = yes, 0 = no): ", &on) != 0) {
+                printf("Input error.\n");
+                continue;
+            }
+            if (on && safe_get_filename("Session file for autosave: ",
+                                        autosavePath, sizeof(autosavePath)) != 0) {
+                printf("Input error.\n");
+                continue;
+            }
+            autosaveOn = (on != 0);
+            printf("Autosave is %s.\n", autosaveOn ? "on" : "off");
+        } else {
+            printf("Invalid choice.\n");
+        }
+    }
+
+    go_back_to_main();
+}
+
+// ========== Helper Functions (analysis) ==========
+
+double find_min(const double a[], int n)
+{
+    int i;
+    double min = a[0];
+    for (i = 1; i < n; i++) {
+        if (a[i] < min)
+            min = a[i];
+    }
+    return min;
+}
+
+double find_max(const double a[], int n)
+{
+    int i;
+    double max = a[0];
+    for (i = 1; i < n; i++) {
+        if (a[i] > max)
+            max = a[i];
+    }
+    return max;
+}
+
+double calc_average(const double a[], int n)
+{
+    return accurate_sum(a, n, 0) / n;
+}
+
+double calc_rms(const double a[], int n)
+{
+    return sqrt(accurate_sum(a, n, 1) / n);
+}
+
+int count_zero_crossings(const double a[], int n)
+{
+    int count = 0;
+    for (int i = 1; i < n; i++) {
+        if ((a[i - 1] > 0 && a[i] < 0) ||
+            (a[i - 1] < 0 && a[i] > 0)) {
+            count++;
+        }
+    }
+    return count;
+}
+
+// simple peak detection: a peak is higher than both neighbours
+int detect_peaks(const double a[], int n)
+{
+    int count = 0;
+
+    if (n < 3) {
+        return 0; // need at least 3 points
+    }
+
+    for (int i = 1; i < n - 1; i++) {
+        if (a[i] > a[i - 1] && a[i] > a[i + 1]) {
+            printf("Peak at index %d, value = %.4f\n", i, a[i]);
+            count++;
+        }
+    }
+
+    return count;
+}
+
+// moving average smoothing (in-place), returns -1 if out of memory
+int smooth_moving_average(double a[], int n, int windowSize)
+{
+    double *temp = malloc((size_t)n * sizeof(double));
+    int half = windowSize / 2;
+
+    if (temp == NULL) {
+        return -1;
+    }
+
+    for (int i = 0; i < n; i++) {
+        temp[i] = a[i];
+    }
+
+    for (int i = 0; i < n; i++) {
+        double sum = 0.0;
+        int count = 0;
+
+        int start = i - half;
+        int end   = i + half;
+
+        if (start < 0) start = 0;
+        if (end >= n) end = n - 1;
+
+        for (int j = start; j <= end; j++) {
+            sum += temp[j];
+            count++;
+        }
+
+        a[i] = sum / count;
+    }
+
+    free(temp);
+    return 0;
+}
+
+// generate a simple sine wave
+void generate_sine_wave(double a[], int n, double amplitude, int periods)
+{
+    const double TWO_PI = 6.28318530717958647692;
+    for (int i = 0; i < n; i++) {
+        double t = (double)i / (double)n;  // 0 to 1
+        a[i] = amplitude * sin(TWO_PI * periods * t);
+    }
+}
+
+// samples[] is about to change (or just has): cached indexes are stale
+void samples_changed(void)
+{
+    sampleGeneration++;
+}
+
+// menu 3/4/5 style results for n samples summarised in r
+void print_summary(const SummaryNode *r, long long n)
+{
+    double rms = sqrt(r->sumSq / n);
+    double peak = fmax(fabs(r->min), fabs(r->max));
+
+    printf("Samples           : %lld\n", n);
+    printf("Min / Max         : %.4f / %.4f\n", r->min, r->max);
+    printf("Peak-to-peak      : %.4f\n", r->max - r->min);
+    printf("DC / RMS          : %.4f / %.4f\n", r->sum / n, rms);
+    printf("Crest factor      : %.4f\n", (rms > 0.0) ? peak / rms : 0.0);
+}
+
+// ========== Helper Functions (maths) ==========
+
+// Quadratic roots for a block of equations a*x^2 + b*x + c = 0.
+// Uses q = -(b + sign(b)*sqrt(D)) / 2, x1 = q / a, x2 = c / q, which avoids
+// the cancellation of -b + sqrt(D) when b*b >> 4ac. Complex pairs are
+// returned with x1im >= 0 and x2im = -x1im. When a = 0 the single linear
+// root goes in x1 and x2 is NaN (NaN in both if b is also 0).
+// The loop body only selects between precomputed values, so with the
+// Makefile flags the compiler runs it in SIMD lanes.
+void solve_quadratic_block(const double a[], const double b[], const double c[],
+                           double *restrict x1re, double *restrict x1im,
+                           double *restrict x2re, double *restrict x2im, int n)
+{
+    for (int i = 0; i < n; i++) {
+        double A = a[i], B = b[i], C = c[i];
+        double D = B * B - 4.0 * A * C;
+        double sqrtAbsD = sqrt(fabs(D));
+
+        // every candidate is computed, then selected below
+        double q = -0.5 * (B + copysign(sqrtAbsD, B));
+        double r1 = q / A;
+        double r2 = C / q;
+        double re = -B / (2.0 * A);
+        double im = sqrtAbsD / fabs(2.0 * A);
+        double lin = -C / B;
+
+        r2 = (q != 0.0) ? r2 : 0.0;    // b = 0 and D = 0 means c = 0
+        lin = (B != 0.0) ? lin : NAN;
+
+        double x1r = (D >= 0.0) ? r1 : re;
+        double x2r = (D >= 0.0) ? r2 : re;
+        double xi  = (D >= 0.0) ? 0.0 : im;
+
+        x1re[i] = (A == 0.0) ? lin : x1r;
+        x2re[i] = (A == 0.0) ? NAN : x2r;
+        xi = (A == 0.0) ? 0.0 : xi;
+        x1im[i] = xi;
+        x2im[i] = -xi;
+    }
+}
+
+// seconds since 'start' on the monotonic clock
+double elapsed_seconds(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - start->tv_sec) +
+           (double)(now.tv_nsec - start->tv_nsec) * 1e-9;
+}
+
+// ========== Helper Functions (sensor / ADC) ==========
+
+// sensor models used by menus 19 and 23 (0 = plain voltage)
+double sensor_from_voltage(int sensor, double voltage)
+{
+    switch (sensor) {
+        case 1:  return voltage / 0.01;           // LM35: 10 mV/°C = 0.01 V/°C
+        case 2:  return (voltage / 5.0) * 100.0;  // 0–5 V -> 0–100 kPa
+        case 3:  return (voltage - 1.65) / 0.3;   // 1.65 V at 0 g, 0.3 V/g
+        default: return voltage;
+    }
+}
+
+// All sensor models are linear, so code -> units is code * scale + offset
+void adc_linear_map(int sensor, double vref, double *scale, double *offset)
+{
+    *offset = sensor_from_voltage(sensor, 0.0);
+    *scale  = sensor_from_voltage(sensor, vref / ADC_MAX) - *offset;
+}
+
+// unpack 12-bit samples stored two per 3 bytes (low nibble first)
+void unpack_adc12(const uint8_t *restrict in, int nPairs, uint16_t *restrict codes)
+{
+    for (int i = 0; i < nPairs; i++) {
+        unsigned b0 = in[3 * i], b1 = in[3 * i + 1], b2 = in[3 * i + 2];
+        codes[2 * i]     = (uint16_t)(b0 | ((b1 & 0x0Fu) << 8));
+        codes[2 * i + 1] = (uint16_t)((b1 >> 4) | (b2 << 4));
+    }
+}
+
+void adc_codes_to_units(const uint16_t *restrict codes, int n,
+                        double scale, double offset, double *restrict out)
+{
+    for (int i = 0; i < n; i++) {
+        out[i] = (double)codes[i] * scale + offset;
+    }
+}
+
+// write values as raw doubles or as text (one per line), -1 on error
+int write_doubles(FILE *fp, const double a[], int n, int binary)
+{
+    if (binary) {
+        return (fwrite(a, sizeof(double), (size_t)n, fp) == (size_t)n) ? 0 : -1;
+    }
+    for (int i = 0; i < n; i++) {
+        if (fprintf(fp, "%.10g\n", a[i]) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// ========== Helper Functions (calibration) ==========
+
+// read a curve definition (format described above menu_item_24)
+int cal_load_curve(const char *filename, CalCurve *cv)
+{
+    char line[256];
+    int lineNo = 0;
+    FILE *fp = fopen(filename, "r");
+
+    if (fp == NULL) {
+        printf("Could not open curve file.\n");
+        return -1;
+    }
+
+    memset(cv, 0, sizeof(*cv));
+    snprintf(cv->unit, sizeof(cv->unit), "units");
+    cv->vref = 3.3;
+    cv->bits = 12;
+    cv->vMin = 0.0;
+    cv->vMax = -1.0;   // -1 = up to vref
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        char *key, *arg;
+        lineNo++;
+        line[strcspn(line, "#\n")] = '\0';
+        key = strtok(line, " \t\r");
+        if (key == NULL) {
+            continue;
+        }
+
+        if (strcmp(key, "type") == 0) {
+            arg = strtok(NULL, " \t\r");
+            if (arg != NULL && strcmp(arg, "poly") == 0) {
+                cv->type = CAL_POLY;
+            } else if (arg != NULL && strcmp(arg, "steinhart") == 0) {
+                cv->type = CAL_STEINHART;
+            } else if (arg != NULL && strcmp(arg, "table") == 0) {
+                cv->type = CAL_TABLE;
+            } else {
+                printf("Line %d: unknown curve type.\n", lineNo);
+                fclose(fp);
+                return -1;
+            }
+        } else if (strcmp(key, "unit") == 0) {
+            arg = strtok(NULL, " \t\r");
+            if (arg != NULL) {
+                snprintf(cv->unit, sizeof(cv->unit), "%s", arg);
+            }
+        } else if (strcmp(key, "vref") == 0) {
+            arg = strtok(NULL, " \t\r");
+            cv->vref = (arg != NULL) ? strtod(arg, NULL) : 0.0;
+        } else if (strcmp(key, "bits") == 0) {
+            arg = strtok(NULL, " \t\r");
+            cv->bits = (arg != NULL) ? atoi(arg) : 0;
+        } else if (strcmp(key, "range") == 0) {
+            char *lo = strtok(NULL, " \t\r"), *hi = strtok(NULL, " \t\r");
+            if (hi == NULL) {
+                printf("Line %d: range needs Vmin Vmax.\n", lineNo);
+                fclose(fp);
+                return -1;
+            }
+            cv->vMin = strtod(lo, NULL);
+            cv->vMax = strtod(hi, NULL);
+        } else if (strcmp(key, "coeffs") == 0) {
+            cv->nCoeffs = 0;
+            while ((arg = strtok(NULL, " \t\r")) != NULL && cv->nCoeffs < CAL_MAX_COEFFS) {
+                cv->coeffs[cv->nCoeffs++] = strtod(arg, NULL);
+            }
+        } else if (strcmp(key, "steinhart") == 0) {
+            char *a = strtok(NULL, " \t\r"), *b = strtok(NULL, " \t\r"), *c = strtok(NULL, " \t\r");
+            if (c == NULL) {
+                printf("Line %d: steinhart needs A B C.\n", lineNo);
+                fclose(fp);
+                return -1;
+            }
+            cv->shA = strtod(a, NULL);
+            cv->shB = strtod(b, NULL);
+            cv->shC = strtod(c, NULL);
+        } else if (strcmp(key, "divider") == 0) {
+            char *r = strtok(NULL, " \t\r"), *v = strtok(NULL, " \t\r");
+            if (v == NULL) {
+                printf("Line %d: divider needs Rfixed Vsupply.\n", lineNo);
+                fclose(fp);
+                return -1;
+            }
+            cv->rFixed = strtod(r, NULL);
+            cv->vSupply = strtod(v, NULL);
+        } else if (strcmp(key, "point") == 0) {
+            char *v = strtok(NULL, " \t\r"), *y = strtok(NULL, " \t\r");
+            if (y == NULL || cv->nPoints >= CAL_MAX_POINTS) {
+                printf("Line %d: bad point or too many points.\n", lineNo);
+                fclose(fp);
+                return -1;
+            }
+            cv->ptV[cv->nPoints] = strtod(v, NULL);
+            cv->ptY[cv->nPoints] = strtod(y, NULL);
+            if (cv->nPoints > 0 && cv->ptV[cv->nPoints] <= cv->ptV[cv->nPoints - 1]) {
+                printf("Line %d: points must have ascending V.\n", lineNo);
+                fclose(fp);
+                return -1;
+            }
+            cv->nPoints++;
+        } else {
+            printf("Line %d: unknown keyword '%s'.\n", lineNo, key);
+            fclose(fp);
+            return -1;
+        }
+    }
+    fclose(fp);
+
+    if (cv->vref <= 0.0 || cv->bits < 2 || cv->bits > 16) {
+        printf("vref must be positive and bits between 2 and 16.\n");
+        return -1;
+    }
+    if (cv->vMax < 0.0) {
+        cv->vMax = cv->vref;
+    }
+    if (cv->vMin < 0.0 || cv->vMax > cv->vref || cv->vMin >= cv->vMax) {
+        printf("range must satisfy 0 <= Vmin < Vmax <= vref.\n");
+        return -1;
+    }
+    if ((cv->type == CAL_POLY && cv->nCoeffs == 0) ||
+        (cv->type == CAL_STEINHART && (cv->rFixed <= 0.0 || cv->vSupply <= 0.0)) ||
+        (cv->type == CAL_TABLE && cv->nPoints < 2) ||
+        cv->type == 0) {
+        printf("Curve definition is incomplete.\n");
+        return -1;
+    }
+    // the divider gives r = 0 at 0 V and r = inf at vSupply: log() of either
+    // would poison the end nodes of the table
+    if (cv->type == CAL_STEINHART && !(cv->vMin > 0.0 && cv->vMax < cv->vSupply)) {
+        printf("Steinhart curves need a range with 0 < Vmin < Vmax < Vsupply (divider).\n");
+        return -1;
+    }
+    return 0;
+}
+
+// exact (slow) curve value at a given input voltage
+double cal_curve_eval(const CalCurve *cv, double volts)
+{
+    if (cv->type == CAL_POLY) {
+        double y = 0.0;
+        for (int k = cv->nCoeffs - 1; k >= 0; k--) {
+            y = y * volts + cv->coeffs[k];   // Horner
+        }
+        return y;
+    }
+
+    if (cv->type == CAL_STEINHART) {
+        double r = cv->rFixed * volts / (cv->vSupply - volts);
+        double lnR = log(r);
+        return 1.0 / (cv->shA + cv->shB * lnR + cv->shC * lnR * lnR * lnR) - 273.15;
+    }
+
+    // tabulated: linear between points, flat outside the range
+    if (volts <= cv->ptV[0]) return cv->ptY[0];
+    if (volts >= cv->ptV[cv->nPoints - 1]) return cv->ptY[cv->nPoints - 1];
+
+    int lo = 0, hi = cv->nPoints - 1;
+    while (hi - lo > 1) {
+        int mid = (lo + hi) / 2;
+        if (cv->ptV[mid] <= volts) lo = mid; else hi = mid;
+    }
+    double f = (volts - cv->ptV[lo]) / (cv->ptV[hi] - cv->ptV[lo]);
+    return cv->ptY[lo] + f * (cv->ptY[hi] - cv->ptY[lo]);
+}
+
+// sample the curve at 'nodes' evenly spaced codes and measure the error
+void cal_compile(const CalCurve *cv, int nodes, int cubic, CalLut *lut)
+{
+    double fullScale = (double)((1 << cv->bits) - 1);
+
+    if (nodes > CAL_LUT_MAX) nodes = CAL_LUT_MAX;
+
+    lut->nodes = nodes;
+    lut->minCode = cv->vMin / cv->vref * fullScale;
+    lut->maxCode = cv->vMax / cv->vref * fullScale;
+    lut->codesPerNode = (lut->maxCode - lut->minCode) / (nodes - 1);
+    lut->cubic = cubic;
+
+    for (int j = 0; j < nodes; j++) {
+        double code = lut->minCode + j * lut->codesPerNode;
+        lut->table[j + 1] = cal_curve_eval(cv, code * cv->vref / fullScale);
+    }
+    // guard nodes: straight-line extension so cubic needs no edge cases
+    lut->table[0] = 2.0 * lut->table[1] - lut->table[2];
+    lut->table[nodes + 1] = 2.0 * lut->table[nodes] - lut->table[nodes - 1];
+    lut->table[nodes + 2] = lut->table[nodes + 1];
+
+    lut->maxError = 0.0;
+    lut->maxErrorCode = (int)ceil(lut->minCode);
+    for (int code = (int)ceil(lut->minCode); code <= (int)lut->maxCode; code++) {
+        double exact = cal_curve_eval(cv, code * cv->vref / fullScale);
+        double err = fabs(cal_lookup(lut, code) - exact);
+        if (isfinite(exact) && err > lut->maxError) {
+            lut->maxError = err;
+            lut->maxErrorCode = code;
+        }
+    }
+}
+
+// table lookup with linear or Catmull-Rom interpolation
+double cal_lookup(const CalLut *lut, double code)
+{
+    if (code < lut->minCode) code = lut->minCode;
+    if (code > lut->maxCode) code = lut->maxCode;
+
+    double t = (code - lut->minCode) / lut->codesPerNode;
+    int j = (int)t;
+    if (j > lut->nodes - 2) j = lut->nodes - 2;
+    double f = t - j;
+
+    const double *p = &lut->table[j];   // p[1] is node j
+    if (!lut->cubic) {
+        return p[1] + f * (p[2] - p[1]);
+    }
+    return p[1] + 0.5 * f * (p[2] - p[0] +
+           f * (2.0 * p[0] - 5.0 * p[1] + 4.0 * p[2] - p[3] +
+           f * (3.0 * (p[1] - p[2]) + p[3] - p[0])));
+}
+
+void cal_apply(const CalLut *lut, const double in[], double out[], int n)
+{
+    for (int i = 0; i < n; i++) {
+        out[i] = cal_lookup(lut, in[i]);
+    }
+}
+
+// ========== Helper Functions (units) ==========
+
+// find a unit such as "mV", "kohm" or "degC" in the tables, -1 if unknown
+int unit_lookup(const char *text, double *scale, double *offset, int *dimension)
+{
+    int nUnits = (int)(sizeof(UNITS) / sizeof(UNITS[0]));
+    int nPrefixes = (int)(sizeof(SI_PREFIXES) / sizeof(SI_PREFIXES[0]));
+
+    // exact names first, so "m" is metres and "min" is minutes
+    for (int u = 0; u < nUnits; u++) {
+        if (strcmp(text, UNITS[u].symbol) == 0) {
+            *scale = UNITS[u].scale;
+            *offset = UNITS[u].offset;
+            *dimension = UNITS[u].dimension;
+            return 0;
+        }
+    }
+
+    for (int p = 0; p < nPrefixes; p++) {
+        size_t len = strlen(SI_PREFIXES[p].symbol);
+        if (strncmp(text, SI_PREFIXES[p].symbol, len) != 0) {
+            continue;
+        }
+        for (int u = 0; u < nUnits; u++) {
+            if (UNITS[u].prefixable && strcmp(text + len, UNITS[u].symbol) == 0) {
+                *scale = SI_PREFIXES[p].factor * UNITS[u].scale;
+                *offset = UNITS[u].offset;
+                *dimension = UNITS[u].dimension;
+                return 0;
+            }
+        }
+    }
+    return -1;
+}
+
+// y = x * scale + offset converts 'from' to 'to'; prints the reason on error
+int unit_conversion(const char *from, const char *to, double *scale, double *offset)
+{
+    double s1, o1, s2, o2;
+    int d1, d2;
+
+    if (unit_lookup(from, &s1, &o1, &d1) != 0) {
+        printf("Unknown unit '%s'.\n", from);
+        return -1;
+    }
+    if (unit_lookup(to, &s2, &o2, &d2) != 0) {
+        printf("Unknown unit '%s'.\n", to);
+        return -1;
+    }
+    if (d1 != d2) {
+        printf("Cannot convert %s (%s) to %s (%s).\n", from, UNIT_DIMENSIONS[d1],
+               to, UNIT_DIMENSIONS[d2]);
+        return -1;
+    }
+
+    *scale = s1 / s2;
+    *offset = (o1 - o2) / s2;
+    return 0;
+}
+
+// a[i * stride] = a[i * stride] * scale + offset for every row
+void scale_offset_column(double a[], long rows, int stride, double scale, double offset)
+{
+    if (stride == 1) {
+        for (long i = 0; i < rows; i++) {
+            a[i] = a[i] * scale + offset;
+        }
+        return;
+    }
+    for (long i = 0; i < rows; i++) {
+        a[i * stride] = a[i * stride] * scale + offset;
+    }
+}
+
+// ========== Helper Functions (threads) ==========
+
+typedef struct {
+    RangeFn fn;
+    void *ctx;
+    long start, end;
+} RangeTask;
+
+// number of worker threads to use (online CPUs, at most MAX_THREADS)
+int worker_count(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    if (n < 1) n = 1;
+    if (n > MAX_THREADS) n = MAX_THREADS;
+    return (int)n;
+}
+
+void *parallel_range_thread(void *arg)
+{
+    RangeTask *task = arg;
+    task->fn(task->ctx, task->start, task->end);
+    return NULL;
+}
+
+// split [0, n) into contiguous chunks (at least minChunk items each) and
+// run fn on each chunk in its own thread; the caller runs the first chunk
+void parallel_range(long n, long minChunk, RangeFn fn, void *ctx)
+{
+    RangeTask tasks[MAX_THREADS];
+    pthread_t threads[MAX_THREADS];
+    int started[MAX_THREADS];
+    long nWorkers = worker_count();
+
+    if (minChunk < 1) minChunk = 1;
+    if (nWorkers > n / minChunk) nWorkers = n / minChunk;
+    if (nWorkers <= 1) {
+        if (n > 0) fn(ctx, 0, n);
+        return;
+    }
+
+    for (int w = 0; w < nWorkers; w++) {
+        tasks[w].fn = fn;
+        tasks[w].ctx = ctx;
+        tasks[w].start = n * w / nWorkers;
+        tasks[w].end = n * (w + 1) / nWorkers;
+        started[w] = 0;
+    }
+    for (int w = 1; w < nWorkers; w++) {
+        started[w] = (pthread_create(&threads[w], NULL, parallel_range_thread, &tasks[w]) == 0);
+    }
+
+    fn(ctx, tasks[0].start, tasks[0].end);
+
+    for (int w = 1; w < nWorkers; w++) {
+        if (started[w]) {
+            pthread_join(threads[w], NULL);
+        } else {
+            fn(ctx, tasks[w].start, tasks[w].end);   // thread failed, run here
+        }
+    }
+}
+
+// ========== Helper Functions (summation) ==========
+//
+// accurate_sum() always adds the same numbers in the same order, whatever
+// the thread count or vector width: the input is cut into SUM_BLOCK blocks,
+// each block is summed in SUM_LANES fixed lanes, and the block sums are
+// combined pairwise over a tree that depends only on n. Threads just
+// compute different blocks. Rounding error grows with log(n) rather than n.
+// Build with -ffp-contract=off (as the Makefile does): GCC ignores
+// "#pragma STDC FP_CONTRACT", and a fused x * x + lane would round
+// differently on CPUs with FMA.
+
+typedef struct {
+    const double *a;
+    long n;
+    int squares;
+    double *partials;
+} SumTask;
+
+// sum (or sum of squares) of one block, in SUM_LANES interleaved lanes
+double block_sum(const double *restrict a, long n, int squares)
+{
+    double lane[SUM_LANES] = {0.0};
+    long i = 0;
+
+    if (squares) {
+        for (; i + SUM_LANES <= n; i += SUM_LANES) {
+            for (int j = 0; j < SUM_LANES; j++) lane[j] += a[i + j] * a[i + j];
+        }
+        for (int j = 0; i + j < n; j++) lane[j] += a[i + j] * a[i + j];
+    } else {
+        for (; i + SUM_LANES <= n; i += SUM_LANES) {
+            for (int j = 0; j < SUM_LANES; j++) lane[j] += a[i + j];
+        }
+        for (int j = 0; i + j < n; j++) lane[j] += a[i + j];
+    }
+    return ((lane[0] + lane[1]) + (lane[2] + lane[3])) +
+           ((lane[4] + lane[5]) + (lane[6] + lane[7]));
+}
+
+void sum_blocks_range(void *ctx, long start, long end)
+{
+    SumTask *t = ctx;
+    for (long b = start; b < end; b++) {
+        long first = b * SUM_BLOCK;
+        long len = (t->n - first < SUM_BLOCK) ? t->n - first : SUM_BLOCK;
+        t->partials[b] = block_sum(t->a + first, len, t->squares);
+    }
+}
+
+// pairwise sum of blocks [lo, hi); blocks come from partials when given,
+// otherwise they are summed here (same tree, same result)
+double tree_sum(const double *partials, long lo, long hi,
+                const double a[], long n, int squares)
+{
+    if (hi - lo == 1) {
+        if (partials != NULL) {
+            return partials[lo];
+        }
+        long first = lo * SUM_BLOCK;
+        return block_sum(a + first, (n - first < SUM_BLOCK) ? n - first : SUM_BLOCK, squares);
+    }
+    long mid = lo + (hi - lo) / 2;
+    return tree_sum(partials, lo, mid, a, n, squares) +
+           tree_sum(partials, mid, hi, a, n, squares);
+}
+
+// sum of a[] (squares = 0) or of a[]^2 (squares = 1), bit-identical for
+// any number of threads
+double accurate_sum(const double a[], long n, int squares)
+{
+    long nBlocks = (n + SUM_BLOCK - 1) / SUM_BLOCK;
+    SumTask task;
+    double total;
+
+    if (n <= 0) {
+        return 0.0;
+    }
+    if (nBlocks < 64) {
+        return tree_sum(NULL, 0, nBlocks, a, n, squares);   // too small to share
+    }
+
+    task.a = a;
+    task.n = n;
+    task.squares = squares;
+    task.partials = malloc((size_t)nBlocks * sizeof(double));
+    if (task.partials == NULL) {
+        return tree_sum(NULL, 0, nBlocks, a, n, squares);
+    }
+    parallel_range(nBlocks, 64, sum_blocks_range, &task);
+    total = tree_sum(task.partials, 0, nBlocks, a, n, squares);
+    free(task.partials);
+    return total;
+}
+
+// ========== Helper Functions (frequency response) ==========
+
+Cplx cplx_make(double re, double im)
+{
+    Cplx z = { re, im };
+    return z;
+}
+
+Cplx cplx_add(Cplx a, Cplx b)
+{
+    return cplx_make(a.re + b.re, a.im + b.im);
+}
+
+Cplx cplx_mul(Cplx a, Cplx b)
+{
+    return cplx_make(a.re * b.re - a.im * b.im, a.re * b.im + a.im * b.re);
+}
+
+Cplx cplx_div(Cplx a, Cplx b)
+{
+    double d = b.re * b.re + b.im * b.im;
+    return cplx_make((a.re * b.re + a.im * b.im) / d, (a.im * b.re - a.re * b.im) / d);
+}
+
+// fill sweep points [start, end) of an RcSweep
+void rc_sweep_range(void *ctx, long start, long end)
+{
+    RcSweep *sw = ctx;
+    double logF1 = log(sw->f1);
+    double logStep = (log(sw->f2) - logF1) / (double)(sw->points - 1);
+
+    for (long k = start; k < end; k++) {
+        double f = exp(logF1 + logStep * (double)k);
+        double w = 2.0 * M_PI * f;
+        Cplx H;
+
+        if (!sw->loaded) {
+            H = cplx_make(1.0, 0.0);
+            for (int s = 0; s < sw->nStages; s++) {
+                Cplx jwRC = cplx_make(0.0, w * sw->R[s] * sw->C[s]);
+                Cplx num = (sw->type[s] == 1) ? cplx_make(1.0, 0.0) : jwRC;
+                H = cplx_mul(H, cplx_div(num, cplx_add(cplx_make(1.0, 0.0), jwRC)));
+            }
+        } else {
+            // chain [A B; C D] of series Z then shunt Y for every stage
+            Cplx A = cplx_make(1.0, 0.0), B = cplx_make(0.0, 0.0);
+            Cplx Cm = cplx_make(0.0, 0.0), D = cplx_make(1.0, 0.0);
+            for (int s = 0; s < sw->nStages; s++) {
+                Cplx zC = cplx_make(0.0, -1.0 / (w * sw->C[s]));
+                Cplx yC = cplx_make(0.0, w * sw->C[s]);
+                Cplx Z = (sw->type[s] == 1) ? cplx_make(sw->R[s], 0.0) : zC;
+                Cplx Y = (sw->type[s] == 1) ? yC : cplx_make(1.0 / sw->R[s], 0.0);
+                // [A B; C D] * [1 Z; 0 1] * [1 0; Y 1]
+                Cplx b2 = cplx_add(cplx_mul(A, Z), B);
+                Cplx d2 = cplx_add(cplx_mul(Cm, Z), D);
+                A = cplx_add(A, cplx_mul(b2, Y));
+                Cm = cplx_add(Cm, cplx_mul(d2, Y));
+                B = b2;
+                D = d2;
+            }
+            H = cplx_div(cplx_make(1.0, 0.0), A);   // open-circuit: Vout / Vin = 1 / A
+        }
+
+        sw->freq[k] = f;
+        sw->magDb[k] = 10.0 * log10(H.re * H.re + H.im * H.im);
+        sw->phaseDeg[k] = atan2(H.im, H.re) * 180.0 / M_PI;
+    }
+}
+
+// frequency where the line between (f1, y1) and (f2, y2) on a log-f axis
+// reaches 'level'
+double interp_log_crossing(double f1, double y1, double f2, double y2, double level)
+{
+    double t = (level - y1) / (y2 - y1);
+    return exp(log(f1) + t * (log(f2) - log(f1)));
+}
+
+// least-squares slope of magDb against log10(freq) over points [from, to]
+double fit_slope_per_decade(const double freq[], const double magDb[], long from, long to)
+{
+    double sx = 0.0, sy = 0.0, sxx = 0.0, sxy = 0.0;
+    long n = to - from + 1;
+
+    if (from < 0) from = 0;
+    if (n < 2) return 0.0;
+
+    for (long k = from; k <= to; k++) {
+        double x = log10(freq[k]);
+        sx += x;
+        sy += magDb[k];
+        sxx += x * x;
+        sxy += x * magDb[k];
+    }
+    return (n * sxy - sx * sy) / (n * sxx - sx * sx);
+}
+
+// ========== Helper Functions (E-series) ==========
+
+// standard values from 'firstDecade' upwards, sorted; returns the count
+int eseries_build(int series, double firstDecade, int decades, double out[])
+{
+    static const double E24[24] = {
+        1.0, 1.1, 1.2, 1.3, 1.5, 1.6, 1.8, 2.0, 2.2, 2.4, 2.7, 3.0,
+        3.3, 3.6, 3.9, 4.3, 4.7, 5.1, 5.6, 6.2, 6.8, 7.5, 8.2, 9.1
+    };
+    double base[192];
+    int n = 0;
+
+    if (series <= 24) {
+        // E12 and E6 are every 2nd / 4th E24 value
+        int step = 24 / series;
+        for (int i = 0; i < 24; i += step) base[n++] = E24[i];
+    } else {
+        // E48/E96/E192: 10^(i/192) to 3 significant figures, one exception
+        int step = 192 / series;
+        for (int i = 0; i < 192; i += step) {
+            base[n++] = (i == 185) ? 9.20 : round(pow(10.0, i / 192.0) * 100.0) / 100.0;
+        }
+    }
+
+    int count = 0;
+    double decade = firstDecade;
+    for (int d = 0; d < decades; d++) {
+        for (int i = 0; i < n; i++) {
+            out[count++] = base[i] * decade;
+        }
+        decade *= 10.0;
+    }
+    return count;
+}
+
+// index of the table value closest to x (table sorted ascending)
+int nearest_index(const double t[], int n, double x)
+{
+    int lo = 0, hi = n - 1;
+    while (hi - lo > 1) {
+        int mid = (lo + hi) / 2;
+        if (t[mid] <= x) lo = mid; else hi = mid;
+    }
+    return (fabs(t[hi] - x) < fabs(t[lo] - x)) ? hi : lo;
+}
+
+// closest value to x from one part, or two in series (mode 1) or parallel
+// (mode 2); the partner part is found by binary search, O(n log n)
+int eseries_best(const double t[], int n, double x, int allowPairs,
+                 double *v1, double *v2, int *mode)
+{
+    int k = nearest_index(t, n, x);
+    double bestErr = fabs(t[k] - x);
+
+    *v1 = t[k];
+    *v2 = 0.0;
+    *mode = 0;
+
+    if (!allowPairs) {
+        return 0;
+    }
+
+    for (int i = 0; i < n && t[i] < x; i++) {
+        // series: t[i] + b = x, with b >= t[i] so each pair is seen once
+        double need = x - t[i];
+        if (need >= t[i]) {
+            int j = nearest_index(t, n, need);
+            double err = fabs(t[i] + t[j] - x);
+            if (err < bestErr) {
+                bestErr = err;
+                *v1 = t[j]; *v2 = t[i]; *mode = 1;
+            }
+        }
+    }
+    for (int i = n - 1; i >= 0 && t[i] > x; i--) {
+        // parallel: 1/t[i] + 1/b = 1/x, with b >= t[i]
+        double need = 1.0 / (1.0 / x - 1.0 / t[i]);
+        if (need >= t[i]) {
+            int j = nearest_index(t, n, need);
+            double err = fabs(t[i] * t[j] / (t[i] + t[j]) - x);
+            if (err < bestErr) {
+                bestErr = err;
+                *v1 = t[i]; *v2 = t[j]; *mode = 2;
+            }
+        }
+    }
+    return 0;
+}
+
+double eseries_value(double v1, double v2, int mode)
+{
+    if (mode == 1) return v1 + v2;
+    if (mode == 2) return v1 * v2 / (v1 + v2);
+    return v1;
+}
+
+// insert c into the ranked list (smallest |error| first), ignoring repeats
+void eseries_keep(RcChoice top[], int *count, const RcChoice *c)
+{
+    int pos;
+
+    for (int k = 0; k < *count; k++) {
+        if (top[k].fc == c->fc &&
+            eseries_value(top[k].r1, top[k].r2, top[k].rMode) ==
+            eseries_value(c->r1, c->r2, c->rMode)) {
+            // same pair already listed: keep the one with fewer parts
+            if (c->rMode + c->cMode < top[k].rMode + top[k].cMode) top[k] = *c;
+            return;
+        }
+    }
+
+    pos = *count;
+    while (pos > 0 && fabs(top[pos - 1].errPct) > fabs(c->errPct)) {
+        if (pos < ESERIES_TOP) top[pos] = top[pos - 1];
+        pos--;
+    }
+    if (pos < ESERIES_TOP) {
+        top[pos] = *c;
+        if (*count < ESERIES_TOP) (*count)++;
+    }
+}
+
+// "4.7 kohm", "10 kohm + 2.2 kohm", "100 nF || 47 nF"
+void format_parts(double v1, double v2, int mode, const char *unit, char *buf, size_t sz)
+{
+    char a[20], b[20];
+    format_eng(v1, unit, a, sizeof(a));
+    if (mode == 0) {
+        snprintf(buf, sz, "%s", a);
+        return;
+    }
+    format_eng(v2, unit, b, sizeof(b));
+    snprintf(buf, sz, "%s %s %s", a, (mode == 1) ? "+" : "||", b);
+}
+
+// value with an SI prefix, e.g. 0.0000047 F -> "4.7 uF"
+void format_eng(double v, const char *unit, char *buf, size_t sz)
+{
+    static const char *PREFIX[] = { "p", "n", "u", "m", "", "k", "M", "G" };
+    int p = 4;
+    double a = fabs(v);
+
+    while (a >= 1000.0 * (1.0 - 1e-9) && p < 7) { a /= 1000.0; v /= 1000.0; p++; }
+    while (a < 1.0 - 1e-9 && a > 0.0 && p > 0) { a *= 1000.0; v *= 1000.0; p--; }
+    snprintf(buf, sz, "%.3g %s%s", v, PREFIX[p], unit);
+}
+
+// ========== Helper Functions (Monte Carlo) ==========
+
+// seed expander for the per-stream generators
+unsigned long long splitmix64(unsigned long long *state)
+{
+    unsigned long long z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+// xoshiro256+ step, returns a double in [0, 1)
+double xoshiro_uniform(unsigned long long s[4])
+{
+    unsigned long long result = s[0] + s[3];
+    unsigned long long t = s[1] << 17;
+
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = (s[3] << 45) | (s[3] >> 19);
+
+    return (double)(result >> 11) * 0x1.0p-53;
+}
+
+// series / parallel resistance or RC cut-off for one set of part values
+double mc_circuit_value(const McRun *run, const double parts[])
+{
+    if (run->circuit == 3) {
+        return 1.0 / (2.0 * M_PI * parts[0] * parts[1]);
+    }
+    double total = 0.0;
+    for (int i = 0; i < run->nParts; i++) {
+        total += (run->circuit == 1) ? parts[i] : 1.0 / parts[i];
+    }
+    return (run->circuit == 1) ? total : 1.0 / total;
+}
+
+// run PRNG streams [start, end); each stream is seeded from its own index
+void mc_range(void *ctx, long start, long end)
+{
+    McRun *run = ctx;
+    long *hist = calloc(MC_BINS, sizeof(long));
+    static const double TWO_PI = 6.28318530717958647692;
+    double scale = MC_BINS / (run->hi - run->lo);
+    double factor[MC_MAX_PARTS][MC_CHUNK];
+    double value[MC_CHUNK];
+
+    if (hist == NULL) {
+        run->failed = 1;              // its streams are never filled in
+        return;
+    }
+
+    for (long b = start; b < end; b++) {
+        unsigned long long seedState = run->seed ^ ((unsigned long long)b * 0xD1B54A32D192ED03ULL);
+        unsigned long long s[4];
+        long first = b * MC_STREAM;
+        long last = first + MC_STREAM;
+        double sum = 0.0, sumSq = 0.0, mn = INFINITY, mx = -INFINITY;
+
+        if (last > run->trials) last = run->trials;
+        for (int k = 0; k < 4; k++) s[k] = splitmix64(&seedState);
+
+        for (long base = first; base < last; base += MC_CHUNK) {
+            int m = (last - base < MC_CHUNK) ? (int)(last - base) : MC_CHUNK;
+
+            // draw part multipliers for the whole chunk, one part at a time
+            for (int p = 0; p < run->nParts; p++) {
+                double *f = factor[p];
+                double tol = run->tol[p];
+                if (!run->gaussian) {
+                    for (int j = 0; j < m; j++) {
+                        f[j] = 1.0 + tol * (2.0 * xoshiro_uniform(s) - 1.0);
+                    }
+                } else {
+                    double sigma = tol / 3.0;
+                    for (int j = 0; j < m; j += 2) {
+                        // Box-Muller, two normals per pair of uniforms
+                        double u1 = 1.0 - xoshiro_uniform(s), u2 = xoshiro_uniform(s);
+                        double r = sqrt(-2.0 * log(u1));
+                        double z0 = r * cos(TWO_PI * u2), z1 = r * sin(TWO_PI * u2);
+                        if (z0 > 6.0) z0 = 6.0; else if (z0 < -6.0) z0 = -6.0;
+                        if (z1 > 6.0) z1 = 6.0; else if (z1 < -6.0) z1 = -6.0;
+                        f[j] = 1.0 + sigma * z0;
+                        if (j + 1 < m) f[j + 1] = 1.0 + sigma * z1;
+                    }
+                }
+            }
+
+            // evaluate the circuit for the chunk
+            if (run->circuit == 3) {
+                double k = 1.0 / (2.0 * M_PI * run->nominal[0] * run->nominal[1]);
+                for (int j = 0; j < m; j++) {
+                    value[j] = k / (factor[0][j] * factor[1][j]);
+                }
+            } else if (run->circuit == 1) {
+                for (int j = 0; j < m; j++) value[j] = 0.0;
+                for (int p = 0; p < run->nParts; p++) {
+                    for (int j = 0; j < m; j++) value[j] += run->nominal[p] * factor[p][j];
+                }
+            } else {
+                for (int j = 0; j < m; j++) value[j] = 0.0;
+                for (int p = 0; p < run->nParts; p++) {
+                    double g = 1.0 / run->nominal[p];
+                    for (int j = 0; j < m; j++) value[j] += g / factor[p][j];
+                }
+                for (int j = 0; j < m; j++) value[j] = 1.0 / value[j];
+            }
+
+            for (int j = 0; j < m; j++) {
+                double v = value[j];
+                int bin = (int)((v - run->lo) * scale);
+                if (bin < 0) bin = 0;
+                if (bin >= MC_BINS) bin = MC_BINS - 1;
+                hist[bin]++;
+                sum += v;
+                sumSq += v * v;
+                if (v < mn) mn = v;
+                if (v > mx) mx = v;
+            }
+        }
+
+        run->streamSum[b] = sum;
+        run->streamSumSq[b] = sumSq;
+        run->streamMin[b] = mn;
+        run->streamMax[b] = mx;
+    }
+
+    pthread_mutex_lock(&run->lock);
+    for (int k = 0; k < MC_BINS; k++) {
+        run->hist[k] += hist[k];
+    }
+    pthread_mutex_unlock(&run->lock);
+    free(hist);
+}
+
+// value below which p percent of the histogram lies (linear inside a bin)
+double hist_percentile(const long hist[], int bins, double lo, double hi,
+                       long total, double p)
+{
+    double target = p / 100.0 * (double)total;
+    double binW = (hi - lo) / bins;
+    long seen = 0;
+
+    for (int b = 0; b < bins; b++) {
+        if (seen + hist[b] >= target && hist[b] > 0) {
+            double frac = (target - seen) / (double)hist[b];
+            return lo + (b + frac) * binW;
+        }
+        seen += hist[b];
+    }
+    return hi;
+}
+
+// ========== Helper Functions (snapshots) ==========
+
+// copy samples[] into a new version, sharing chunks that equal the
+// matching chunk of snapLatest; returns NULL if out of memory
+SnapVersion *snapshot_capture(const char *name)
+{
+    SnapVersion *v = snapshot_from_array(name, samples, dataAvailable ? sampleCount : 0);
+
+    if (v != NULL) {
+        snapshot_set_latest(v);
+    }
+    return v;
+}
+
+// same for any array of count samples (session restore); snapLatest is
+// only used for sharing, not changed
+SnapVersion *snapshot_from_array(const char *name, const double x[], int count)
+{
+    SnapVersion *v = calloc(1, sizeof(SnapVersion));
+    const SnapVersion *base = snapLatest;
+
+    if (v == NULL) {
+        return NULL;
+    }
+    v->refs = 1;
+    snprintf(v->name, sizeof(v->name), "%s", name);
+    v->count = count;
+    v->nChunks = (v->count + SNAP_CHUNK - 1) / SNAP_CHUNK;
+    v->chunks = calloc(v->nChunks > 0 ? v->nChunks : 1, sizeof(SnapChunk *));
+    if (v->chunks == NULL) {
+        free(v);
+        return NULL;
+    }
+
+    for (int c = 0; c < v->nChunks; c++) {
+        int first = c * SNAP_CHUNK;
+        int len = (v->count - first < SNAP_CHUNK) ? v->count - first : SNAP_CHUNK;
+        SnapChunk *old = (base != NULL && c < base->nChunks) ? base->chunks[c] : NULL;
+
+        if (old != NULL && old->len == len &&
+            memcmp(old->data, &x[first], (size_t)len * sizeof(double)) == 0) {
+            old->refs++;
+            v->chunks[c] = old;
+            continue;
+        }
+
+        SnapChunk *chunk = malloc(sizeof(SnapChunk) + (size_t)len * sizeof(double));
+        if (chunk == NULL) {
+            v->nChunks = c;   // release only what was filled
+            snapshot_release(v);
+            return NULL;
+        }
+        chunk->refs = 1;
+        chunk->len = len;
+        chunk->mark = 0;
+        chunk->map = NULL;
+        chunk->data = chunk->store;
+        memcpy(chunk->data, &x[first], (size_t)len * sizeof(double));
+        v->chunks[c] = chunk;
+    }
+
+    return v;
+}
+
+// copy a version back into samples[]
+void snapshot_restore(SnapVersion *v)
+{
+    samples_changed();
+    for (int c = 0; c < v->nChunks; c++) {
+        memcpy(&samples[c * SNAP_CHUNK], v->chunks[c]->data,
+               (size_t)v->chunks[c]->len * sizeof(double));
+    }
+    sampleCount = v->count;
+    dataAvailable = (v->count > 0);
+    snapshot_set_latest(v);
+}
+
+// copy a version into the reference buffer; returns -1 if out of memory
+int snapshot_restore_ref(const SnapVersion *v)
+{
+    if (refSamples == NULL) {
+        refSamples = malloc(SAMPLE_BUF_SIZE * sizeof(double));
+        if (refSamples == NULL) {
+            return -1;
+        }
+    }
+    for (int c = 0; c < v->nChunks; c++) {
+        memcpy(&refSamples[c * SNAP_CHUNK], v->chunks[c]->data,
+               (size_t)v->chunks[c]->len * sizeof(double));
+    }
+    refCount = v->count;
+    return 0;
+}
+
+void snapshot_release(SnapVersion *v)
+{
+    if (v == NULL || --v->refs > 0) {
+        return;
+    }
+    for (int c = 0; c < v->nChunks; c++) {
+        if (--v->chunks[c]->refs == 0) {
+            session_map_release(v->chunks[c]->map);
+            free(v->chunks[c]);
+        }
+    }
+    snapshot_release(v->ref);
+    free(v->chunks);
+    free(v);
+}
+
+// remember which version samples[] currently matches (sharing base)
+void snapshot_set_latest(SnapVersion *v)
+{
+    if (v != NULL) v->refs++;
+    snapshot_release(snapLatest);
+    snapLatest = v;
+}
+
+// push onto an undo/redo stack, dropping the oldest entry when full
+void snapshot_push(SnapVersion *stack[], int *count, SnapVersion *v)
+{
+    if (*count == SNAP_HISTORY) {
+        snapshot_release(stack[0]);
+        memmove(stack, stack + 1, (SNAP_HISTORY - 1) * sizeof(stack[0]));
+        (*count)--;
+    }
+    stack[(*count)++] = v;
+}
+
+// save samples[] for undo before a menu overwrites them
+void snapshot_before_change(const char *what)
+{
+    SnapVersion *v;
+
+    samples_changed();
+    if (!dataAvailable) {
+        return;
+    }
+    v = snapshot_capture(what);
+    if (v == NULL) {
+        printf("Warning: not enough memory to keep an undo copy.\n");
+        return;
+    }
+    snapshot_push(undoStack, &undoCount, v);
+
+    while (redoCount > 0) {
+        snapshot_release(redoStack[--redoCount]);
+    }
+}
+
+// same for a change to both samples[] and the reference buffer; the undo
+// entry is made even when samples[] is empty
+void snapshot_before_swap(const char *what)
+{
+    SnapVersion *v;
+
+    samples_changed();
+    v = snapshot_capture(what);
+    if (v != NULL) {
+        v->ref = snapshot_from_array("reference", refSamples, refCount);
+    }
+    if (v == NULL || v->ref == NULL) {
+        printf("Warning: not enough memory to keep an undo copy.\n");
+        snapshot_release(v);
+        return;
+    }
+    snapshot_push(undoStack, &undoCount, v);
+
+    while (redoCount > 0) {
+        snapshot_release(redoStack[--redoCount]);
+    }
+}
+
+// bytes of samples held by all versions, and bytes actually stored
+void snapshot_memory(long *logicalBytes, long *storedBytes)
+{
+    static int markValue = 0;
+    SnapVersion *all[4 * SNAP_HISTORY + SNAP_NAMED];
+    int n = 0;
+
+    for (int k = 0; k < undoCount; k++) all[n++] = undoStack[k];
+    for (int k = 0; k < redoCount; k++) all[n++] = redoStack[k];
+    for (int k = 0; k < namedCount; k++) all[n++] = namedVersions[k];
+    for (int k = 0; k < undoCount + redoCount; k++) {
+        if (all[k]->ref != NULL) all[n++] = all[k]->ref;
+    }
+
+    markValue++;
+    *logicalBytes = 0;
+    *storedBytes = 0;
+    for (int k = 0; k < n; k++) {
+        *logicalBytes += (long)all[k]->count * (long)sizeof(double);
+        for (int c = 0; c < all[k]->nChunks; c++) {
+            SnapChunk *chunk = all[k]->chunks[c];
+            if (chunk->mark != markValue) {
+                chunk->mark = markValue;
+                *storedBytes += (long)chunk->len * (long)sizeof(double);
+            }
+        }
+    }
+}
+
+// ========== Helper Functions (live acquisition) ==========
+
+int spsc_init(SpscRing *r, size_t capacity)
+{
+    r->data = malloc(capacity * sizeof(double));
+    r->mask = capacity - 1;
+    atomic_init(&r->head, 0);
+    atomic_init(&r->tail, 0);
+    return (r->data == NULL) ? -1 : 0;
+}
+
+// copy up to n samples in; returns how many fitted (reader thread only)
+size_t spsc_push(SpscRing *r, const double *src, size_t n)
+{
+    size_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+    size_t space = r->mask + 1 - (head - tail);
+    size_t first, part;
+
+    if (n > space) n = space;
+    first = head & r->mask;
+    part = r->mask + 1 - first;
+    if (part > n) part = n;
+
+    memcpy(r->data + first, src, part * sizeof(double));
+    memcpy(r->data, src + part, (n - part) * sizeof(double));
+    atomic_store_explicit(&r->head, head + n, memory_order_release);
+    return n;
+}
+
+// copy up to max samples out; returns how many were waiting (analyser only)
+size_t spsc_pop(SpscRing *r, double *dst, size_t max)
+{
+    size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+    size_t n = head - tail;
+    size_t first, part;
+
+    if (n > max) n = max;
+    first = tail & r->mask;
+    part = r->mask + 1 - first;
+    if (part > n) part = n;
+
+    memcpy(dst, r->data + first, part * sizeof(double));
+    memcpy(dst + part, r->data, (n - part) * sizeof(double));
+    atomic_store_explicit(&r->tail, tail + n, memory_order_release);
+    return n;
+}
+
+// samples waiting in the ring
+size_t spsc_fill(SpscRing *r)
+{
+    return atomic_load_explicit(&r->head, memory_order_acquire) -
+           atomic_load_explicit(&r->tail, memory_order_acquire);
+}
+
+void pause_microseconds(long us)
+{
+    struct timespec ts;
+    ts.tv_sec = us / 1000000;
+    ts.tv_nsec = (us % 1000000) * 1000;
+    nanosleep(&ts, NULL);
+}
+
+// start a new interval; the last sample is kept so crossings between
+// intervals are still counted
+void live_stats_reset(LiveStats *s)
+{
+    s->n = 0;
+    s->min = INFINITY;
+    s->max = -INFINITY;
+    s->sum = 0.0;
+    s->sumSq = 0.0;
+    s->crossings = 0;
+}
+
+void live_stats_add(LiveStats *s, const double *x, long n)
+{
+    double mn = s->min, mx = s->max, sum = 0.0, sumSq = 0.0;
+    long crossings = 0;
+
+    if (n <= 0) {
+        return;
+    }
+    if (s->haveLast &&
+        ((s->last > 0 && x[0] < 0) || (s->last < 0 && x[0] > 0))) {
+        crossings++;
+    }
+
+    for (long i = 0; i < n; i++) {
+        mn = (x[i] < mn) ? x[i] : mn;
+        mx = (x[i] > mx) ? x[i] : mx;
+        sum += x[i];
+        sumSq += x[i] * x[i];
+    }
+    for (long i = 1; i < n; i++) {
+        crossings += (x[i - 1] > 0 && x[i] < 0) | (x[i - 1] < 0 && x[i] > 0);
+    }
+
+    s->min = mn;
+    s->max = mx;
+    s->sum += sum;
+    s->sumSq += sumSq;
+    s->crossings += crossings;
+    s->n += n;
+    s->last = x[n - 1];
+    s->haveLast = 1;
+}
+
+// add one interval into the running totals
+void live_stats_merge(LiveStats *total, const LiveStats *part)
+{
+    if (part->n == 0) {
+        return;
+    }
+    if (part->min < total->min) total->min = part->min;
+    if (part->max > total->max) total->max = part->max;
+    total->sum += part->sum;
+    total->sumSq += part->sumSq;
+    total->crossings += part->crossings;
+    total->n += part->n;
+}
+
+// hand parsed samples to the ring, waiting or dropping when it is full
+void live_publish(LiveRun *run, const double *x, size_t n)
+{
+    size_t sent = 0;
+    int stalled = 0;
+
+    atomic_fetch_add(&run->received, (long)n);
+
+    while (1) {
+        sent += spsc_push(&run->ring, x + sent, n - sent);
+        if (sent == n) {
+            return;
+        }
+        if (!run->block || atomic_load(&run->stop)) {
+            atomic_fetch_add(&run->dropped, (long)(n - sent));
+            return;
+        }
+        if (!stalled) {
+            atomic_fetch_add(&run->stalls, 1);
+            stalled = 1;
+        }
+        pause_microseconds(100);
+    }
+}
+
+int live_is_separator(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == ',' || c == ';';
+}
+
+// parse numbers from text[0..have); a token touching the end is left for the
+// next read unless final is set. Returns the number of bytes used.
+size_t live_parse_text(LiveRun *run, char *text, size_t have, int final)
+{
+    double values[LIVE_BLOCK];
+    size_t nValues = 0;
+    size_t pos = 0;
+
+    text[have] = '\0';
+    while (1) {
+        size_t end;
+        char *stop;
+        double v;
+
+        while (pos < have && live_is_separator(text[pos])) pos++;
+        if (pos >= have) break;
+
+        end = pos;
+        while (end < have && !live_is_separator(text[end])) end++;
+        if (end == have && !final) break;
+
+        v = strtod(text + pos, &stop);
+        if (stop != text + end) {
+            atomic_fetch_add(&run->badTokens, 1);
+        } else {
+            values[nValues++] = v;
+            if (nValues == LIVE_BLOCK) {
+                live_publish(run, values, nValues);
+                nValues = 0;
+            }
+        }
+        pos = end;
+    }
+
+    live_publish(run, values, nValues);
+    return pos;
+}
+
+// producer: read the source, parse it and push samples into the ring
+void *live_reader_thread(void *arg)
+{
+    LiveRun *run = arg;
+    static char text[LIVE_READ + 1];   // one reader thread at a time
+    size_t have = 0;
+
+    while (!atomic_load(&run->stop)) {
+        struct pollfd p;
+        ssize_t got;
+
+        p.fd = run->fd;
+        p.events = POLLIN;
+        p.revents = 0;
+        if (poll(&p, 1, 50) == 0) {
+            continue;   // nothing yet; check stop again
+        }
+
+        got = read(run->fd, text + have, LIVE_READ - have);
+        if (got < 0) {
+            if (errno == EINTR || errno == EAGAIN) continue;
+            run->readError = errno;
+            break;
+        }
+        if (got == 0) {
+            if (!run->follow) break;
+            pause_microseconds(20000);   // wait for the file to grow
+            continue;
+        }
+        have += (size_t)got;
+
+        if (run->binary) {
+            size_t nValues = have / sizeof(double);
+            double values[LIVE_BLOCK];
+            for (size_t k = 0; k < nValues; k += LIVE_BLOCK) {
+                size_t len = (nValues - k < LIVE_BLOCK) ? nValues - k : LIVE_BLOCK;
+                memcpy(values, text + k * sizeof(double), len * sizeof(double));
+                live_publish(run, values, len);
+            }
+            memmove(text, text + nValues * sizeof(double), have - nValues * sizeof(double));
+            have -= nValues * sizeof(double);
+        } else {
+            size_t used = live_parse_text(run, text, have, 0);
+            if (used == 0 && have == LIVE_READ) {
+                atomic_fetch_add(&run->badTokens, 1);   // token longer than the buffer
+                used = have;
+            }
+            memmove(text, text + used, have - used);
+            have -= used;
+        }
+    }
+
+    if (!run->binary && have > 0) {
+        live_parse_text(run, text, have, 1);
+    }
+    atomic_store(&run->done, 1);
+    return NULL;
+}
+
+void live_print_stats(double t, const LiveStats *s, double seconds, size_t fill,
+                      size_t capacity, long dropped, long stalls)
+{
+    double rms = (s->n > 0) ? sqrt(s->sumSq / s->n) : 0.0;
+    double peak = (s->n > 0) ? fmax(fabs(s->min), fabs(s->max)) : 0.0;
+
+    if (s->n == 0) {
+        printf("%7.2f %9s %10s %10s %10s %6s %6s %5.1f%% %9ld %7ld\n", t, "0",
+               "-", "-", "-", "-", "-", 100.0 * fill / capacity, dropped, stalls);
+        return;
+    }
+    printf("%7.2f %9.0f %10.4f %10.4f %10.4f %6.3f %6ld %5.1f%% %9ld %7ld\n",
+           t, s->n / seconds, s->min, s->max, rms, (rms > 0.0) ? peak / rms : 0.0,
+           s->crossings, 100.0 * fill / capacity, dropped, stalls);
+}
+
+// ========== Helper Functions (block reader) ==========
+
+// fill buf with up to blockBytes, looping over short reads (pipes);
+// a short result means end of file or an error
+size_t block_reader_fill(BlockReader *r, double *buf)
+{
+    char *dst = (char *)buf;
+    size_t have = 0;
+
+    while (have < r->blockBytes) {
+        ssize_t got;
+        if (r->seekable) {
+            got = pread(r->fd, dst + have, r->blockBytes - have, r->offset);
+        } else {
+            got = read(r->fd, dst + have, r->blockBytes - have);
+        }
+        if (got < 0) {
+            if (errno == EINTR) continue;
+            r->error = errno;
+            break;
+        }
+        if (got == 0) {
+            break;
+        }
+        have += (size_t)got;
+        r->offset += got;
+    }
+    return have;
+}
+
+// background thread: keep both buffers full, one block ahead of the caller
+void *block_reader_thread(void *arg)
+{
+    BlockReader *r = arg;
+    int slot = 0;
+
+    pthread_mutex_lock(&r->lock);
+    while (!r->stop) {
+        size_t got;
+
+        while (r->full[slot] && !r->stop) {
+            pthread_cond_wait(&r->cond, &r->lock);
+        }
+        if (r->stop) break;
+
+        pthread_mutex_unlock(&r->lock);
+        got = block_reader_fill(r, r->buf[slot]);
+        pthread_mutex_lock(&r->lock);
+
+        r->len[slot] = got;
+        r->full[slot] = 1;
+        if (got < r->blockBytes) {
+            r->eof = 1;
+        }
+        pthread_cond_broadcast(&r->cond);
+        if (r->eof) break;
+        slot ^= 1;
+    }
+    pthread_mutex_unlock(&r->lock);
+    return NULL;
+}
+
+// open a file, FIFO or pipe; returns 0 on success
+int block_reader_open(BlockReader *r, const char *path, size_t blockBytes, int threaded)
+{
+    memset(r, 0, sizeof(*r));
+    r->held = -1;
+    r->blockBytes = blockBytes;
+    r->threaded = threaded;
+
+    r->fd = open(path, O_RDONLY);
+    if (r->fd < 0) {
+        return -1;
+    }
+    r->seekable = (lseek(r->fd, 0, SEEK_CUR) == 0);
+    r->buf[0] = malloc(blockBytes);
+    r->buf[1] = malloc(blockBytes);
+    if (r->buf[0] == NULL || r->buf[1] == NULL) {
+        free(r->buf[0]);
+        free(r->buf[1]);
+        close(r->fd);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    pthread_mutex_init(&r->lock, NULL);
+    pthread_cond_init(&r->cond, NULL);
+    if (threaded && pthread_create(&r->thread, NULL, block_reader_thread, r) != 0) {
+        r->threaded = 0;   // no thread: read in the caller instead
+    }
+    return 0;
+}
+
+// next block of doubles, valid until the following call; the data is
+// read straight into the buffer, so no copy is made. Returns 0 at the end.
+long block_reader_next(BlockReader *r, const double **data)
+{
+    struct timespec start;
+    size_t len;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    if (!r->threaded) {
+        if (r->eof) return 0;
+        len = block_reader_fill(r, r->buf[0]);
+        if (len < r->blockBytes) r->eof = 1;
+        r->waitSeconds += elapsed_seconds(&start);
+        r->bytes += (long long)len;
+        *data = r->buf[0];
+        return (long)(len / sizeof(double));
+    }
+
+    pthread_mutex_lock(&r->lock);
+    if (r->held >= 0) {
+        r->full[r->held] = 0;   // hand the previous buffer back
+        r->held = -1;
+        pthread_cond_broadcast(&r->cond);
+    }
+    while (!r->full[r->next] && !r->eof) {
+        pthread_cond_wait(&r->cond, &r->lock);
+    }
+    if (!r->full[r->next]) {
+        pthread_mutex_unlock(&r->lock);
+        r->waitSeconds += elapsed_seconds(&start);
+        return 0;
+    }
+    len = r->len[r->next];
+    *data = r->buf[r->next];
+    r->held = r->next;
+    r->next ^= 1;
+    pthread_mutex_unlock(&r->lock);
+
+    r->waitSeconds += elapsed_seconds(&start);
+    r->bytes += (long long)len;
+    return (long)(len / sizeof(double));
+}
+
+void block_reader_close(BlockReader *r)
+{
+    if (r->threaded) {
+        pthread_mutex_lock(&r->lock);
+        r->stop = 1;
+        pthread_cond_broadcast(&r->cond);
+        pthread_mutex_unlock(&r->lock);
+        pthread_join(r->thread, NULL);
+    }
+    pthread_mutex_destroy(&r->lock);
+    pthread_cond_destroy(&r->cond);
+    free(r->buf[0]);
+    free(r->buf[1]);
+    close(r->fd);
+}
+
+// ========== Helper Functions (compressed captures) ==========
+
+// bits needed to hold v (0 for v = 0)
+int bit_width(uint64_t v)
+{
+    int w = 0;
+    while (v != 0) {
+        w++;
+        v >>= 1;
+    }
+    return w;
+}
+
+// OR a w-bit value into a zeroed buffer at bit position pos
+void wfc_put_bits(uint8_t *buf, uint64_t pos, uint64_t v, int w)
+{
+    uint64_t word;
+
+    if (w > 56) {
+        wfc_put_bits(buf, pos, v & 0xFFFFFFFFu, 32);
+        wfc_put_bits(buf, pos + 32, v >> 32, w - 32);
+        return;
+    }
+    memcpy(&word, buf + (pos >> 3), sizeof(word));
+    word |= v << (pos & 7);
+    memcpy(buf + (pos >> 3), &word, sizeof(word));
+}
+
+// read a w-bit value; the buffer has 8 bytes of padding after the payload
+uint64_t wfc_get_bits(const uint8_t *buf, uint64_t pos, int w, uint64_t mask)
+{
+    uint64_t word;
+
+    if (w > 56) {
+        uint64_t lo = wfc_get_bits(buf, pos, 32, 0xFFFFFFFFu);
+        uint64_t hi = wfc_get_bits(buf, pos + 32, w - 32, mask >> 32);
+        return lo | (hi << 32);
+    }
+    memcpy(&word, buf + (pos >> 3), sizeof(word));
+    return (word >> (pos & 7)) & mask;
+}
+
+// encode up to WFC_BLOCK samples; step = 0 stores them exactly.
+// Returns -1 if a sample cannot be quantised (not finite or too large).
+int wfc_encode_block(const double *x, int n, double step, WfcBlock *hdr, uint8_t *payload)
+{
+    uint64_t vals[WFC_BLOCK];
+    uint64_t all = 0;
+    double mn = INFINITY, mx = -INFINITY, sum = 0.0, sumSq = 0.0;
+    uint64_t pos = 0;
+
+    memset(hdr, 0, sizeof(*hdr));
+    hdr->n = (uint32_t)n;
+
+    if (step > 0.0) {
+        double inv = 1.0 / step;
+        int64_t prev;
+
+        for (int i = 0; i < n; i++) {
+            double s = x[i] * inv;
+            if (!(fabs(s) < 2305843009213693952.0)) {   // 2^61
+                return -1;
+            }
+        }
+        prev = llround(x[0] * inv);
+        hdr->first = prev;
+        for (int i = 0; i < n; i++) {
+            int64_t q = llround(x[i] * inv);
+            int64_t d = q - prev;
+            double y = (double)q * step;
+
+            vals[i] = ((uint64_t)d << 1) ^ (uint64_t)(d >> 63);   // zigzag
+            all |= vals[i];
+            prev = q;
+            mn = (y < mn) ? y : mn;
+            mx = (y > mx) ? y : mx;
+            sum += y;
+            sumSq += y * y;
+        }
+    } else {
+        uint64_t prev;
+
+        memcpy(&prev, &x[0], sizeof(prev));
+        hdr->first = (int64_t)prev;
+        for (int i = 0; i < n; i++) {
+            uint64_t b;
+            memcpy(&b, &x[i], sizeof(b));
+            vals[i] = b ^ prev;
+            all |= vals[i];
+            prev = b;
+            mn = (x[i] < mn) ? x[i] : mn;
+            mx = (x[i] > mx) ? x[i] : mx;
+            sum += x[i];
+            sumSq += x[i] * x[i];
+        }
+        while (all != 0 && (all & 1) == 0) {
+            all >>= 1;
+            hdr->shift++;
+        }
+    }
+
+    hdr->bits = (uint8_t)bit_width(all);
+    hdr->payloadBytes = (uint32_t)(((uint64_t)n * hdr->bits + 7) / 8);
+    hdr->min = mn;
+    hdr->max = mx;
+    hdr->sum = sum;
+    hdr->sumSq = sumSq;
+
+    memset(payload, 0, hdr->payloadBytes + 8);
+    for (int i = 0; i < n; i++) {
+        wfc_put_bits(payload, pos, vals[i] >> hdr->shift, hdr->bits);
+        pos += hdr->bits;
+    }
+    return 0;
+}
+
+// unpack one block into out[0 .. hdr->n)
+void wfc_decode_block(const WfcBlock *hdr, const uint8_t *payload, double step,
+                      double *restrict out)
+{
+    int w = hdr->bits;
+    uint64_t mask = (w >= 64) ? ~0ULL : ((1ULL << w) - 1);
+    uint64_t pos = 0;
+    int n = (int)hdr->n;
+
+    if (step > 0.0 && w <= 56) {
+        // common case: every value is one unaligned 64-bit load
+        int64_t q = hdr->first;
+        for (int i = 0; i < n; i++) {
+            uint64_t word;
+            memcpy(&word, payload + (pos >> 3), sizeof(word));
+            uint64_t v = (word >> (pos & 7)) & mask;
+            pos += w;
+            q += (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+            out[i] = (double)q * step;
+        }
+    } else if (step > 0.0) {
+        int64_t q = hdr->first;
+        for (int i = 0; i < n; i++) {
+            uint64_t v = wfc_get_bits(payload, pos, w, mask);
+            pos += w;
+            q += (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+            out[i] = (double)q * step;
+        }
+    } else {
+        uint64_t b = (uint64_t)hdr->first;
+        for (int i = 0; i < n; i++) {
+            uint64_t v = wfc_get_bits(payload, pos, w, mask);
+            pos += w;
+            b ^= v << hdr->shift;
+            memcpy(&out[i], &b, sizeof(b));
+        }
+    }
+}
+
+// write a header with no blocks yet; wfc_finish fills in the totals
+int wfc_begin(FILE *fp, WfcHeader *h, double step)
+{
+    memset(h, 0, sizeof(*h));
+    memcpy(h->magic, "WFC1", 4);
+    h->blockSamples = WFC_BLOCK;
+    h->lossless = (step <= 0.0);
+    h->step = (step > 0.0) ? step : 0.0;
+    return (fwrite(h, sizeof(*h), 1, fp) == 1) ? 0 : -1;
+}
+
+// encode and append one block (1 <= n <= WFC_BLOCK); scratch holds
+// WFC_MAX_PAYLOAD bytes and is left holding the payload described by blk.
+// Returns -1 on a write error, -2 if the samples cannot be quantised.
+int wfc_write_block(FILE *fp, WfcHeader *h, const double *x, int n, uint8_t *scratch,
+                    WfcBlock *blk)
+{
+    if (wfc_encode_block(x, n, h->step, blk, scratch) != 0) {
+        return -2;
+    }
+    if (fwrite(blk, sizeof(*blk), 1, fp) != 1 ||
+        fwrite(scratch, 1, blk->payloadBytes, fp) != blk->payloadBytes) {
+        return -1;
+    }
+    h->count += (uint64_t)n;
+    h->nBlocks++;
+    return 0;
+}
+
+int wfc_finish(FILE *fp, const WfcHeader *h)
+{
+    if (fflush(fp) != 0 || fseek(fp, 0, SEEK_SET) != 0 ||
+        fwrite(h, sizeof(*h), 1, fp) != 1) {
+        return -1;
+    }
+    return 0;
+}
+
+// read and check the file header; prints the problem on failure
+int wfc_read_header(FILE *fp, WfcHeader *h)
+{
+    if (fread(h, sizeof(*h), 1, fp) != 1 || memcmp(h->magic, "WFC1", 4) != 0) {
+        printf("Not a compressed capture file.\n");
+        return -1;
+    }
+    if (h->blockSamples != WFC_BLOCK) {
+        printf("Unsupported block size %u.\n", h->blockSamples);
+        return -1;
+    }
+    return 0;
+}
+
+// read the next block; payload may be NULL to skip over the data
+int wfc_read_block(FILE *fp, WfcBlock *blk, uint8_t *payload)
+{
+    // shift + bits <= 64 keeps v << shift defined, and the payload must be
+    // exactly the packed values so no stale bytes are decoded
+    if (fread(blk, sizeof(*blk), 1, fp) != 1 || blk->n == 0 || blk->n > WFC_BLOCK ||
+        blk->bits > 64 || blk->shift + blk->bits > 64 ||
+        blk->payloadBytes != ((uint64_t)blk->n * blk->bits + 7) / 8 ||
+        blk->payloadBytes > WFC_MAX_PAYLOAD - 8) {
+        return -1;
+    }
+    if (payload == NULL) {
+        return (fseek(fp, blk->payloadBytes, SEEK_CUR) == 0) ? 0 : -1;
+    }
+    return (fread(payload, 1, blk->payloadBytes, fp) == blk->payloadBytes) ? 0 : -1;
+}
+
+// ========== Helper Functions (summary pyramid) ==========
+
+void summary_reset(SummaryNode *s)
+{
+    s->min = INFINITY;
+    s->max = -INFINITY;
+    s->sum = 0.0;
+    s->sumSq = 0.0;
+}
+
+void summary_add_samples(SummaryNode *s, const double *x, long n)
+{
+    double mn = s->min, mx = s->max, sum = 0.0, sumSq = 0.0;
+
+    for (long i = 0; i < n; i++) {
+        mn = (x[i] < mn) ? x[i] : mn;
+        mx = (x[i] > mx) ? x[i] : mx;
+        sum += x[i];
+        sumSq += x[i] * x[i];
+    }
+    s->min = mn;
+    s->max = mx;
+    s->sum += sum;
+    s->sumSq += sumSq;
+}
+
+void summary_merge(SummaryNode *s, const SummaryNode *t)
+{
+    if (t->min < s->min) s->min = t->min;
+    if (t->max > s->max) s->max = t->max;
+    s->sum += t->sum;
+    s->sumSq += t->sumSq;
+}
+
+// allocate levels 1.. and fill them from level 0
+int pyramid_build_levels(Pyramid *p)
+{
+    p->levels = 1;
+    while (p->nodes[p->levels - 1] > 1 && p->levels < PYR_MAX_LEVELS) {
+        int L = p->levels;
+        long long n = (p->nodes[L - 1] + PYR_FANOUT - 1) / PYR_FANOUT;
+
+        p->level[L] = malloc((size_t)n * sizeof(SummaryNode));
+        if (p->level[L] == NULL) {
+            return -1;
+        }
+        p->nodes[L] = n;
+        for (long long j = 0; j < n; j++) {
+            long long first = j * PYR_FANOUT;
+            long long last = (first + PYR_FANOUT < p->nodes[L - 1]) ? first + PYR_FANOUT
+                                                                     : p->nodes[L - 1];
+            summary_reset(&p->level[L][j]);
+            for (long long k = first; k < last; k++) {
+                summary_merge(&p->level[L][j], &p->level[L - 1][k]);
+            }
+        }
+        p->levels++;
+    }
+    return 0;
+}
+
+// scan the whole capture once to build level 0
+int pyramid_build(Pyramid *p)
+{
+    BlockReader reader;
+    const double *data;
+    long n;
+    long long node = 0;
+
+    p->nodes[0] = (p->count + PYR_BASE - 1) / PYR_BASE;
+    p->level[0] = malloc((size_t)(p->nodes[0] > 0 ? p->nodes[0] : 1) * sizeof(SummaryNode));
+    if (p->level[0] == NULL) {
+        return -1;
+    }
+    if (block_reader_open(&reader, p->path, (size_t)PYR_BASE * 128 * sizeof(double), 1) != 0) {
+        return -1;
+    }
+    while ((n = block_reader_next(&reader, &data)) > 0 && node < p->nodes[0]) {
+        for (long i = 0; i < n && node < p->nodes[0]; i += PYR_BASE) {
+            long len = (n - i < PYR_BASE) ? n - i : PYR_BASE;
+            summary_reset(&p->level[0][node]);
+            summary_add_samples(&p->level[0][node], data + i, len);
+            node++;
+        }
+    }
+    block_reader_close(&reader);
+
+    if (reader.error != 0 || node != p->nodes[0]) {
+        return -1;
+    }
+    return pyramid_build_levels(p);
+}
+
+int pyramid_save(const Pyramid *p, const struct stat *st)
+{
+    char name[120];
+    PyrFileHeader h;
+    FILE *fp;
+    int ok;
+
+    snprintf(name, sizeof(name), "%s.pyr", p->path);
+    fp = fopen(name, "wb");
+    if (fp == NULL) {
+        return -1;
+    }
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, "PYR1", 4);
+    h.base = PYR_BASE;
+    h.fanout = PYR_FANOUT;
+    h.levels = (uint32_t)p->levels;
+    h.count = (uint64_t)p->count;
+    h.fileSize = (int64_t)st->st_size;
+    h.fileTime = (int64_t)st->st_mtime;
+
+    ok = (fwrite(&h, sizeof(h), 1, fp) == 1);
+    for (int L = 0; L < p->levels && ok; L++) {
+        ok = (fwrite(p->level[L], sizeof(SummaryNode), (size_t)p->nodes[L], fp) ==
+              (size_t)p->nodes[L]);
+    }
+    if (fclose(fp) != 0) ok = 0;
+    if (!ok) remove(name);
+    return ok ? 0 : -1;
+}
+
+// read a saved index if it matches the capture as it is now
+int pyramid_load(Pyramid *p, const struct stat *st)
+{
+    char name[120];
+    PyrFileHeader h;
+    FILE *fp;
+    int L;
+
+    snprintf(name, sizeof(name), "%s.pyr", p->path);
+    fp = fopen(name, "rb");
+    if (fp == NULL) {
+        return -1;
+    }
+    if (fread(&h, sizeof(h), 1, fp) != 1 || memcmp(h.magic, "PYR1", 4) != 0 ||
+        h.base != PYR_BASE || h.fanout != PYR_FANOUT || h.levels < 1 ||
+        h.levels > PYR_MAX_LEVELS || h.count != (uint64_t)p->count ||
+        h.fileSize != (int64_t)st->st_size || h.fileTime != (int64_t)st->st_mtime) {
+        fclose(fp);
+        return -1;   // missing, old or for a different capture
+    }
+
+    p->nodes[0] = (p->count + PYR_BASE - 1) / PYR_BASE;
+    for (L = 0; L < (int)h.levels; L++) {
+        if (L > 0) p->nodes[L] = (p->nodes[L - 1] + PYR_FANOUT - 1) / PYR_FANOUT;
+        p->level[L] = malloc((size_t)(p->nodes[L] > 0 ? p->nodes[L] : 1) * sizeof(SummaryNode));
+        if (p->level[L] == NULL ||
+            fread(p->level[L], sizeof(SummaryNode), (size_t)p->nodes[L], fp) !=
+                (size_t)p->nodes[L]) {
+            break;
+        }
+    }
+    fclose(fp);
+
+    if (L < (int)h.levels) {
+        return -1;   // truncated; the caller frees what was read
+    }
+    p->levels = (int)h.levels;
+    return 0;
+}
+
+void pyramid_close(Pyramid *p)
+{
+    for (int L = 0; L < PYR_MAX_LEVELS; L++) {
+        free(p->level[L]);
+        p->level[L] = NULL;
+    }
+    if (p->fd >= 0) {
+        close(p->fd);
+    }
+    p->fd = -1;
+    p->levels = 0;
+    p->count = 0;
+}
+
+// open a capture of binary doubles, reusing <capture>.pyr when it is up to
+// date and building (and saving) it otherwise; *reused tells which
+int pyramid_open(Pyramid *p, const char *path, int *reused)
+{
+    struct stat st;
+
+    memset(p, 0, sizeof(*p));
+    p->fd = -1;
+    snprintf(p->path, sizeof(p->path), "%s", path);
+    if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) {
+        printf("%s is not a regular file.\n", path);
+        return -1;
+    }
+    p->count = (long long)(st.st_size / (off_t)sizeof(double));
+    if (p->count == 0) {
+        printf("Capture is empty.\n");
+        return -1;
+    }
+    p->fd = open(path, O_RDONLY);
+    if (p->fd < 0) {
+        printf("Could not open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    *reused = (pyramid_load(p, &st) == 0);
+    if (*reused) {
+        return 0;
+    }
+
+    for (int L = 0; L < PYR_MAX_LEVELS; L++) {
+        free(p->level[L]);
+        p->level[L] = NULL;
+    }
+    if (pyramid_build(p) != 0) {
+        printf("Could not read the capture.\n");
+        pyramid_close(p);
+        return -1;
+    }
+    if (pyramid_save(p, &st) != 0) {
+        printf("Warning: could not save %s.pyr (index kept in memory).\n", path);
+    }
+    return 0;
+}
+
+// summarise samples [start, end) straight from the capture (short runs)
+int pyramid_read_range(const Pyramid *p, long long start, long long end, SummaryNode *s)
+{
+    double buf[PYR_BASE];
+
+    while (start < end) {
+        long long len = (end - start < PYR_BASE) ? end - start : PYR_BASE;
+        ssize_t want = (ssize_t)(len * (long long)sizeof(double));
+        if (pread(p->fd, buf, (size_t)want, (off_t)(start * (long long)sizeof(double))) != want) {
+            return -1;
+        }
+        summary_add_samples(s, buf, (long)len);
+        start += len;
+    }
+    return 0;
+}
+
+// statistics over samples [start, end): partial blocks at the edges are
+// read from the file, everything between comes from the coarsest level
+// that covers it, so a query touches O(PYR_FANOUT * levels) nodes
+int pyramid_query(const Pyramid *p, long long start, long long end, SummaryNode *out)
+{
+    long long a = (start + PYR_BASE - 1) / PYR_BASE;   // first whole block
+    long long b = end / PYR_BASE;                      // one past the last
+
+    summary_reset(out);
+    if (a >= b) {
+        return pyramid_read_range(p, start, end, out);
+    }
+    if (pyramid_read_range(p, start, a * PYR_BASE, out) != 0 ||
+        pyramid_read_range(p, b * PYR_BASE, end, out) != 0) {
+        return -1;
+    }
+
+    for (int L = 0; a < b; L++) {
+        long long a2 = (a + PYR_FANOUT - 1) / PYR_FANOUT;
+        long long b2 = b / PYR_FANOUT;
+
+        if (L + 1 >= p->levels || a2 >= b2) {
+            for (long long k = a; k < b; k++) summary_merge(out, &p->level[L][k]);
+            break;
+        }
+        for (long long k = a; k < a2 * PYR_FANOUT; k++) summary_merge(out, &p->level[L][k]);
+        for (long long k = b2 * PYR_FANOUT; k < b; k++) summary_merge(out, &p->level[L][k]);
+        a = a2;
+        b = b2;
+    }
+    return 0;
+}
+
+// draw [start, end) as a min/max envelope, one range query per column
+void pyramid_overview(const Pyramid *p, long long start, long long end, int width, int height)
+{
+    SummaryNode cols[PYR_OVERVIEW_WIDTH];
+    double lo = INFINITY, hi = -INFINITY;
+
+    if (width > PYR_OVERVIEW_WIDTH) width = PYR_OVERVIEW_WIDTH;
+    if (end - start < width) width = (int)(end - start);
+
+    for (int c = 0; c < width; c++) {
+        long long s = start + (end - start) * c / width;
+        long long e = start + (end - start) * (c + 1) / width;
+        if (pyramid_query(p, s, e, &cols[c]) != 0) {
+            printf("Read error.\n");
+            return;
+        }
+        if (cols[c].min < lo) lo = cols[c].min;
+        if (cols[c].max > hi) hi = cols[c].max;
+    }
+    if (hi <= lo) hi = lo + 1.0;
+
+    for (int r = 0; r < height; r++) {
+        double top = hi - (hi - lo) * r / height;
+        double bottom = hi - (hi - lo) * (r + 1) / height;
+        printf("%10.3f |", top);
+        for (int c = 0; c < width; c++) {
+            int covered = cols[c].max >= bottom && cols[c].min <= top;
+            int zero = (top >= 0.0 && bottom < 0.0);
+            putchar(covered ? '#' : (zero ? '-' : ' '));
+        }
+        putchar('\n');
+    }
+    printf("%10.3f +", lo);
+    for (int c = 0; c < width; c++) putchar('-');
+    printf("\n%12s%-*lld%lld\n", "", width - 10, start, end);
+}
+
+// ========== Helper Functions (regions) ==========
+
+void roi_free(void)
+{
+    for (int k = 0; k < ROI_MAX_LEVELS && roiIndex.map == NULL; k++) {
+        free(roiIndex.blockMin[k]);
+        free(roiIndex.blockMax[k]);
+        free(roiIndex.blockSum[k]);
+        free(roiIndex.blockSumSq[k]);
+    }
+    session_map_release(roiIndex.map);
+    memset(&roiIndex, 0, sizeof(roiIndex));
+}
+
+// levels of the block sum table for nBlocks blocks: the block totals plus
+// one per bit of the largest block index
+int roi_sum_levels(long nBlocks)
+{
+    int levels = 1;
+    while (nBlocks - 1 >= (1L << (levels - 1))) levels++;
+    return levels;
+}
+
+// build the block sum and min/max tables for the current samples unless
+// they are already up to date; returns -1 if out of memory
+int roi_prepare(void)
+{
+    RoiIndex *r = &roiIndex;
+    int n = sampleCount;
+
+    if (r->built && r->generation == sampleGeneration && r->n == n) {
+        return 0;
+    }
+    roi_free();
+
+    r->n = n;
+    r->nBlocks = (n + ROI_BLOCK - 1) / ROI_BLOCK;
+    r->sumLevels = roi_sum_levels(r->nBlocks);
+    r->blockMin[0] = malloc((size_t)r->nBlocks * sizeof(double));
+    r->blockMax[0] = malloc((size_t)r->nBlocks * sizeof(double));
+    for (int h = 0; h < r->sumLevels; h++) {
+        r->blockSum[h] = malloc((size_t)r->nBlocks * sizeof(double));
+        r->blockSumSq[h] = malloc((size_t)r->nBlocks * sizeof(double));
+        if (r->blockSum[h] == NULL || r->blockSumSq[h] == NULL) {
+            roi_free();
+            return -1;
+        }
+    }
+    if (r->blockMin[0] == NULL || r->blockMax[0] == NULL) {
+        roi_free();
+        return -1;
+    }
+
+    for (int b = 0; b < r->nBlocks; b++) {
+        int first = b * ROI_BLOCK;
+        int len = (n - first < ROI_BLOCK) ? n - first : ROI_BLOCK;
+        double sum = 0.0, sumSq = 0.0;
+        for (int i = first; i < first + len; i++) {
+            sum += samples[i];
+            sumSq += samples[i] * samples[i];
+        }
+        r->blockSum[0][b] = sum;
+        r->blockSumSq[0][b] = sumSq;
+        r->blockMin[0][b] = find_min(&samples[first], len);
+        r->blockMax[0][b] = find_max(&samples[first], len);
+    }
+
+    // sums never come from subtracting two long prefixes, which would wipe
+    // out a quiet region after a loud one: entry i of level h + 1 holds the
+    // blocks from i to the middle of its 2^(h+1)-block run, so a query adds
+    // two partial sums of its own blocks only
+    for (int h = 0; h + 1 < r->sumLevels; h++) {
+        long half = 1L << h;
+        double *sum = r->blockSum[h + 1], *sumSq = r->blockSumSq[h + 1];
+
+        for (long mid = half; mid - half < r->nBlocks; mid += 2 * half) {
+            double acc = 0.0, accSq = 0.0;
+            for (long i = mid - 1; i >= mid - half; i--) {        // left half, outwards
+                if (i < r->nBlocks) {
+                    acc += r->blockSum[0][i];
+                    accSq += r->blockSumSq[0][i];
+                    sum[i] = acc;
+                    sumSq[i] = accSq;
+                }
+            }
+            acc = 0.0;
+            accSq = 0.0;
+            for (long i = mid; i < mid + half && i < r->nBlocks; i++) {   // right half
+                acc += r->blockSum[0][i];
+                accSq += r->blockSumSq[0][i];
+                sum[i] = acc;
+                sumSq[i] = accSq;
+            }
+        }
+    }
+
+    r->levels = 1;
+    while ((1 << r->levels) <= r->nBlocks && r->levels < ROI_MAX_LEVELS) {
+        int k = r->levels;
+        int half = 1 << (k - 1);
+        int count = r->nBlocks - (1 << k) + 1;
+
+        r->blockMin[k] = malloc((size_t)count * sizeof(double));
+        r->blockMax[k] = malloc((size_t)count * sizeof(double));
+        if (r->blockMin[k] == NULL || r->blockMax[k] == NULL) {
+            roi_free();
+            return -1;
+        }
+        for (int i = 0; i < count; i++) {
+            double a = r->blockMin[k - 1][i], b = r->blockMin[k - 1][i + half];
+            double c = r->blockMax[k - 1][i], d = r->blockMax[k - 1][i + half];
+            r->blockMin[k][i] = (a < b) ? a : b;
+            r->blockMax[k][i] = (c > d) ? c : d;
+        }
+        r->levels++;
+    }
+
+    r->generation = sampleGeneration;
+    r->built = 1;
+    return 0;
+}
+
+// stats over samples [start, end) in constant time: two table lookups
+// each for the sums and for min / max over the whole blocks, plus at most
+// 2 * (ROI_BLOCK - 1) edge samples. roi_prepare() must have succeeded.
+void roi_query(int start, int end, SummaryNode *out)
+{
+    const RoiIndex *r = &roiIndex;
+    int n = end - start;
+    int a = (start + ROI_BLOCK - 1) / ROI_BLOCK;   // first whole block
+    int b = end / ROI_BLOCK;                       // one past the last
+    int edgeEnd = (a < b) ? a * ROI_BLOCK : end;
+    double sum = 0.0, sumSq = 0.0;
+
+    for (int i = start; i < edgeEnd; i++) {
+        sum += samples[i];
+        sumSq += samples[i] * samples[i];
+    }
+    if (a < b) {
+        for (int i = b * ROI_BLOCK; i < end; i++) {
+            sum += samples[i];
+            sumSq += samples[i] * samples[i];
+        }
+        if (b - a == 1) {
+            sum += r->blockSum[0][a];
+            sumSq += r->blockSumSq[0][a];
+        } else {
+            // the highest differing bit picks the run where a and b - 1
+            // fall on opposite sides of the middle
+            int h = 0;
+            while (((a ^ (b - 1)) >> (h + 1)) != 0) h++;
+            sum += r->blockSum[h + 1][a] + r->blockSum[h + 1][b - 1];
+            sumSq += r->blockSumSq[h + 1][a] + r->blockSumSq[h + 1][b - 1];
+        }
+    }
+    out->sum = sum;
+    out->sumSq = sumSq;
+
+    if (a >= b) {
+        out->min = find_min(&samples[start], n);
+        out->max = find_max(&samples[start], n);
+        return;
+    }
+
+    int k = 0;
+    while ((2 << k) <= b - a) k++;
+    double mn = r->blockMin[k][a], mx = r->blockMax[k][a];
+    double mn2 = r->blockMin[k][b - (1 << k)], mx2 = r->blockMax[k][b - (1 << k)];
+    if (mn2 < mn) mn = mn2;
+    if (mx2 > mx) mx = mx2;
+
+    for (int i = start; i < a * ROI_BLOCK; i++) {
+        mn = (samples[i] < mn) ? samples[i] : mn;
+        mx = (samples[i] > mx) ? samples[i] : mx;
+    }
+    for (int i = b * ROI_BLOCK; i < end; i++) {
+        mn = (samples[i] < mn) ? samples[i] : mn;
+        mx = (samples[i] > mx) ? samples[i] : mx;
+    }
+    out->min = mn;
+    out->max = mx;
+}
+
+// one CSV row: start,end,n,min,max,p2p,dc,rms,crest
+void roi_write_row(FILE *fp, int start, int end, const SummaryNode *r)
+{
+    int n = end - start;
+    double rms = sqrt(r->sumSq / n);
+    double peak = fmax(fabs(r->min), fabs(r->max));
+
+    fprintf(fp, "%d,%d,%d,%.6g,%.6g,%.6g,%.6g,%.6g,%.6g\n", start, end, n, r->min, r->max,
+            r->max - r->min, r->sum / n, rms, (rms > 0.0) ? peak / rms : 0.0);
+}
+
+// ========== Helper Functions (tone detection) ==========
+
+// parse "50, 100, 150" or "50x5" (50 Hz and harmonics up to the 5th);
+// returns the number of frequencies, or -1 with a message
+int tone_parse_list(const char *text, double freqs[], int maxTones)
+{
+    const char *p = text;
+    int n = 0;
+
+    while (*p != '\0') {
+        char *end;
+        double f;
+        long harmonics = 1;
+
+        p += strspn(p, " ,;\t");
+        if (*p == '\0') break;
+
+        f = strtod(p, &end);
+        if (end == p || f <= 0.0) {
+            printf("Could not read a frequency at \"%s\".\n", p);
+            return -1;
+        }
+        p = end;
+        if (*p == 'x' || *p == 'X') {
+            harmonics = strtol(p + 1, &end, 10);
+            if (end == p + 1 || harmonics < 1) {
+                printf("Write harmonics as e.g. 50x5.\n");
+                return -1;
+            }
+            p = end;
+        }
+        for (long h = 1; h <= harmonics; h++) {
+            if (n == maxTones) {
+                printf("At most %d tones.\n", maxTones);
+                return -1;
+            }
+            freqs[n++] = f * h;
+        }
+    }
+    return n;
+}
+
+void tone_bank_init(ToneBank *bank, const double freqs[], int nTones, double fs)
+{
+    memset(bank, 0, sizeof(*bank));
+    bank->nTones = nTones;
+    bank->fs = fs;
+    for (int k = 0; k < nTones; k++) {
+        double w = 2.0 * M_PI * freqs[k] / fs;
+        bank->freq[k] = freqs[k];
+        bank->cosw[k] = cos(w);
+        bank->sinw[k] = sin(w);
+        bank->coeff[k] = 2.0 * bank->cosw[k];
+    }
+}
+
+// feed n more samples; call as often as needed (streaming)
+void tone_bank_update(ToneBank *bank, const double *x, long n)
+{
+    int nTones = bank->nTones;
+    double c[TONE_MAX], s1[TONE_MAX], s2[TONE_MAX];
+
+    memcpy(c, bank->coeff, (size_t)nTones * sizeof(double));
+    memcpy(s1, bank->s1, (size_t)nTones * sizeof(double));
+    memcpy(s2, bank->s2, (size_t)nTones * sizeof(double));
+
+    // tones are the inner loop, so every resonator advances together
+    for (long i = 0; i < n; i++) {
+        double xi = x[i];
+        for (int k = 0; k < nTones; k++) {
+            double s0 = xi + c[k] * s1[k] - s2[k];
+            s2[k] = s1[k];
+            s1[k] = s0;
+        }
+    }
+
+    memcpy(bank->s1, s1, (size_t)nTones * sizeof(double));
+    memcpy(bank->s2, s2, (size_t)nTones * sizeof(double));
+    bank->sumSq += accurate_sum(x, n, 1);
+    bank->n += n;
+}
+
+// amplitude (peak) and phase (degrees, cosine at sample 0) of tone k
+void tone_bank_result(const ToneBank *bank, int k, double *amplitude, double *phaseDeg)
+{
+    double w = 2.0 * M_PI * bank->freq[k] / bank->fs;
+    // y = s1 - e^{-jw} s2 = e^{jw(N-1)} X(w)
+    double yRe = bank->s1[k] - bank->cosw[k] * bank->s2[k];
+    double yIm = bank->sinw[k] * bank->s2[k];
+    double turn = -w * (double)(bank->n - 1);
+    double xRe = yRe * cos(turn) - yIm * sin(turn);
+    double xIm = yRe * sin(turn) + yIm * cos(turn);
+    double scale = (bank->freq[k] * 2.0 == bank->fs) ? 1.0 : 2.0;   // Nyquist has one side
+
+    *amplitude = scale * sqrt(xRe * xRe + xIm * xIm) / (double)bank->n;
+    *phaseDeg = atan2(xIm, xRe) * 180.0 / M_PI;
+}
+
+void tone_bank_report(const ToneBank *bank)
+{
+    double totalRms = sqrt(bank->sumSq / (double)bank->n);
+
+    printf("\nSamples: %lld, resolution about %.4g Hz (fs / N)\n", bank->n,
+           bank->fs / (double)bank->n);
+    printf("%12s %12s %12s %9s %10s\n", "freq (Hz)", "amplitude", "RMS", "% power", "phase");
+    for (int k = 0; k < bank->nTones; k++) {
+        double amp, phase;
+        tone_bank_result(bank, k, &amp, &phase);
+        double rms = amp / sqrt(2.0);
+        double share = (totalRms > 0.0) ? 100.0 * rms * rms / (totalRms * totalRms) : 0.0;
+        printf("%12.3f %12.4f %12.4f %8.2f%% %9.2f°\n", bank->freq[k], amp, rms, share, phase);
+    }
+    printf("Total RMS: %.4f\n", totalRms);
+}
+
+// ========== Helper Functions (correlation) ==========
+
+// tw[k] = e^(-2 pi i k / n) for k < n / 2
+void fft_twiddles(Cplx *tw, int n)
+{
+    for (int k = 0; k < n / 2; k++) {
+        double a = -2.0 * M_PI * k / n;
+        tw[k] = cplx_make(cos(a), sin(a));
+    }
+}
+
+// in-place radix-2 FFT, n a power of two; the inverse is scaled by 1/n
+void fft_radix2(Cplx *a, int n, const Cplx *tw, int inverse)
+{
+    for (int i = 1, j = 0; i < n; i++) {
+        int bit = n >> 1;
+        for (; j & bit; bit >>= 1) j ^= bit;
+        j ^= bit;
+        if (i < j) {
+            Cplx t = a[i];
+            a[i] = a[j];
+            a[j] = t;
+        }
+    }
+
+    for (int len = 2; len <= n; len <<= 1) {
+        int half = len / 2;
+        int stride = n / len;
+        for (int i = 0; i < n; i += len) {
+            for (int k = 0; k < half; k++) {
+                Cplx w = tw[k * stride];
+                if (inverse) w.im = -w.im;
+                Cplx u = a[i + k];
+                Cplx v = cplx_mul(a[i + k + half], w);
+                a[i + k] = cplx_add(u, v);
+                a[i + k + half] = cplx_make(u.re - v.re, u.im - v.im);
+            }
+        }
+    }
+
+    if (inverse) {
+        for (int i = 0; i < n; i++) {
+            a[i].re /= n;
+            a[i].im /= n;
+        }
+    }
+}
+
+// out[j] = sum over t of k[t] * x[j - t], j < n + m - 1 (full convolution).
+// Taps are the outer loop so the inner loop is a plain vector multiply-add.
+void convolve_direct(const double *restrict x, long n, const double *restrict k, long m,
+                     double *restrict out)
+{
+    for (long j = 0; j < n + m - 1; j++) out[j] = 0.0;
+    for (long t = 0; t < m; t++) {
+        double kt = k[t];
+        double *restrict o = out + t;
+        for (long i = 0; i < n; i++) {
+            o[i] += kt * x[i];
+        }
+    }
+}
+
+typedef struct {
+    const double *x;
+    long n, m;
+    int  L;                           // FFT size
+    long step;                        // new outputs per segment (L - m + 1)
+    const Cplx *K;                    // FFT of the kernel
+    const Cplx *tw;
+    double *out;
+    int  failed;
+} ConvTask;
+
+// overlap-save segments [start, end): each FFT of L inputs gives step outputs
+void convolve_fft_range(void *ctx, long start, long end)
+{
+    ConvTask *t = ctx;
+    long total = t->n + t->m - 1;
+    Cplx *buf = malloc((size_t)t->L * sizeof(Cplx));
+
+    if (buf == NULL) {
+        t->failed = 1;
+        return;
+    }
+    for (long s = start; s < end; s++) {
+        long first = s * t->step;           // first output of this segment
+        long from = first - (t->m - 1);     // first input it needs
+
+        for (int q = 0; q < t->L; q++) {
+            long i = from + q;
+            buf[q] = cplx_make((i >= 0 && i < t->n) ? t->x[i] : 0.0, 0.0);
+        }
+        fft_radix2(buf, t->L, t->tw, 0);
+        for (int q = 0; q < t->L; q++) {
+            buf[q] = cplx_mul(buf[q], t->K[q]);
+        }
+        fft_radix2(buf, t->L, t->tw, 1);
+        for (long q = 0; q < t->step && first + q < total; q++) {
+            t->out[first + q] = buf[t->m - 1 + q].re;   // first m - 1 are wrapped
+        }
+    }
+    free(buf);
+}
+
+// full convolution by FFT overlap-save, segments shared between threads
+int convolve_fft(const double *x, long n, const double *k, long m, double *out)
+{
+    ConvTask task;
+    int L = 1024;
+    Cplx *K, *tw;
+
+    while (L < 4 * m) L <<= 1;   // at least 3/4 of each FFT is new output
+    K = malloc((size_t)L * sizeof(Cplx));
+    tw = malloc((size_t)(L / 2) * sizeof(Cplx));
+    if (K == NULL || tw == NULL) {
+        free(K);
+        free(tw);
+        return -1;
+    }
+    fft_twiddles(tw, L);
+    for (int q = 0; q < L; q++) {
+        K[q] = cplx_make((q < m) ? k[q] : 0.0, 0.0);
+    }
+    fft_radix2(K, L, tw, 0);
+
+    task.x = x;
+    task.n = n;
+    task.m = m;
+    task.L = L;
+    task.step = L - m + 1;
+    task.K = K;
+    task.tw = tw;
+    task.out = out;
+    task.failed = 0;
+    parallel_range((n + m - 1 + task.step - 1) / task.step, 1, convolve_fft_range, &task);
+
+    free(K);
+    free(tw);
+    return task.failed ? -1 : 0;
+}
+
+// full convolution, direct for short kernels and FFT otherwise;
+// out holds n + m - 1 values. Returns -1 if out of memory.
+int convolve_full(const double *x, long n, const double *k, long m, double *out, int *usedFft)
+{
+    *usedFft = (m > CORR_DIRECT_MAX && n > CORR_DIRECT_MAX);
+    if (!*usedFft) {
+        if (m > n) {
+            convolve_direct(k, m, x, n, out);   // same result, longer inner loop
+        } else {
+            convolve_direct(x, n, k, m, out);
+        }
+        return 0;
+    }
+    if (m > n) {
+        return convolve_fft(k, m, x, n, out);
+    }
+    return convolve_fft(x, n, k, m, out);
+}
+
+// find where h (length m) best lines up with x (length n): lag l compares
+// h[j] with x[j + l]. Means are removed first, so the coefficient is the
+// correlation coefficient over the overlapping part.
+int xcorr_best(const double *x, long n, const double *h, long m, XcorrResult *res)
+{
+    double *xc = malloc((size_t)n * sizeof(double));
+    double *hr = malloc((size_t)m * sizeof(double));
+    double *r = malloc((size_t)(n + m - 1) * sizeof(double));
+    double mx, mh;
+    long best = 0;
+
+    if (xc == NULL || hr == NULL || r == NULL) {
+        free(xc);
+        free(hr);
+        free(r);
+        return -1;
+    }
+
+    // correlation = convolution with the time-reversed reference
+    mx = accurate_sum(x, n, 0) / n;
+    mh = accurate_sum(h, m, 0) / m;
+    for (long i = 0; i < n; i++) xc[i] = x[i] - mx;
+    for (long j = 0; j < m; j++) hr[j] = h[m - 1 - j] - mh;
+
+    if (convolve_full(xc, n, hr, m, r, &res->usedFft) != 0) {
+        free(xc);
+        free(hr);
+        free(r);
+        return -1;
+    }
+
+    // r[j] is the correlation at lag j - (m - 1)
+    for (long j = 1; j < n + m - 1; j++) {
+        if (r[j] > r[best]) best = j;
+    }
+    res->lag = best - (m - 1);
+    res->peak = r[best];
+    res->subLag = (double)res->lag;
+    if (best > 0 && best < n + m - 2) {
+        double a = r[best - 1], b = r[best], c = r[best + 1];
+        double den = a - 2.0 * b + c;
+        if (den < 0.0) {
+            res->subLag += 0.5 * (a - c) / den;
+        }
+    }
+
+    double ex = 0.0, eh = 0.0;
+    long jLo = (res->lag < 0) ? -res->lag : 0;
+    long jHi = (n - res->lag < m) ? n - res->lag : m;
+    for (long j = jLo; j < jHi; j++) {
+        double hv = h[j] - mh;
+        double xv = xc[j + res->lag];
+        ex += xv * xv;
+        eh += hv * hv;
+    }
+    res->coeff = (ex > 0.0 && eh > 0.0) ? res->peak / sqrt(ex * eh) : 0.0;
+
+    free(xc);
+    free(hr);
+    free(r);
+    return 0;
+}
+
+// ========== Helper Functions (distribution) ==========
+
+// read numbers separated by spaces or commas; returns how many, or -1
+int parse_number_list(const char *text, double out[], int maxCount)
+{
+    const char *p = text;
+    int n = 0;
+
+    while (1) {
+        char *end;
+        p += strspn(p, " ,;\t");
+        if (*p == '\0') break;
+        if (n == maxCount) {
+            printf("At most %d values.\n", maxCount);
+            return -1;
+        }
+        out[n] = strtod(p, &end);
+        if (end == p) {
+            printf("Could not read a number at \"%s\".\n", p);
+            return -1;
+        }
+        n++;
+        p = end;
+    }
+    return n;
+}
+
+typedef struct {
+    const double *a;
+    double lo, hi;
+    int bins;
+    long *hist;                       // merged counts
+    pthread_mutex_t lock;
+} HistTask;
+
+// count [start, end) into a private histogram, then merge it
+void hist_range(void *ctx, long start, long end)
+{
+    HistTask *t = ctx;
+    long *local = calloc((size_t)t->bins, sizeof(long));
+    double scale = t->bins / (t->hi - t->lo);
+
+    if (local == NULL) {
+        pthread_mutex_lock(&t->lock);   // no memory: count straight into the result
+        for (long i = start; i < end; i++) {
+            int b = (int)((t->a[i] - t->lo) * scale);
+            t->hist[(b < 0) ? 0 : (b >= t->bins ? t->bins - 1 : b)]++;
+        }
+        pthread_mutex_unlock(&t->lock);
+        return;
+    }
+    for (long i = start; i < end; i++) {
+        int b = (int)((t->a[i] - t->lo) * scale);
+        b = (b < 0) ? 0 : b;
+        b = (b >= t->bins) ? t->bins - 1 : b;
+        local[b]++;
+    }
+
+    pthread_mutex_lock(&t->lock);
+    for (int b = 0; b < t->bins; b++) {
+        t->hist[b] += local[b];
+    }
+    pthread_mutex_unlock(&t->lock);
+    free(local);
+}
+
+// histogram of a[] over [lo, hi] (values outside go to the end bins)
+void build_histogram(const double a[], long n, double lo, double hi, int bins, long hist[])
+{
+    HistTask task;
+
+    memset(hist, 0, (size_t)bins * sizeof(long));
+    if (hi <= lo) hi = lo + 1.0;
+    task.a = a;
+    task.lo = lo;
+    task.hi = hi;
+    task.bins = bins;
+    task.hist = hist;
+    pthread_mutex_init(&task.lock, NULL);
+    parallel_range(n, 1 << 16, hist_range, &task);
+    pthread_mutex_destroy(&task.lock);
+}
+
+void print_histogram(FILE *fp, const long hist[], int bins, double lo, double hi, long total)
+{
+    long most = 1;
+    double width = (hi > lo) ? (hi - lo) / bins : 1.0 / bins;
+
+    for (int b = 0; b < bins; b++) {
+        if (hist[b] > most) most = hist[b];
+    }
+    for (int b = 0; b < bins; b++) {
+        int len = (int)(HIST_BAR * hist[b] / most);
+        fprintf(fp, "%11.4f .. %11.4f %10ld %6.2f%% ", lo + b * width, lo + (b + 1) * width,
+                hist[b], 100.0 * hist[b] / total);
+        for (int k = 0; k < len; k++) fputc('#', fp);
+        fputc('\n', fp);
+    }
+}
+
+// median of medians of a[lo..hi]: the median of each group of five is
+// moved to the front, and the median of those is selected. Used as the
+// pivot when quickselect keeps partitioning badly.
+double select_pivot_mom(double a[], long lo, long hi)
+{
+    long groups = 0;
+
+    for (long g = lo; g <= hi; g += 5) {
+        long end = (hi - g < 4) ? hi : g + 4;
+        for (long i = g + 1; i <= end; i++) {      // insertion sort, at most 5
+            double v = a[i];
+            long j = i;
+            while (j > g && a[j - 1] > v) {
+                a[j] = a[j - 1];
+                j--;
+            }
+            a[j] = v;
+        }
+        double t = a[g + (end - g) / 2];
+        a[g + (end - g) / 2] = a[lo + groups];
+        a[lo + groups] = t;
+        groups++;
+    }
+    return select_kth(a, lo, lo + groups, lo + groups / 2);
+}
+
+// put the k-th smallest of a[lo..hi) at a[k], smaller values before it and
+// larger after. Quickselect with a median-of-three pivot; after about
+// 2 log2(n) partitions that keep more than 3/4 of the range it switches to
+// median-of-medians pivots (introselect), so it stays O(n) in the worst case.
+double select_kth(double a[], long lo, long hi, long k)
+{
+    int badLeft = 2;
+
+    for (long len = hi - lo; len > 1; len >>= 1) badLeft += 2;
+    hi--;
+    while (lo < hi) {
+        long mid = lo + (hi - lo) / 2;
+        long size = hi - lo + 1;
+        double t, pivot;
+
+        if (badLeft > 0) {
+            // order a[lo], a[mid], a[hi] and use the middle as pivot
+            if (a[mid] < a[lo]) { t = a[mid]; a[mid] = a[lo]; a[lo] = t; }
+            if (a[hi] < a[lo])  { t = a[hi]; a[hi] = a[lo]; a[lo] = t; }
+            if (a[hi] < a[mid]) { t = a[hi]; a[hi] = a[mid]; a[mid] = t; }
+            pivot = a[mid];
+        } else {
+            pivot = select_pivot_mom(a, lo, hi);
+        }
+
+        long i = lo, j = hi;
+        while (i <= j) {
+            while (a[i] < pivot) i++;
+            while (a[j] > pivot) j--;
+            if (i <= j) {
+                t = a[i]; a[i] = a[j]; a[j] = t;
+                i++;
+                j--;
+            }
+        }
+        if (k <= j) {
+            hi = j;
+        } else if (k >= i) {
+            lo = i;
+        } else {
+            break;   // a[j + 1 .. i - 1] all equal the pivot
+        }
+        if (4 * (hi - lo + 1) > 3 * size) badLeft--;
+    }
+    return a[k];
+}
+
+// exact percentiles (0..100, linear between order statistics) of a[]
+// using selection on a scratch copy; returns -1 if out of memory
+int percentiles_exact(const double a[], long n, const double p[], int np, double out[])
+{
+    double *work = malloc((size_t)n * sizeof(double));
+    int order[PCT_MAX];
+    long from = 0;
+
+    if (work == NULL) {
+        return -1;
+    }
+    memcpy(work, a, (size_t)n * sizeof(double));
+
+    // ascending order, so each selection only searches what is left
+    for (int i = 0; i < np; i++) order[i] = i;
+    for (int i = 1; i < np; i++) {
+        for (int j = i; j > 0 && p[order[j]] < p[order[j - 1]]; j--) {
+            int t = order[j];
+            order[j] = order[j - 1];
+            order[j - 1] = t;
+        }
+    }
+
+    for (int i = 0; i < np; i++) {
+        double pc = p[order[i]];
+        double pos = ((pc < 0.0) ? 0.0 : (pc > 100.0 ? 100.0 : pc)) / 100.0 * (n - 1);
+        long k = (long)pos;
+        double frac = pos - k;
+        double v = select_kth(work, from, n, k);
+
+        if (frac > 0.0 && k + 1 < n) {
+            double next = find_min(&work[k + 1], (int)(n - k - 1));
+            v += frac * (next - v);
+        }
+        out[order[i]] = v;
+        from = k;
+    }
+
+    free(work);
+    return 0;
+}
+
+void p2_init(P2Quantile *e, double p)
+{
+    memset(e, 0, sizeof(*e));
+    e->p = p;
+    for (int i = 0; i < 5; i++) e->pos[i] = i + 1;
+    e->want[0] = 1.0;
+    e->want[1] = 1.0 + 2.0 * p;
+    e->want[2] = 1.0 + 4.0 * p;
+    e->want[3] = 3.0 + 2.0 * p;
+    e->want[4] = 5.0;
+    e->inc[0] = 0.0;
+    e->inc[1] = p / 2.0;
+    e->inc[2] = p;
+    e->inc[3] = (1.0 + p) / 2.0;
+    e->inc[4] = 1.0;
+}
+
+void p2_add(P2Quantile *e, double x)
+{
+    int k;
+
+    if (e->count < 5) {
+        // the first five samples are kept sorted as the markers
+        int i = (int)e->count++;
+        while (i > 0 && e->q[i - 1] > x) {
+            e->q[i] = e->q[i - 1];
+            i--;
+        }
+        e->q[i] = x;
+        return;
+    }
+    e->count++;
+
+    if (x < e->q[0]) {
+        e->q[0] = x;
+        k = 0;
+    } else if (x >= e->q[4]) {
+        e->q[4] = x;
+        k = 3;
+    } else {
+        k = 0;
+        while (k < 3 && x >= e->q[k + 1]) k++;
+    }
+    for (int i = k + 1; i < 5; i++) e->pos[i] += 1.0;
+    for (int i = 0; i < 5; i++) e->want[i] += e->inc[i];
+
+    // move the middle markers towards their desired positions
+    for (int i = 1; i <= 3; i++) {
+        double d = e->want[i] - e->pos[i];
+        if ((d >= 1.0 && e->pos[i + 1] - e->pos[i] > 1.0) ||
+            (d <= -1.0 && e->pos[i - 1] - e->pos[i] < -1.0)) {
+            double s = (d > 0.0) ? 1.0 : -1.0;
+            double np = e->pos[i + 1], nm = e->pos[i - 1], n0 = e->pos[i];
+            double qp = e->q[i] + s / (np - nm) *
+                        ((n0 - nm + s) * (e->q[i + 1] - e->q[i]) / (np - n0) +
+                         (np - n0 - s) * (e->q[i] - e->q[i - 1]) / (n0 - nm));
+            if (qp <= e->q[i - 1] || qp >= e->q[i + 1]) {
+                int j = i + (int)s;   // parabola overshoots: step linearly
+                qp = e->q[i] + s * (e->q[j] - e->q[i]) / (e->pos[j] - n0);
+            }
+            e->q[i] = qp;
+            e->pos[i] += s;
+        }
+    }
+}
+
+double p2_result(const P2Quantile *e)
+{
+    if (e->count == 0) {
+        return 0.0;
+    }
+    if (e->count < 5) {
+        long k = (long)(e->p * (e->count - 1) + 0.5);
+        return e->q[k];
+    }
+    return e->q[2];
+}
+
+// ========== Helper Functions (frame features) ==========
+
+// rules equivalent to the whole-buffer classification of menu 8
+void frame_rules_default(void)
+{
+    static const char *DEFAULTS[] = {
+        "flat: rms == 0",
+        "dc: dcratio > 0.8 and zcr == 0",
+        "ac: zcr > 0.1",
+    };
+
+    frameRuleCount = 0;
+    for (size_t i = 0; i < sizeof(DEFAULTS) / sizeof(DEFAULTS[0]); i++) {
+        frame_rule_parse(DEFAULTS[i], &frameRules[frameRuleCount++]);
+    }
+}
+
+// "label: feature op value [and feature op value ...]"; returns 0 if valid
+int frame_rule_parse(const char *text, FrameRule *rule)
+{
+    const char *colon = strchr(text, ':');
+    const char *p;
+    size_t len;
+
+    memset(rule, 0, sizeof(*rule));
+    if (colon == NULL) {
+        printf("Missing ':' after the label.\n");
+        return -1;
+    }
+    while (*text == ' ') text++;
+    len = (size_t)(colon - text);
+    while (len > 0 && text[len - 1] == ' ') len--;
+    if (len == 0 || len >= FRAME_LABEL) {
+        printf("Label must be 1 to %d characters.\n", FRAME_LABEL - 1);
+        return -1;
+    }
+    memcpy(rule->label, text, len);
+
+    p = colon + 1;
+    while (1) {
+        char name[16];
+        int n = 0, f, op;
+        char *end;
+
+        if (rule->nConds == FRAME_MAX_CONDS) {
+            printf("At most %d conditions per rule.\n", FRAME_MAX_CONDS);
+            return -1;
+        }
+        if (sscanf(p, " %15[a-z]%n", name, &n) != 1) {
+            printf("Expected a feature name at \"%s\".\n", p);
+            return -1;
+        }
+        for (f = 0; f < FEAT_COUNT && strcmp(name, FEATURE_NAMES[f]) != 0; f++) { }
+        if (f == FEAT_COUNT) {
+            printf("Unknown feature \"%s\".\n", name);
+            return -1;
+        }
+        p += n;
+        while (*p == ' ') p++;
+        if (p[0] == '<' && p[1] == '=')      { op = CMP_LE; p += 2; }
+        else if (p[0] == '>' && p[1] == '=') { op = CMP_GE; p += 2; }
+        else if (p[0] == '=' && p[1] == '=') { op = CMP_EQ; p += 2; }
+        else if (p[0] == '<')                { op = CMP_LT; p += 1; }
+        else if (p[0] == '>')                { op = CMP_GT; p += 1; }
+        else {
+            printf("Expected <, <=, >, >= or == after \"%s\".\n", name);
+            return -1;
+        }
+        rule->value[rule->nConds] = strtod(p, &end);
+        if (end == p) {
+            printf("Expected a number after the comparison.\n");
+            return -1;
+        }
+        rule->feature[rule->nConds] = f;
+        rule->op[rule->nConds] = op;
+        rule->nConds++;
+
+        p = end;
+        while (*p == ' ') p++;
+        if (*p == '\0') break;
+        if (strncmp(p, "and", 3) != 0) {
+            printf("Expected \"and\" at \"%s\".\n", p);
+            return -1;
+        }
+        p += 3;
+    }
+    return 0;
+}
+
+void frame_rule_print(int index, const FrameRule *rule)
+{
+    static const char *OPS[] = { "<", "<=", ">", ">=", "==" };
+
+    printf(" %c) %s:", 'a' + index, rule->label);
+    for (int c = 0; c < rule->nConds; c++) {
+        printf("%s %s %s %g", (c > 0) ? " and" : "", FEATURE_NAMES[rule->feature[c]],
+               OPS[rule->op[c]], rule->value[c]);
+    }
+    printf("\n");
+}
+
+// index of the first rule whose conditions all hold, or frameRuleCount
+int frame_classify(const double f[])
+{
+    for (int r = 0; r < frameRuleCount; r++) {
+        const FrameRule *rule = &frameRules[r];
+        int match = 1;
+
+        for (int c = 0; c < rule->nConds && match; c++) {
+            double v = f[rule->feature[c]], t = rule->value[c];
+            switch (rule->op[c]) {
+                case CMP_LT: match = (v < t); break;
+                case CMP_LE: match = (v <= t); break;
+                case CMP_GT: match = (v > t); break;
+                case CMP_GE: match = (v >= t); break;
+                default:     match = (v == t); break;
+            }
+        }
+        if (match) {
+            return r;
+        }
+    }
+    return frameRuleCount;
+}
+
+const char *frame_label(int index)
+{
+    return (index < frameRuleCount) ? frameRules[index].label : FRAME_FALLBACK;
+}
+
+// features of frames [start, end), each classified as soon as it is done
+void frame_range(void *ctx, long start, long end)
+{
+    FrameTask *t = ctx;
+    Cplx *buf = malloc((size_t)t->fftLen * sizeof(Cplx));
+    int len = t->frameLen;
+
+    if (buf == NULL) {
+        t->memError = 1;
+        return;
+    }
+
+    for (long fr = start; fr < end; fr++) {
+        const double *x = t->x + fr * len;
+        double *f = t->feats + fr * FEAT_COUNT;
+        double sum = 0.0, sumSq = 0.0, mn = x[0], mx = x[0];
+        long crossings = 0, peaks = 0;
+
+        // single pass for everything in the time domain
+        for (int i = 0; i < len; i++) {
+            double v = x[i];
+            sum += v;
+            sumSq += v * v;
+            mn = (v < mn) ? v : mn;
+            mx = (v > mx) ? v : mx;
+            if (i > 0) {
+                double u = x[i - 1];
+                crossings += (u > 0 && v < 0) || (u < 0 && v > 0);
+                if (i + 1 < len) {
+                    peaks += (v > t->peakLevel && v > u && v >= x[i + 1]);
+                }
+            }
+        }
+
+        double dc = sum / len;
+        double rms = sqrt(sumSq / len);
+        double peak = fmax(fabs(mn), fabs(mx));
+
+        f[FEAT_DC] = dc;
+        f[FEAT_RMS] = rms;
+        f[FEAT_CREST] = (rms > 0.0) ? peak / rms : 0.0;
+        f[FEAT_ZCR] = (double)crossings / len;
+        f[FEAT_PEAKS] = (double)peaks;
+        f[FEAT_DCRATIO] = (rms > 0.0) ? fabs(dc) / rms : 0.0;
+        f[FEAT_P2P] = mx - mn;
+
+        // spectral centroid of the windowed frame with its DC removed
+        for (int i = 0; i < t->fftLen; i++) {
+            buf[i] = cplx_make((i < len) ? (x[i] - dc) * t->window[i] : 0.0, 0.0);
+        }
+        fft_radix2(buf, t->fftLen, t->tw, 0);
+        double weighted = 0.0, total = 0.0;
+        for (int k = 1; k <= t->fftLen / 2; k++) {
+            double mag = hypot(buf[k].re, buf[k].im);
+            weighted += k * mag;
+            total += mag;
+        }
+        f[FEAT_CENTROID] = (total > 0.0) ? weighted / total * t->fs / t->fftLen : 0.0;
+
+        t->labels[fr] = frame_classify(f);
+    }
+    free(buf);
+}
+
+// split x[] into whole frames and fill feats[] / labels[]; returns frames or -1
+long frame_extract(const double *x, long n, int frameLen, double fs, double peakLevel,
+                   double **feats, int **labels)
+{
+    FrameTask task;
+    long nFrames = n / frameLen;
+    Cplx *tw;
+    double *window;
+
+    task.fftLen = 1;
+    while (task.fftLen < frameLen) task.fftLen <<= 1;
+
+    *feats = malloc((size_t)nFrames * FEAT_COUNT * sizeof(double));
+    *labels = malloc((size_t)nFrames * sizeof(int));
+    tw = malloc((size_t)(task.fftLen / 2 + 1) * sizeof(Cplx));
+    window = malloc((size_t)frameLen * sizeof(double));
+    if (*feats == NULL || *labels == NULL || tw == NULL || window == NULL) {
+        free(*feats);
+        free(*labels);
+        free(tw);
+        free(window);
+        return -1;
+    }
+    fft_twiddles(tw, task.fftLen);
+    for (int i = 0; i < frameLen; i++) {
+        window[i] = 0.5 - 0.5 * cos(2.0 * M_PI * i / (frameLen - 1));
+    }
+
+    task.x = x;
+    task.frameLen = frameLen;
+    task.tw = tw;
+    task.window = window;
+    task.fs = fs;
+    task.peakLevel = peakLevel;
+    task.feats = *feats;
+    task.labels = *labels;
+    task.memError = 0;
+    parallel_range(nFrames, (65536 / frameLen > 0) ? 65536 / frameLen : 1, frame_range, &task);
+    free(tw);
+    free(window);
+
+    if (task.memError) {
+        free(*feats);
+        free(*labels);
+        return -1;
+    }
+    return nFrames;
+}
+
+// one character per column: the highest-priority label seen in its frames,
+// so a single odd frame still shows; then the runs of equal labels
+void frame_timeline(const int *labels, long nFrames, int frameLen, double fs)
+{
+    long count[FRAME_MAX_RULES + 1] = { 0 };
+    int width = (nFrames < FRAME_TIMELINE_WIDTH) ? (int)nFrames : FRAME_TIMELINE_WIDTH;
+    long runs = 0;
+
+    printf("\nTimeline (%ld frames, %d per column at most):\n ", nFrames,
+           (int)((nFrames + width - 1) / width));
+    for (int c = 0; c < width; c++) {
+        long from = nFrames * c / width, to = nFrames * (c + 1) / width;
+        int best = frameRuleCount;
+        for (long fr = from; fr < to; fr++) {
+            best = (labels[fr] < best) ? labels[fr] : best;
+        }
+        putchar((best < frameRuleCount) ? 'a' + best : '.');
+    }
+    printf("\n");
+
+    printf("\n%-17s %14s %14s  %s\n", "   Frames", "From (s)", "To (s)", "Label");
+    for (long fr = 0; fr < nFrames; ) {
+        long last = fr;
+        while (last + 1 < nFrames && labels[last + 1] == labels[fr]) last++;
+        if (runs < FRAME_MAX_RUNS) {
+            printf("%8ld-%-8ld %14.4f %14.4f  %s\n", fr, last, (double)fr * frameLen / fs,
+                   (double)(last + 1) * frameLen / fs, frame_label(labels[fr]));
+        }
+        runs++;
+        count[labels[fr]] += last - fr + 1;
+        fr = last + 1;
+    }
+    if (runs > FRAME_MAX_RUNS) {
+        printf("... %ld more runs\n", runs - FRAME_MAX_RUNS);
+    }
+
+    printf("\nLabel counts:\n");
+    for (int r = 0; r <= frameRuleCount; r++) {
+        if (count[r] > 0) {
+            printf(" %c %-*s %10ld frames (%.2f%%)\n", (r < frameRuleCount) ? 'a' + r : '.',
+                   FRAME_LABEL, frame_label(r), count[r], 100.0 * count[r] / nFrames);
+        }
+    }
+}
+
+// ========== Helper Functions (envelope) ==========
+
+void envelope_free(void)
+{
+    if (envelope.map != NULL) {
+        session_map_release(envelope.map);
+        envelope.map = NULL;
+    } else {
+        free(envelope.win);
+    }
+    envelope.win = NULL;
+    envelope.count = 0;
+}
+
+// windows [start, end) from the region index; each costs the same
+// whatever the overlap, and the index is only read. Its sums cover only
+// the window's own blocks, so quiet windows after loud ones stay exact.
+void envelope_range(void *ctx, long start, long end)
+{
+    Envelope *e = ctx;
+
+    for (long w = start; w < end; w++) {
+        int first = (int)(w * e->hop);
+        roi_query(first, first + e->window, &e->win[w]);
+    }
+}
+
+int envelope_compute(int window, int hop, double fs)
+{
+    long count = (sampleCount - window) / hop + 1;
+
+    if (roi_prepare() != 0) {
+        return -1;
+    }
+    envelope_free();
+    envelope.win = malloc((size_t)count * sizeof(SummaryNode));
+    if (envelope.win == NULL) {
+        return -1;
+    }
+    envelope.count = count;
+    envelope.window = window;
+    envelope.hop = hop;
+    envelope.fs = fs;
+    envelope.generation = sampleGeneration;
+    parallel_range(count, 4096, envelope_range, &envelope);
+    return 0;
+}
+
+// one column (ENV_*) of window w
+double envelope_value(long w, int column)
+{
+    const SummaryNode *s = &envelope.win[w];
+    double n = envelope.window;
+    double rms = sqrt(s->sumSq / n);
+    double peak = fmax(fabs(s->min), fabs(s->max));
+
+    switch (column) {
+        case ENV_DC:   return s->sum / n;
+        case ENV_RMS:  return rms;
+        case ENV_MIN:  return s->min;
+        case ENV_MAX:  return s->max;
+        case ENV_PEAK: return peak;
+        default:       return (rms > 0.0) ? peak / rms : 0.0;
+    }
+}
+
+// time of the middle of window w, in seconds
+double envelope_time(long w)
+{
+    return (w * (double)envelope.hop + envelope.window / 2.0) / envelope.fs;
+}
+
+// ========== Helper Functions (sliding extrema) ==========
+
+int sliding_init(SlidingExtrema *s, long window)
+{
+    long size = 1;
+
+    memset(s, 0, sizeof(*s));
+    while (size < window) size <<= 1;
+    s->window = window;
+    s->mask = size - 1;
+    s->minVal = malloc((size_t)size * sizeof(double));
+    s->maxVal = malloc((size_t)size * sizeof(double));
+    s->minIdx = malloc((size_t)size * sizeof(long long));
+    s->maxIdx = malloc((size_t)size * sizeof(long long));
+    if (s->minVal == NULL || s->maxVal == NULL || s->minIdx == NULL || s->maxIdx == NULL) {
+        sliding_free(s);
+        return -1;
+    }
+    return 0;
+}
+
+void sliding_free(SlidingExtrema *s)
+{
+    free(s->minVal);
+    free(s->maxVal);
+    free(s->minIdx);
+    free(s->maxIdx);
+    s->minVal = s->maxVal = NULL;
+    s->minIdx = s->maxIdx = NULL;
+}
+
+// add one sample; returns 1 (with min / max of the last window) once
+// `window` samples have been seen
+int sliding_push(SlidingExtrema *s, double x, double *mn, double *mx)
+{
+    long long i = s->next++;
+    long m = s->mask;
+
+    // the front leaves once it falls out of the window (done first, so
+    // the ring never holds more than `window` entries)
+    if (s->minCount > 0 && s->minIdx[s->minHead] <= i - s->window) {
+        s->minHead = (s->minHead + 1) & m;
+        s->minCount--;
+    }
+    if (s->maxCount > 0 && s->maxIdx[s->maxHead] <= i - s->window) {
+        s->maxHead = (s->maxHead + 1) & m;
+        s->maxCount--;
+    }
+
+    // drop values that can no longer be the extreme, then append x
+    while (s->minCount > 0 && s->minVal[(s->minHead + s->minCount - 1) & m] >= x) s->minCount--;
+    s->minVal[(s->minHead + s->minCount) & m] = x;
+    s->minIdx[(s->minHead + s->minCount) & m] = i;
+    s->minCount++;
+    while (s->maxCount > 0 && s->maxVal[(s->maxHead + s->maxCount - 1) & m] <= x) s->maxCount--;
+    s->maxVal[(s->maxHead + s->maxCount) & m] = x;
+    s->maxIdx[(s->maxHead + s->maxCount) & m] = i;
+    s->maxCount++;
+
+    if (i + 1 < s->window) {
+        return 0;
+    }
+    *mn = s->minVal[s->minHead];
+    *mx = s->maxVal[s->maxHead];
+    return 1;
+}
+
+// rolling min / max of x[] for windows ending at window-1 .. n-1;
+// returns the number of windows or -1 if out of memory
+long sliding_series(const double *x, long n, long window, double *mn, double *mx)
+{
+    SlidingExtrema s;
+    long out = 0;
+
+    if (sliding_init(&s, window) != 0) {
+        return -1;
+    }
+    for (long i = 0; i < n; i++) {
+        out += sliding_push(&s, x[i], &mn[out], &mx[out]);
+    }
+    sliding_free(&s);
+    return out;
+}
+
+// largest, smallest and mean of a peak-to-peak series; window k ends at
+// sample k + window - 1
+void ripple_report(double largest, long long largestAt, double smallest, long long smallestAt,
+                   double sum, long long count, long window)
+{
+    printf("Windows           : %lld of %ld samples\n", count, window);
+    printf("Largest p2p       : %.4f (window ending at sample %lld)\n", largest,
+           largestAt + window - 1);
+    printf("Smallest p2p      : %.4f (window ending at sample %lld)\n", smallest,
+           smallestAt + window - 1);
+    printf("Mean p2p          : %.4f\n", sum / count);
+}
+
+// ========== Helper Functions (running median) ==========
+
+int skip_init(SkipList *s, int capacity)
+{
+    size_t nodes = (size_t)capacity + 2;
+
+    s->levels = 1;
+    while ((1 << s->levels) < capacity && s->levels < SKIP_LEVELS) s->levels++;
+    s->value = malloc(nodes * sizeof(double));
+    s->level = malloc(nodes * sizeof(int));
+    s->link = malloc(nodes * (size_t)s->levels * sizeof(SkipLink));
+    s->freeList = malloc((size_t)capacity * sizeof(int));
+    if (s->value == NULL || s->level == NULL || s->link == NULL || s->freeList == NULL) {
+        skip_free(s);
+        return -1;
+    }
+    for (int i = 0; i < capacity; i++) {
+        s->freeList[i] = capacity + 1 - i;
+    }
+    s->freeCount = capacity;
+    s->size = 0;
+    s->rng = 2463534242u;
+
+    s->value[1] = INFINITY;           // end node: searches stop on its index
+    s->level[0] = s->levels;
+    for (int k = 0; k < s->levels; k++) {
+        s->link[k].next = 1;
+        s->link[k].width = 1;
+    }
+    return 0;
+}
+
+void skip_free(SkipList *s)
+{
+    free(s->value);
+    free(s->level);
+    free(s->link);
+    free(s->freeList);
+    s->value = NULL;
+    s->level = NULL;
+    s->link = NULL;
+    s->freeList = NULL;
+}
+
+void skip_insert(SkipList *s, double value)
+{
+    int chain[SKIP_LEVELS], steps[SKIP_LEVELS];
+    int L = s->levels;
+    int at = 0;
+
+    for (int k = L - 1; k >= 0; k--) {
+        steps[k] = 0;
+        int next;
+        while ((next = s->link[at * L + k].next) != 1 && s->value[next] <= value) {
+            steps[k] += s->link[at * L + k].width;
+            at = s->link[at * L + k].next;
+        }
+        chain[k] = at;
+    }
+
+    // level with probability 1/2 per step up (xorshift32)
+    s->rng ^= s->rng << 13;
+    s->rng ^= s->rng >> 17;
+    s->rng ^= s->rng << 5;
+    int level = 1;
+    for (uint32_t r = s->rng; (r & 1) && level < L; r >>= 1) level++;
+
+    int id = s->freeList[--s->freeCount];
+    int passed = 0;
+
+    s->value[id] = value;
+    s->level[id] = level;
+    for (int k = 0; k < level; k++) {
+        SkipLink *prev = &s->link[chain[k] * L + k];
+        SkipLink *cur = &s->link[id * L + k];
+        cur->next = prev->next;
+        prev->next = id;
+        cur->width = prev->width - passed;
+        prev->width = passed + 1;
+        passed += steps[k];
+    }
+    for (int k = level; k < L; k++) {
+        s->link[chain[k] * L + k].width++;
+    }
+    s->size++;
+}
+
+// remove one element equal to value (it must be present)
+void skip_remove(SkipList *s, double value)
+{
+    int chain[SKIP_LEVELS];
+    int L = s->levels;
+    int at = 0;
+
+    for (int k = L - 1; k >= 0; k--) {
+        int next;
+        while ((next = s->link[at * L + k].next) != 1 && s->value[next] < value) {
+            at = next;
+        }
+        chain[k] = at;
+    }
+
+    int id = s->link[chain[0] * L].next;
+    for (int k = 0; k < s->level[id]; k++) {
+        SkipLink *prev = &s->link[chain[k] * L + k];
+        prev->width += s->link[id * L + k].width - 1;
+        prev->next = s->link[id * L + k].next;
+    }
+    for (int k = s->level[id]; k < L; k++) {
+        s->link[chain[k] * L + k].width--;
+    }
+    s->freeList[s->freeCount++] = id;
+    s->size--;
+}
+
+// k-th smallest, from 0
+double skip_get(const SkipList *s, int k)
+{
+    int L = s->levels;
+    int at = 0;
+
+    k++;
+    for (int level = L - 1; level >= 0; level--) {
+        while (s->link[at * L + level].width <= k) {
+            k -= s->link[at * L + level].width;
+            at = s->link[at * L + level].next;
+        }
+    }
+    return s->value[at];
+}
+
+// how many elements are below value (or at most value when inclusive)
+int skip_rank(const SkipList *s, double value, int inclusive)
+{
+    int L = s->levels;
+    int at = 0, rank = 0;
+
+    for (int k = L - 1; k >= 0; k--) {
+        while (1) {
+            int next = s->link[at * L + k].next;
+            if (next == 1) break;
+            double v = s->value[next];
+            if (!(v < value || (inclusive && v == value))) break;
+            rank += s->link[at * L + k].width;
+            at = s->link[at * L + k].next;
+        }
+    }
+    return rank;
+}
+
+// running median (threshold < 0) or Hampel filter: a sample further than
+// threshold * 1.4826 * MAD from its window median is replaced by the
+// median. Windows are centred and shrink at the ends so they stay odd.
+// The MAD itself is never formed: it is below a distance D exactly when
+// more than half the window lies within D of the median, which is two
+// rank lookups. Samples that are inf or NaN have no place in the order:
+// they are kept out of the windows and passed through unchanged.
+// Returns the number of samples changed, or -1 if out of memory.
+long median_filter(double a[], int n, int windowSize, double threshold)
+{
+    SkipList s;
+    double *out = malloc((size_t)n * sizeof(double));
+    int half = windowSize / 2;
+    int lo = 0, hi = -1;              // window currently in the list
+    long changed = 0;
+
+    if (out == NULL || skip_init(&s, windowSize) != 0) {
+        free(out);
+        return -1;
+    }
+
+    for (int i = 0; i < n; i++) {
+        int h = half;
+        if (h > i) h = i;
+        if (h > n - 1 - i) h = n - 1 - i;
+
+        while (lo < i - h) {
+            if (isfinite(a[lo])) skip_remove(&s, a[lo]);
+            lo++;
+        }
+        while (hi < i + h) {
+            hi++;
+            if (isfinite(a[hi])) skip_insert(&s, a[hi]);
+        }
+
+        if (!isfinite(a[i]) || s.size == 0) {
+            out[i] = a[i];
+            continue;
+        }
+        double m = skip_get(&s, s.size / 2);
+        if (threshold < 0.0) {
+            out[i] = m;
+        } else {
+            double dev = fabs(a[i] - m);
+            int outlier;
+
+            if (dev == 0.0) {
+                outlier = 0;
+            } else if (threshold == 0.0) {
+                outlier = 1;
+            } else {
+                double d = dev / (threshold * 1.4826);
+                int inside = skip_rank(&s, m + d, 0) - skip_rank(&s, m - d, 1);
+                outlier = (inside > s.size / 2);
+            }
+            out[i] = outlier ? m : a[i];
+        }
+        changed += (out[i] != a[i]);
+    }
+
+    memcpy(a, out, (size_t)n * sizeof(double));
+    skip_free(&s);
+    free(out);
+    return changed;
+}
+
+// ========== Helper Functions (trigger) ==========
+
+// does sample j fire an edge, level or window trigger? Edges need j >= 1.
+int trigger_hit(const TriggerSpec *t, const double *x, long j)
+{
+    switch (t->type) {
+        case TRIG_RISING:  return x[j - 1] < t->level && x[j] >= t->level;
+        case TRIG_FALLING: return x[j - 1] > t->level && x[j] <= t->level;
+        case TRIG_LEVEL:   return x[j] >= t->level;
+        case TRIG_WINDOW:  return x[j] < t->low || x[j] > t->high;
+        default:           return (x[j - 1] < t->level) != (x[j] < t->level);   // any crossing
+    }
+}
+
+// could anything in [i, end) fire? Each condition is turned into 0.0 or
+// 1.0 and summed without branches, which the compiler runs as SIMD compares
+// plus one test per block; quiet blocks are skipped at memory speed.
+int trigger_block_active(const TriggerSpec *t, const double *restrict x, long i, long end)
+{
+    double hits = 0.0;
+    double level = t->level, low = t->low, high = t->high;
+
+    switch (t->type) {
+        case TRIG_RISING:
+            for (long j = i; j < end; j++) {
+                double now = (x[j] >= level) ? 1.0 : 0.0, before = (x[j - 1] >= level) ? 1.0 : 0.0;
+                hits += (now > before) ? 1.0 : 0.0;
+            }
+            break;
+        case TRIG_FALLING:
+            for (long j = i; j < end; j++) {
+                double now = (x[j] <= level) ? 1.0 : 0.0, before = (x[j - 1] <= level) ? 1.0 : 0.0;
+                hits += (now > before) ? 1.0 : 0.0;
+            }
+            break;
+        case TRIG_LEVEL:
+            for (long j = i; j < end; j++) hits += (x[j] >= level) ? 1.0 : 0.0;
+            break;
+        case TRIG_WINDOW:
+            for (long j = i; j < end; j++) hits += (x[j] < low || x[j] > high) ? 1.0 : 0.0;
+            break;
+        default:
+            for (long j = i; j < end; j++) hits += ((x[j - 1] < level) != (x[j] < level)) ? 1.0 : 0.0;
+            break;
+    }
+    return hits > 0.0;
+}
+
+// find trigger positions in x[]; at most maxEvents are stored, all are
+// counted in *total. Returns the number stored.
+long trigger_scan(const TriggerSpec *t, const double *x, long n, long *events, long maxEvents,
+                  long long *total)
+{
+    long stored = 0;
+    long next = 0;                    // first sample allowed after the holdoff
+    long riseAt = -1;                 // pulse trigger: start of the current pulse
+    long hold = (t->holdoff > 0) ? t->holdoff : 1;
+
+    long first = 1;
+
+    *total = 0;
+    // level and window triggers need no previous sample, so sample 0 can
+    // fire too; edges and pulses start comparing at sample 1
+    if (n > 0 && (t->type == TRIG_LEVEL || t->type == TRIG_WINDOW) && trigger_hit(t, x, 0)) {
+        if (maxEvents > 0) events[stored++] = 0;
+        (*total)++;
+        next = hold;
+        first = next;
+    }
+    for (long i = first; i < n; ) {
+        long end = (n - i < TRIG_BLOCK) ? n : i + TRIG_BLOCK;
+        long resume = end;
+
+        if (!trigger_block_active(t, x, i, end)) {
+            i = end;
+            continue;
+        }
+        for (long j = i; j < end; j++) {
+            long at = j;
+
+            if (!trigger_hit(t, x, j)) continue;
+            if (t->type == TRIG_PULSE) {
+                if (x[j] >= t->level) {
+                    riseAt = j;       // pulse starts
+                    continue;
+                }
+                if (riseAt < 0) continue;   // pulse began before the capture
+                long width = j - riseAt;
+                at = riseAt;
+                riseAt = -1;
+                if (width >= t->minWidth && width <= t->maxWidth) continue;
+            }
+            if (at < next) continue;
+
+            if (stored < maxEvents) events[stored++] = at;
+            (*total)++;
+            next = at + hold;
+            if (t->type != TRIG_PULSE && next > j + 1) {
+                resume = next;        // jump over the holdoff
+                break;
+            }
+        }
+        i = resume;
+    }
+    return stored;
+}
+
+// samples kept around event k: [*start, *end), clipped to the buffer
+void trigger_window(long k, long *start, long *end)
+{
+    long at = trigEvents[k];
+
+    *start = (at - trigSpec.pre > 0) ? at - trigSpec.pre : 0;
+    *end = (at + trigSpec.post < sampleCount) ? at + trigSpec.post : sampleCount;
+    if (*end <= *start) *end = *start + 1;
+}
+
+// ========== Helper Functions (sample slots) ==========
+
+// "buffer", "ref" or the name of a menu 28 version; returns 0 if found
+int slot_find(const char *name, SlotView *v)
+{
+    memset(v, 0, sizeof(*v));
+    snprintf(v->name, sizeof(v->name), "%s", name);
+    if (strcmp(name, "buffer") == 0) {
+        v->flat = samples;
+        v->count = dataAvailable ? sampleCount : 0;
+        return 0;
+    }
+    if (strcmp(name, "ref") == 0) {
+        v->flat = refSamples;
+        v->count = (refSamples != NULL) ? refCount : 0;
+        return 0;
+    }
+    for (int k = 0; k < namedCount; k++) {
+        if (strcmp(namedVersions[k]->name, name) == 0) {
+            v->version = namedVersions[k];
+            v->count = namedVersions[k]->count;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// samples from index `at` that are contiguous in memory; *len gets how many
+const double *slot_piece(const SlotView *v, long at, long *len)
+{
+    if (v->flat != NULL) {
+        *len = v->count - at;
+        return v->flat + at;
+    }
+    const SnapChunk *c = v->version->chunks[at / SNAP_CHUNK];
+    *len = c->len - at % SNAP_CHUNK;
+    return c->data + at % SNAP_CHUNK;
+}
+
+// every comparison sum in one pass, in SUM_LANES lanes so it vectorises
+void compare_block(const double *restrict a, const double *restrict b, long n,
+                   double shiftA, double shiftB, CompareSums *s)
+{
+    double d2[SUM_LANES] = {0.0}, mx[SUM_LANES] = {0.0};
+    double sa[SUM_LANES] = {0.0}, sb[SUM_LANES] = {0.0};
+    double saa[SUM_LANES] = {0.0}, sbb[SUM_LANES] = {0.0}, sab[SUM_LANES] = {0.0};
+    long i = 0;
+
+    for (; i + SUM_LANES <= n; i += SUM_LANES) {
+        for (int j = 0; j < SUM_LANES; j++) {
+            double x = a[i + j] - shiftA, y = b[i + j] - shiftB;
+            double d = a[i + j] - b[i + j];
+            d2[j] += d * d;
+            mx[j] = fmax(mx[j], fabs(d));
+            sa[j] += x;
+            sb[j] += y;
+            saa[j] += x * x;
+            sbb[j] += y * y;
+            sab[j] += x * y;
+        }
+    }
+    for (int j = 0; i + j < n; j++) {
+        double x = a[i + j] - shiftA, y = b[i + j] - shiftB;
+        double d = a[i + j] - b[i + j];
+        d2[j] += d * d;
+        mx[j] = fmax(mx[j], fabs(d));
+        sa[j] += x;
+        sb[j] += y;
+        saa[j] += x * x;
+        sbb[j] += y * y;
+        sab[j] += x * y;
+    }
+
+    memset(s, 0, sizeof(*s));
+    for (int j = 0; j < SUM_LANES; j++) {
+        s->sumD2 += d2[j];
+        s->maxAbs = fmax(s->maxAbs, mx[j]);
+        s->sa += sa[j];
+        s->sb += sb[j];
+        s->saa += saa[j];
+        s->sbb += sbb[j];
+        s->sab += sab[j];
+    }
+}
+
+// blocks [start, end) of SNAP_CHUNK samples; both kinds of slot break at
+// the same places, so each block is one contiguous piece of each
+void compare_range(void *ctx, long start, long end)
+{
+    CompareTask *t = ctx;
+
+    for (long blk = start; blk < end; blk++) {
+        long first = blk * SNAP_CHUNK;
+        long len = (t->n - first < SNAP_CHUNK) ? t->n - first : SNAP_CHUNK;
+        long lenA, lenB;
+        const double *a = slot_piece(t->a, first, &lenA);
+        const double *b = slot_piece(t->b, first, &lenB);
+
+        compare_block(a, b, len, t->shiftA, t->shiftB, &t->partials[blk]);
+    }
+}
+
+// compare the first n samples of two slots; block sums are added in
+// block order, so the result does not depend on the thread count.
+// *maxAt gets the index of the largest |a - b|. Returns -1 if out of memory.
+int compare_slots(const SlotView *a, const SlotView *b, long n, CompareSums *total, long *maxAt)
+{
+    long nBlocks = (n + SNAP_CHUNK - 1) / SNAP_CHUNK;
+    long len;
+    CompareTask task;
+    long maxBlock = 0;
+
+    task.a = a;
+    task.b = b;
+    task.n = n;
+    task.shiftA = *slot_piece(a, 0, &len);   // shifting by a sample keeps sums small
+    task.shiftB = *slot_piece(b, 0, &len);
+    task.partials = malloc((size_t)nBlocks * sizeof(CompareSums));
+    if (task.partials == NULL) {
+        return -1;
+    }
+    parallel_range(nBlocks, 16, compare_range, &task);
+
+    memset(total, 0, sizeof(*total));
+    for (long blk = 0; blk < nBlocks; blk++) {
+        const CompareSums *p = &task.partials[blk];
+        total->sumD2 += p->sumD2;
+        if (p->maxAbs > total->maxAbs) {
+            total->maxAbs = p->maxAbs;
+            maxBlock = blk;
+        }
+        total->sa += p->sa;
+        total->sb += p->sb;
+        total->saa += p->saa;
+        total->sbb += p->sbb;
+        total->sab += p->sab;
+    }
+    free(task.partials);
+
+    // find where the largest error is inside its block
+    long first = maxBlock * SNAP_CHUNK, lenA, lenB;
+    const double *pa = slot_piece(a, first, &lenA);
+    const double *pb = slot_piece(b, first, &lenB);
+    *maxAt = first;
+    for (long i = 0; i < n - first && i < SNAP_CHUNK; i++) {
+        if (fabs(pa[i] - pb[i]) == total->maxAbs) {
+            *maxAt = first + i;
+            break;
+        }
+    }
+    return 0;
+}
+
+// ========== Helper Functions (session) ==========
+
+// bytes per element of a section type, 0 if not fixed
+size_t session_elem_size(uint32_t type)
+{
+    switch (type) {
+        case SESS_SAMPLES:
+        case SESS_REFERENCE:
+        case SESS_NAMED:
+        case SESS_ROI_SUM:
+        case SESS_ROI_SUMSQ:
+        case SESS_ROI_MIN:
+        case SESS_ROI_MAX:  return sizeof(double);
+        case SESS_ENVELOPE: return sizeof(SummaryNode);
+        case SESS_EVENTS:   return sizeof(long);
+        case SESS_TRIGGER:  return sizeof(TriggerSpec);
+        case SESS_RULES:    return sizeof(FrameRule);
+        default:            return 0;
+    }
+}
+
+// start a section at the next page boundary; returns its table entry
+SessionSection *session_begin(SessionWriter *w, uint32_t type, const char *name, int64_t count)
+{
+    static const char zeros[SESS_ALIGN] = { 0 };
+    uint64_t pad = (SESS_ALIGN - w->pos % SESS_ALIGN) % SESS_ALIGN;
+
+    if (w->head.sections == SESS_MAX_SECTIONS ||
+        fwrite(zeros, 1, (size_t)pad, w->fp) != pad) {
+        return NULL;
+    }
+    w->pos += pad;
+
+    SessionSection *s = &w->table[w->head.sections++];
+    memset(s, 0, sizeof(*s));
+    s->type = type;
+    s->offset = w->pos;
+    s->count = count;
+    snprintf(s->name, sizeof(s->name), "%s", (name != NULL) ? name : "");
+    return s;
+}
+
+// append data to the section being written
+int session_write(SessionWriter *w, SessionSection *s, const void *data, size_t bytes)
+{
+    if (bytes > 0 && fwrite(data, 1, bytes, w->fp) != bytes) {
+        return -1;
+    }
+    w->pos += bytes;
+    s->bytes += bytes;
+    return 0;
+}
+
+// one whole section in one call; returns NULL on a write error
+SessionSection *session_put(SessionWriter *w, uint32_t type, const char *name,
+                            const void *data, size_t elemSize, int64_t count)
+{
+    SessionSection *s = session_begin(w, type, name, count);
+
+    if (s == NULL || session_write(w, s, data, elemSize * (size_t)count) != 0) {
+        return NULL;
+    }
+    return s;
+}
+
+int session_save(const char *path)
+{
+    SessionWriter w;
+    SessionSection *s;
+    int ok = 1;
+
+    memset(&w, 0, sizeof(w));
+    w.fp = fopen(path, "wb");
+    if (w.fp == NULL) {
+        return -1;
+    }
+    memcpy(w.head.magic, "WFSESS1", 8);
+    w.head.version = SESS_FORMAT;
+
+    // header and table are rewritten at the end, when they are complete
+    ok = (fwrite(&w.head, sizeof(w.head), 1, w.fp) == 1 &&
+          fwrite(w.table, sizeof(w.table), 1, w.fp) == 1);
+    w.pos = sizeof(w.head) + sizeof(w.table);
+
+    if (ok) {
+        s = session_put(&w, SESS_SAMPLES, signalType, samples, sizeof(double),
+                        dataAvailable ? sampleCount : 0);
+        ok = (s != NULL);
+    }
+    if (ok && refSamples != NULL && refCount > 0) {
+        ok = (session_put(&w, SESS_REFERENCE, "ref", refSamples, sizeof(double), refCount) != NULL);
+    }
+    for (int k = 0; ok && k < namedCount; k++) {
+        const SnapVersion *v = namedVersions[k];
+        s = session_begin(&w, SESS_NAMED, v->name, v->count);
+        ok = (s != NULL);
+        for (int c = 0; ok && c < v->nChunks; c++) {
+            ok = (session_write(&w, s, v->chunks[c]->data,
+                                (size_t)v->chunks[c]->len * sizeof(double)) == 0);
+        }
+    }
+
+    // region index, if it is up to date, so menus 33, 38 and 40 skip the rebuild
+    if (ok && roiIndex.built && roiIndex.generation == sampleGeneration) {
+        const RoiIndex *r = &roiIndex;
+        for (int h = 0; ok && h < r->sumLevels; h++) {
+            s = session_put(&w, SESS_ROI_SUM, NULL, r->blockSum[h], sizeof(double), r->nBlocks);
+            if ((ok = (s != NULL))) s->param[0] = h;
+            if (ok) s = session_put(&w, SESS_ROI_SUMSQ, NULL, r->blockSumSq[h], sizeof(double),
+                                    r->nBlocks);
+            if (ok && (ok = (s != NULL))) s->param[0] = h;
+        }
+        for (int k = 0; ok && k < r->levels; k++) {
+            long count = (k == 0) ? r->nBlocks : r->nBlocks - (1 << k) + 1;
+            s = session_put(&w, SESS_ROI_MIN, NULL, r->blockMin[k], sizeof(double), count);
+            if ((ok = (s != NULL))) s->param[0] = k;
+            if (ok) s = session_put(&w, SESS_ROI_MAX, NULL, r->blockMax[k], sizeof(double), count);
+            if (ok && (ok = (s != NULL))) s->param[0] = k;
+        }
+    }
+
+    if (ok && envelope.count > 0) {
+        s = session_put(&w, SESS_ENVELOPE, NULL, envelope.win, sizeof(SummaryNode),
+                        envelope.count);
+        if ((ok = (s != NULL))) {
+            s->current = (envelope.generation == sampleGeneration);
+            s->param[0] = envelope.window;
+            s->param[1] = envelope.hop;
+            s->value = envelope.fs;
+        }
+    }
+    if (ok && trigCount > 0) {
+        ok = (session_put(&w, SESS_TRIGGER, NULL, &trigSpec, sizeof(trigSpec), 1) != NULL);
+        if (ok) s = session_put(&w, SESS_EVENTS, NULL, trigEvents, sizeof(long), trigCount);
+        if (ok && (ok = (s != NULL))) s->current = (trigGeneration == sampleGeneration);
+    }
+    if (ok && frameRuleCount >= 0) {
+        ok = (session_put(&w, SESS_RULES, NULL, frameRules, sizeof(FrameRule),
+                          frameRuleCount) != NULL);
+    }
+
+    w.head.fileSize = w.pos;
+    if (ok) {
+        ok = (fseek(w.fp, 0, SEEK_SET) == 0 &&
+              fwrite(&w.head, sizeof(w.head), 1, w.fp) == 1 &&
+              fwrite(w.table, sizeof(w.table), 1, w.fp) == 1);
+    }
+    if (fclose(w.fp) != 0) ok = 0;
+    return ok ? 0 : -1;
+}
+
+void session_map_release(SessionMap *m)
+{
+    if (m != NULL && --m->refs == 0) {
+        munmap(m->base, m->size);
+        free(m);
+    }
+}
+
+// a SAMPLE_BUF_SIZE buffer whose start is the section, mapped copy-on-write
+// from the file: nothing is read until it is used, and writes stay private.
+// The rest of the buffer is anonymous memory. Returns NULL on failure.
+double *session_map_buffer(int fd, const SessionSection *s)
+{
+    size_t size = SAMPLE_BUF_SIZE * sizeof(double);
+    void *region = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (region == MAP_FAILED) {
+        return NULL;
+    }
+    if (s->bytes > 0 &&
+        mmap(region, (size_t)s->bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED,
+             fd, (off_t)s->offset) == MAP_FAILED) {
+        munmap(region, size);
+        return NULL;
+    }
+    return region;
+}
+
+// named version whose chunks point into a mapped session file
+SnapVersion *session_map_version(const char *name, const double *x, int count, SessionMap *map)
+{
+    SnapVersion *v = calloc(1, sizeof(SnapVersion));
+
+    if (v == NULL) {
+        return NULL;
+    }
+    v->refs = 1;
+    snprintf(v->name, sizeof(v->name), "%s", name);
+    v->count = count;
+    v->nChunks = (count + SNAP_CHUNK - 1) / SNAP_CHUNK;
+    v->chunks = calloc(v->nChunks > 0 ? v->nChunks : 1, sizeof(SnapChunk *));
+    if (v->chunks == NULL) {
+        free(v);
+        return NULL;
+    }
+    for (int c = 0; c < v->nChunks; c++) {
+        SnapChunk *chunk = malloc(sizeof(SnapChunk));
+        if (chunk == NULL) {
+            v->nChunks = c;
+            snapshot_release(v);
+            return NULL;
+        }
+        chunk->refs = 1;
+        chunk->len = (count - c * SNAP_CHUNK < SNAP_CHUNK) ? count - c * SNAP_CHUNK : SNAP_CHUNK;
+        chunk->mark = 0;
+        chunk->map = map;
+        chunk->data = (double *)&x[c * SNAP_CHUNK];
+        map->refs++;
+        v->chunks[c] = chunk;
+    }
+    return v;
+}
+
+// is the section table safe to restore? Each section must lie inside the
+// file, and sections that depend on each other must agree: the region
+// index, envelope and events must fit the saved samples, and rules must
+// only name known features. Returns 0 if so, -2 if not.
+int session_check(const uint8_t *base, const SessionHeader *h, const SessionSection *table)
+{
+    int64_t n = 0, nBlocks, levels = 0, sumLevels = 0;
+    int samplesSeen = 0;
+    uint32_t minLevels = 0, maxLevels = 0;   // bit k set once level k is seen
+    uint32_t sumLevelsSeen = 0, sumSqLevelsSeen = 0;
+
+    for (uint32_t i = 0; i < h->sections; i++) {
+        const SessionSection *s = &table[i];
+        size_t elem = session_elem_size(s->type);
+
+        // count first, so count * elem below cannot wrap
+        if (s->offset > h->fileSize || s->bytes > h->fileSize - s->offset ||
+            s->offset % SESS_ALIGN != 0 || s->count < 0 ||
+            (uint64_t)s->count > h->fileSize ||
+            memchr(s->name, 0, sizeof(s->name)) == NULL ||
+            (elem > 0 && s->bytes != (uint64_t)s->count * elem) ||
+            ((s->type == SESS_SAMPLES || s->type == SESS_REFERENCE ||
+              s->type == SESS_NAMED) && s->count > SAMPLE_BUF_SIZE) ||
+            (s->type == SESS_RULES && s->count > FRAME_MAX_RULES) ||
+            (s->type == SESS_EVENTS && s->count > TRIG_MAX_EVENTS) ||
+            (s->type == SESS_TRIGGER && s->count != 1)) {
+            return -2;
+        }
+        if (s->type == SESS_SAMPLES) {
+            if (samplesSeen++) return -2;
+            n = s->count;
+        }
+    }
+
+    nBlocks = (n + ROI_BLOCK - 1) / ROI_BLOCK;
+    if (n > 0) {
+        levels = 1;
+        while ((1L << levels) <= nBlocks && levels < ROI_MAX_LEVELS) levels++;
+        sumLevels = roi_sum_levels(nBlocks);
+    }
+
+    for (uint32_t i = 0; i < h->sections; i++) {
+        const SessionSection *s = &table[i];
+        const void *data = base + s->offset;
+
+        switch (s->type) {
+            case SESS_ROI_SUM:
+            case SESS_ROI_SUMSQ: {
+                // every sum level holds one entry per block
+                int64_t k = s->param[0];
+                uint32_t *seen = (s->type == SESS_ROI_SUM) ? &sumLevelsSeen : &sumSqLevelsSeen;
+                if (k < 0 || k >= sumLevels || (*seen & (1u << k)) || s->count != nBlocks) {
+                    return -2;
+                }
+                *seen |= 1u << k;
+                break;
+            }
+            case SESS_ROI_MIN:
+            case SESS_ROI_MAX: {
+                // level k holds one entry per run of 2^k blocks
+                int64_t k = s->param[0];
+                uint32_t *seen = (s->type == SESS_ROI_MIN) ? &minLevels : &maxLevels;
+                if (k < 0 || k >= levels || (*seen & (1u << k)) ||
+                    s->count != ((k == 0) ? nBlocks : nBlocks - (1L << k) + 1)) {
+                    return -2;
+                }
+                *seen |= 1u << k;
+                break;
+            }
+            case SESS_ENVELOPE: {
+                // a current envelope must fit the saved samples; a stale one
+                // (saved on purpose, flagged as such) only has to be sane
+                int64_t limit = s->current ? n : SAMPLE_BUF_SIZE;
+                if (s->param[0] < 1 || s->param[0] > limit || s->param[1] < 1 ||
+                    s->param[1] > limit || s->count > limit || !(s->value > 0.0)) {
+                    return -2;
+                }
+                break;
+            }
+            case SESS_TRIGGER: {
+                const TriggerSpec *t = data;
+                if (t->pre < 0 || t->pre > SAMPLE_BUF_SIZE ||
+                    t->post < 0 || t->post > SAMPLE_BUF_SIZE) {
+                    return -2;
+                }
+                break;
+            }
+            case SESS_EVENTS: {
+                // stale events are never used against the samples (menu 40
+                // asks for a new scan), so they only need to be positions
+                const long *ev = data;
+                int64_t limit = s->current ? n : SAMPLE_BUF_SIZE;
+                for (int64_t k = 0; k < s->count; k++) {
+                    if (ev[k] < 0 || ev[k] >= limit) return -2;
+                }
+                break;
+            }
+            case SESS_RULES: {
+                const FrameRule *rule = data;
+                for (int64_t r = 0; r < s->count; r++, rule++) {
+                    if (memchr(rule->label, 0, sizeof(rule->label)) == NULL ||
+                        rule->nConds < 0 || rule->nConds > FRAME_MAX_CONDS) {
+                        return -2;
+                    }
+                    for (int c = 0; c < rule->nConds; c++) {
+                        if (rule->feature[c] < 0 || rule->feature[c] >= FEAT_COUNT ||
+                            rule->op[c] < CMP_LT || rule->op[c] > CMP_EQ) {
+                            return -2;
+                        }
+                    }
+                }
+                break;
+            }
+            default:
+                break;
+        }
+    }
+
+    // the region index comes back whole or not at all
+    uint32_t allLevels = (uint32_t)((1L << levels) - 1);
+    uint32_t allSumLevels = (uint32_t)((1L << sumLevels) - 1);
+    int anyRoi = (sumLevelsSeen | sumSqLevelsSeen | minLevels | maxLevels) != 0;
+    if (anyRoi && (n == 0 || sumLevelsSeen != allSumLevels || sumSqLevelsSeen != allSumLevels ||
+                   minLevels != allLevels || maxLevels != allLevels)) {
+        return -2;
+    }
+    return 0;
+}
+
+// replace the session with a snapshot file. Nothing is read or copied in
+// bulk: the sample and reference buffers are copy-on-write mappings of
+// their sections, and named versions, the region index and the envelope
+// point into one shared read-only mapping of the file, so restoring costs
+// the same for any session size and pages load as they are used. Only
+// events, the trigger settings and frame rules (small, bounded) are
+// copied. Returns -1 if unreadable, -2 if not a session file, -3 if out
+// of memory.
+int session_restore(const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    SessionMap *map;
+    const uint8_t *base;
+    const SessionHeader *h;
+    const SessionSection *table;
+    int result = 0;
+    int roiLoaded = 0;
+    unsigned long before;
+
+    if (fd < 0) {
+        return -1;
+    }
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)(sizeof(SessionHeader) +
+                                                    SESS_MAX_SECTIONS * sizeof(SessionSection))) {
+        close(fd);
+        return -2;
+    }
+    map = malloc(sizeof(SessionMap));
+    if (map == NULL) {
+        close(fd);
+        return -3;
+    }
+    map->size = (size_t)st.st_size;
+    map->refs = 1;                    // held until the end of this function
+    map->base = mmap(NULL, map->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map->base == MAP_FAILED) {
+        free(map);
+        close(fd);
+        return -1;
+    }
+    base = map->base;
+    h = (const SessionHeader *)base;
+    table = (const SessionSection *)(base + sizeof(SessionHeader));
+
+    // check everything before changing anything
+    if (memcmp(h->magic, "WFSESS1", 8) != 0 || h->version != SESS_FORMAT ||
+        h->fileSize != (uint64_t)st.st_size || h->sections > SESS_MAX_SECTIONS ||
+        session_check(base, h, table) != 0) {
+        session_map_release(map);
+        close(fd);
+        return -2;
+    }
+
+    snapshot_before_change("before session restore");
+    before = sampleGeneration;
+    while (namedCount > 0) {
+        snapshot_release(namedVersions[--namedCount]);
+    }
+    roi_free();
+    envelope_free();
+    trigCount = 0;
+    refCount = 0;
+
+    for (uint32_t i = 0; i < h->sections && result == 0; i++) {
+        const SessionSection *s = &table[i];
+        const void *data = base + s->offset;
+
+        switch (s->type) {
+            case SESS_SAMPLES:
+            case SESS_REFERENCE: {
+                double *buf = session_map_buffer(fd, s);
+                if (buf == NULL) {
+                    result = -3;
+                    break;
+                }
+                if (s->type == SESS_SAMPLES) {
+                    if (samplesMapped) munmap(samples, SAMPLE_BUF_SIZE * sizeof(double));
+                    samples = buf;
+                    samplesMapped = 1;
+                    sampleCount = (int)s->count;
+                    dataAvailable = (s->count > 0);
+                    snprintf(signalType, sizeof(signalType), "%.*s",
+                             (int)sizeof(signalType) - 1, s->name);
+                } else {
+                    if (refMapped) munmap(refSamples, SAMPLE_BUF_SIZE * sizeof(double));
+                    else free(refSamples);
+                    refSamples = buf;
+                    refMapped = 1;
+                    refCount = (int)s->count;
+                }
+                break;
+            }
+            case SESS_NAMED:
+                if (namedCount < SNAP_NAMED) {
+                    SnapVersion *v = session_map_version(s->name, data, (int)s->count, map);
+                    if (v == NULL) {
+                        result = -3;
+                        break;
+                    }
+                    namedVersions[namedCount++] = v;
+                }
+                break;
+            case SESS_ROI_SUM:
+            case SESS_ROI_SUMSQ:
+            case SESS_ROI_MIN:
+            case SESS_ROI_MAX: {
+                // session_check() has matched every level to the samples
+                int64_t k = s->param[0];
+                double **slot = (s->type == SESS_ROI_SUM)   ? &roiIndex.blockSum[k] :
+                                (s->type == SESS_ROI_SUMSQ) ? &roiIndex.blockSumSq[k] :
+                                (s->type == SESS_ROI_MIN)   ? &roiIndex.blockMin[k]
+                                                            : &roiIndex.blockMax[k];
+                *slot = (double *)data;
+                roiLoaded = 1;
+                if (s->type == SESS_ROI_MIN && k + 1 > roiIndex.levels) {
+                    roiIndex.levels = (int)k + 1;
+                }
+                if (s->type == SESS_ROI_SUM && k + 1 > roiIndex.sumLevels) {
+                    roiIndex.sumLevels = (int)k + 1;
+                }
+                break;
+            }
+            case SESS_ENVELOPE:
+                envelope.win = (SummaryNode *)data;
+                envelope.map = map;
+                map->refs++;
+                envelope.count = s->count;
+                envelope.window = (int)s->param[0];
+                envelope.hop = (int)s->param[1];
+                envelope.fs = s->value;
+                envelope.generation = s->current ? before + 1 : before;
+                break;
+            case SESS_TRIGGER:
+                memcpy(&trigSpec, data, sizeof(trigSpec));
+                break;
+            case SESS_EVENTS:
+                if (trigEvents == NULL) trigEvents = malloc(TRIG_MAX_EVENTS * sizeof(long));
+                if (trigEvents == NULL) {
+                    result = -3;
+                    break;
+                }
+                memcpy(trigEvents, data, (size_t)s->count * sizeof(long));
+                trigCount = (long)s->count;
+                trigGeneration = s->current ? before + 1 : before;
+                break;
+            case SESS_RULES:
+                memcpy(frameRules, data, (size_t)s->count * sizeof(FrameRule));
+                frameRuleCount = (int)s->count;
+                break;
+            default:
+                break;                // newer section type: skipped
+        }
+    }
+    close(fd);
+
+    samples_changed();
+    if (roiLoaded) {
+        roiIndex.map = map;           // roi_free() now releases instead of freeing
+        map->refs++;
+    }
+    // the index is only kept if it came back whole
+    if (result == 0 && roiIndex.levels > 0 && roiIndex.sumLevels > 0 && dataAvailable) {
+        roiIndex.n = sampleCount;
+        roiIndex.nBlocks = (sampleCount + ROI_BLOCK - 1) / ROI_BLOCK;
+        roiIndex.built = 1;
+        roiIndex.generation = sampleGeneration;
+    } else {
+        roi_free();
+    }
+    session_map_release(map);
+    return result;
+}
+
+// autosave before leaving from the main menu, when switched on in menu 42
+void session_autosave(void)
+{
+    struct timespec start;
+
+    if (!autosaveOn) {
+        return;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (session_save(autosavePath) == 0) {
+        printf("Session saved to %s (%.3f s)\n", autosavePath, elapsed_seconds(&start));
+    } else {
+        printf("Could not save the session to %s: %s\n", autosavePath, strerror(errno));
+    }
+}
+
+// ========== Helper Functions (formulas) ==========
+//
+// Grammar (lowest to highest precedence):
+//   sum     = product { ('+' | '-') product }
+//   product = unary { ('*' | '/') unary }
+//   unary   = '-' unary | power
+//   power   = primary [ '^' unary ]
+//   primary = number | name | name '(' sum [',' sum] ')' | '(' sum ')'
+
+int expr_compile(const char *text, ExprProgram *prog)
+{
+    prog->length = 0;
+    prog->depth = 0;
+    prog->maxDepth = 0;
+    prog->text = text;
+    prog->source = text;
+    prog->error[0] = '\0';
+
+    if (expr_parse_sum(prog) != 0) {
+        return -1;
+    }
+    while (*prog->text == ' ') prog->text++;
+    if (*prog->text != '\0') {
+        snprintf(prog->error, sizeof(prog->error), "unexpected '%c' at position %d",
+                 *prog->text, (int)(prog->text - prog->source) + 1);
+        return -1;
+    }
+    return 0;
+}
+
+// append one instruction, folding operations whose inputs are constants
+int expr_emit(ExprProgram *prog, int op, double value)
+{
+    ExprInstr *code = prog->code;
+    int len = prog->length;
+    int binary = (op >= OP_ADD && op <= OP_POW) || op == OP_MIN || op == OP_MAX;
+    int unary = (op == OP_NEG) || op >= OP_ABS;
+
+    // constant inputs: evaluate now and keep only the result
+    if ((binary && len >= 2 && code[len - 1].op == OP_CONST && code[len - 2].op == OP_CONST) ||
+        (unary && len >= 1 && code[len - 1].op == OP_CONST)) {
+        ExprProgram one;
+        double unused = 0.0, result;
+        int first = binary ? len - 2 : len - 1;
+
+        one.length = 0;
+        for (int k = first; k < len; k++) {
+            one.code[one.length++] = code[k];
+        }
+        one.code[one.length].op = op;
+        one.code[one.length++].value = 0.0;
+        expr_evaluate(&one, &unused, &result, 1);
+
+        code[first].value = result;
+        prog->length = first + 1;
+        if (binary) {
+            prog->depth--;
+        }
+        return 0;
+    }
+
+    if (len >= EXPR_MAX_CODE) {
+        snprintf(prog->error, sizeof(prog->error), "formula too long");
+        return -1;
+    }
+    code[len].op = op;
+    code[len].value = value;
+    prog->length = len + 1;
+
+    if (op <= OP_INDEX) {
+        prog->depth++;
+    } else if (binary) {
+        prog->depth--;
+    }
+    if (prog->depth > prog->maxDepth) {
+        prog->maxDepth = prog->depth;
+    }
+    if (prog->maxDepth > EXPR_MAX_STACK) {
+        snprintf(prog->error, sizeof(prog->error), "formula nested too deeply");
+        return -1;
+    }
+    return 0;
+}
+
+int expr_parse_sum(ExprProgram *prog)
+{
+    if (expr_parse_product(prog) != 0) return -1;
+
+    while (1) {
+        while (*prog->text == ' ') prog->text++;
+        char c = *prog->text;
+        if (c != '+' && c != '-') return 0;
+        prog->text++;
+        if (expr_parse_product(prog) != 0) return -1;
+        if (expr_emit(prog, (c == '+') ? OP_ADD : OP_SUB, 0.0) != 0) return -1;
+    }
+}
+
+int expr_parse_product(ExprProgram *prog)
+{
+    if (expr_parse_unary(prog) != 0) return -1;
+
+    while (1) {
+        while (*prog->text == ' ') prog->text++;
+        char c = *prog->text;
+        if (c != '*' && c != '/') return 0;
+        prog->text++;
+        if (expr_parse_unary(prog) != 0) return -1;
+        if (expr_emit(prog, (c == '*') ? OP_MUL : OP_DIV, 0.0) != 0) return -1;
+    }
+}
+
+int expr_parse_unary(ExprProgram *prog)
+{
+    while (*prog->text == ' ') prog->text++;
+    if (*prog->text == '-') {
+        prog->text++;
+        if (expr_parse_unary(prog) != 0) return -1;
+        return expr_emit(prog, OP_NEG, 0.0);
+    }
+    if (*prog->text == '+') {
+        prog->text++;
+        return expr_parse_unary(prog);
+    }
+    return expr_parse_power(prog);
+}
+
+int expr_parse_power(ExprProgram *prog)
+{
+    if (expr_parse_primary(prog) != 0) return -1;
+
+    while (*prog->text == ' ') prog->text++;
+    if (*prog->text == '^') {
+        prog->text++;
+        if (expr_parse_unary(prog) != 0) return -1;   // right associative
+        return expr_emit(prog, OP_POW, 0.0);
+    }
+    return 0;
+}
+
+int expr_parse_primary(ExprProgram *prog)
+{
+    static const struct { const char *name; int op; int args; } FUNCS[] = {
+        {"abs", OP_ABS, 1}, {"sqrt", OP_SQRT, 1}, {"sin", OP_SIN, 1},
+        {"cos", OP_COS, 1}, {"tan", OP_TAN, 1},   {"exp", OP_EXP, 1},
+        {"log", OP_LOG, 1}, {"log10", OP_LOG10, 1},
+        {"min", OP_MIN, 2}, {"max", OP_MAX, 2}
+    };
+    const char *start;
+    char name[16];
+    size_t len;
+
+    while (*prog->text == ' ') prog->text++;
+    start = prog->text;
+
+    if (*start == '(') {
+        prog->text++;
+        if (expr_parse_sum(prog) != 0) return -1;
+        while (*prog->text == ' ') prog->text++;
+        if (*prog->text != ')') {
+            snprintf(prog->error, sizeof(prog->error), "missing ')'");
+            return -1;
+        }
+        prog->text++;
+        return 0;
+    }
+
+    if ((*start >= '0' && *start <= '9') || *start == '.') {
+        char *end;
+        double v = strtod(start, &end);
+        if (end == start) {
+            snprintf(prog->error, sizeof(prog->error), "bad number");
+            return -1;
+        }
+        prog->text = end;
+        return expr_emit(prog, OP_CONST, v);
+    }
+
+    len = 0;
+    while ((prog->text[0] >= 'a' && prog->text[0] <= 'z') ||
+           (prog->text[0] >= '0' && prog->text[0] <= '9' && len > 0)) {
+        if (len < sizeof(name) - 1) name[len++] = prog->text[0];
+        prog->text++;
+    }
+    name[len] = '\0';
+    if (len == 0) {
+        snprintf(prog->error, sizeof(prog->error), "expected a value at position %d",
+                 (int)(start - prog->source) + 1);
+        return -1;
+    }
+
+    while (*prog->text == ' ') prog->text++;
+
+    if (*prog->text == '(') {
+        for (size_t f = 0; f < sizeof(FUNCS) / sizeof(FUNCS[0]); f++) {
+            if (strcmp(name, FUNCS[f].name) != 0) continue;
+            prog->text++;
+            if (expr_parse_sum(prog) != 0) return -1;
+            if (FUNCS[f].args == 2) {
+                while (*prog->text == ' ') prog->text++;
+                if (*prog->text != ',') {
+                    snprintf(prog->error, sizeof(prog->error), "%s() needs two arguments", name);
+                    return -1;
+                }
+                prog->text++;
+                if (expr_parse_sum(prog) != 0) return -1;
+            }
+            while (*prog->text == ' ') prog->text++;
+            if (*prog->text != ')') {
+                snprintf(prog->error, sizeof(prog->error), "missing ')' after %s(", name);
+                return -1;
+            }
+            prog->text++;
+            return expr_emit(prog, FUNCS[f].op, 0.0);
+        }
+        snprintf(prog->error, sizeof(prog->error), "unknown function '%s'", name);
+        return -1;
+    }
+
+    if (strcmp(name, "x") == 0)    return expr_emit(prog, OP_X, 0.0);
+    if (strcmp(name, "i") == 0)    return expr_emit(prog, OP_INDEX, 0.0);
+    if (strcmp(name, "pi") == 0)   return expr_emit(prog, OP_CONST, M_PI);
+    if (strcmp(name, "n") == 0)    return expr_emit(prog, OP_CONST, prog->n);
+    if (strcmp(name, "mean") == 0) return expr_emit(prog, OP_CONST, prog->mean);
+    if (strcmp(name, "rms") == 0)  return expr_emit(prog, OP_CONST, prog->rms);
+    if (strcmp(name, "min") == 0)  return expr_emit(prog, OP_CONST, prog->min);
+    if (strcmp(name, "max") == 0)  return expr_emit(prog, OP_CONST, prog->max);
+
+    snprintf(prog->error, sizeof(prog->error), "unknown name '%s'", name);
+    return -1;
+}
+
+// run the program over in[0..n-1]; in and out may be the same buffer
+void expr_evaluate(const ExprProgram *prog, const double in[], double out[], int n)
+{
+    static double stack[EXPR_MAX_STACK][EXPR_BLOCK];
+
+    for (int base = 0; base < n; base += EXPR_BLOCK) {
+        int m = (n - base < EXPR_BLOCK) ? n - base : EXPR_BLOCK;
+        const double *x = &in[base];
+        int sp = 0;                         // values on the stack
+
+        for (int k = 0; k < prog->length; k++) {
+            const ExprInstr *ins = &prog->code[k];
+            int op = ins->op;
+
+            if (op <= OP_INDEX) {
+                double *r = stack[sp++];
+                if (op == OP_CONST) {
+                    for (int j = 0; j < m; j++) r[j] = ins->value;
+                } else if (op == OP_X) {
+                    for (int j = 0; j < m; j++) r[j] = x[j];
+                } else {
+                    for (int j = 0; j < m; j++) r[j] = base + j;
+                }
+                continue;
+            }
+
+            double *t = stack[sp - 1];
+            if (op <= OP_MAX && op != OP_NEG) {
+                double *u = stack[sp - 2];  // u = u (op) t
+                sp--;
+                switch (op) {
+                    case OP_ADD: for (int j = 0; j < m; j++) u[j] += t[j]; break;
+                    case OP_SUB: for (int j = 0; j < m; j++) u[j] -= t[j]; break;
+                    case OP_MUL: for (int j = 0; j < m; j++) u[j] *= t[j]; break;
+                    case OP_DIV: for (int j = 0; j < m; j++) u[j] /= t[j]; break;
+                    case OP_POW: for (int j = 0; j < m; j++) u[j] = pow(u[j], t[j]); break;
+                    case OP_MIN: for (int j = 0; j < m; j++) u[j] = (t[j] < u[j]) ? t[j] : u[j]; break;
+                    case OP_MAX: for (int j = 0; j < m; j++) u[j] = (t[j] > u[j]) ? t[j] : u[j]; break;
+                }
+                continue;
+            }
+
+            switch (op) {
+                case OP_NEG:   for (int j = 0; j < m; j++) t[j] = -t[j]; break;
+                case OP_ABS:   for (int j = 0; j < m; j++) t[j] = fabs(t[j]); break;
+                case OP_SQRT:  for (int j = 0; j < m; j++) t[j] = sqrt(t[j]); break;
+                case OP_SIN:   for (int j = 0; j < m; j++) t[j] = sin(t[j]); break;
+                case OP_COS:   for (int j = 0; j < m; j++) t[j] = cos(t[j]); break;
+                case OP_TAN:   for (int j = 0; j < m; j++) t[j] = tan(t[j]); break;
+                case OP_EXP:   for (int j = 0; j < m; j++) t[j] = exp(t[j]); break;
+                case OP_LOG:   for (int j = 0; j < m; j++) t[j] = log(t[j]); break;
+                case OP_LOG10: for (int j = 0; j < m; j++) t[j] = log10(t[j]); break;
+            }
+        }
+
+        for (int j = 0; j < m; j++) {
+            out[base + j] = stack[0][j];
+        }
+    }
+}
+
+// ========== Helper Functions (safe input) ==========
+
+void flush_input_buffer(void)
+{
+    int ch;
+    while ((ch = getchar()) != '\n' && ch != EOF) {
+        /* discard */
+    }
+}
+
+int is_integer_string(const char *s)
+{
+    if (s == NULL || *s == '\0') {
+        return 0;
+    }
+
+    const char *p = s;
 
     if (*p == '+' || *p == '-') {
         p++;
@@ -1390,3 +10547,31 @@ int safe_get_filename(const char *prompt, char *buf, size_t buf_sz)
         return 0;
     }
 }
+
+// like safe_get_filename, for short text such as unit names
+int safe_get_text(const char *prompt, char *buf, size_t buf_sz)
+{
+    if (buf == NULL || buf_sz == 0) return -1;
+
+    while (1) {
+        printf("%s", prompt);
+
+        if (!fgets(buf, (int)buf_sz, stdin)) {
+            flush_input_buffer();
+            return -1;
+        }
+
+        if (strchr(buf, '\n') == NULL) {
+            flush_input_buffer();
+        }
+
+        buf[strcspn(buf, "\n")] = '\0';
+
+        if (buf[0] == '\0') {
+            printf("Input cannot be empty. Please try again.\n");
+            continue;
+        }
+
+        return 0;
+    }
+}
@@ -15,16 +15,52 @@ echo "Checking for errors..."
 # Each input string is passed to the program's stdin
 inputs=(
   $'5\n100\nb\n6\n'
+  $'16\n1\n2\n5\nb\n0\n'
+  $'26\n2\nsqrt(x*x + 9)\n4\nb\n0\n'
+  $'12\n1000\n2\n3\nb\n33\n1\n100\n300\n0\nb\n0\n'
+  $'12\n1000\n2\n3\nb\n34\n1\n1000\n3\nb\n0\n'
+  $'12\n1000\n2\n3\nb\n36\n2\n50 75\n0\nb\n0\n'
+  $'12\n1000\n2\n3\nb\n39\n1\n50\n0\nb\n0\n'
+  $'12\n1000\n2\n3\nb\n26\n1\n1/x\nb\n9\n2\n5\nb\n3\nb\n0\n'
+  $'16\n1\n3\n2\nb\n0\n'
+  $'12\n1000\n2\n3\nb\n26\n1\nx*(1 + 1e8*max(0, min(1, 500-i)))\nb\n33\n1\n952\n1000\n0\nb\n0\n'
+  $'12\n1000\n2\n3\nb\n38\n1\n1000\n100\n100\n0\nb\n12\n5\n1\n1\nb\n42\n1\n/tmp/test_session.wfs\n2\n/tmp/test_session.wfs\n0\nb\n0\n'
+  $'12\n1000\n2\n3\nb\n26\n1\nx*(1 + 1e8*max(0, min(1, 500-i)))\nb\n38\n1\n1000\n40\n40\n0\nb\n0\n'
+  $'12\n1000\n2\n3\nb\n35\n1\n0\nb\n26\n1\nx*10\nb\n35\n3\n0\nb\n28\n1\n0\nb\n35\n3\n0\nb\n33\n1\n100\n300\n0\nb\n0\n'
 )
 
 # Expected patterns to search for in the program output (regex/ERE)
 # Example: 'Area of circle' or '^Area of circle' or 'Sum : [0-9]+'
 expected_patterns=(
   'Area of circle with radius'
+  '^ x1 = '
+  '^Enter x: Result'
+  'DC / RMS'
+  '^ +3\.000 '
+  '^P75 '
+  '^Largest p2p'
+  '^Minimum value'
+  '^ x1 = '
+  'DC / RMS'
+  '^  envelope  :'
+  '^RMS envelope'
+  'DC / RMS'
 )
 
 expected=(
   'Area of circle with radius 100.00 = 31415.90'
+  ' x1 = -1.000000 + 2.000000i'
+  'Enter x: Result: 5.000000'
+  'DC / RMS          : -0.5854 / 1.4498'
+  '       3.000       2.0000       1.4142   100.00%    -90.00°'
+  'P75               : 1.41421'
+  'Largest p2p       : 1.7823 (window ending at sample 191)'
+  'Minimum value     : -26.5274'
+  ' x1 = -1.000000'
+  'DC / RMS          : -0.8611 / 0.9757'
+  '  envelope  : 10 windows (stale)'
+  'RMS envelope      : 0.4999 to 195078852.4122'
+  'DC / RMS          : -0.5854 / 1.4498'
 )
 
 